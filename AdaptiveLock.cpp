@@ -0,0 +1,90 @@
+#include "AdaptiveLock.h"
+#include <chrono>
+
+#if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
+#include <Windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Odin
+{
+	// Number of times a contended lock is polled before sleeping
+	const uint32 kLockSpinCount = 128;
+
+	//--------------------------------------------------------------------------------------------------------------
+	// Tell the processor this is a spin-wait loop
+	static FORCEINLINE void spinPause()
+	{
+#if ODIN_COMPILER == ODIN_COMPILER_MSVC
+		YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void AdaptiveLock::lockContended()
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		// The holder usually leaves soon, poll the state for a while without writing to it
+		bool acquired = false;
+		for (uint32 i = 0; i < kLockSpinCount && !acquired; ++i)
+		{
+			spinPause();
+			uint32 state = mState.load(std::memory_order_relaxed);
+			if (state == kUnlocked)
+				acquired = mState.compare_exchange_weak(state, kLocked, std::memory_order_acquire, std::memory_order_relaxed);
+		}
+
+		// Announce a waiter and sleep until the lock is handed over. A lock taken this way
+		// stays marked with waiters, which costs the holder one spurious wake at most.
+		if (!acquired)
+		{
+			while (mState.exchange(kLockedWithWaiters, std::memory_order_acquire) != kUnlocked)
+				wait();
+		}
+
+		uint64 wait_ns = static_cast<uint64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count());
+		mContended.store(mContended.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		mWaitNs.store(mWaitNs.load(std::memory_order_relaxed) + wait_ns, std::memory_order_relaxed);
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void AdaptiveLock::wait()
+	{
+#if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
+		uint32 compare = kLockedWithWaiters;
+		WaitOnAddress(&mState, &compare, sizeof(compare), INFINITE);
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+		// Returns right away if the state changed since the exchange
+		syscall(SYS_futex, reinterpret_cast<uint32*>(&mState), FUTEX_WAIT_PRIVATE, kLockedWithWaiters, nullptr, nullptr, 0);
+#endif
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void AdaptiveLock::wake()
+	{
+#if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
+		WakeByAddressSingle(&mState);
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+		syscall(SYS_futex, reinterpret_cast<uint32*>(&mState), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void AdaptiveLock::getStats(LockStats& stats) const
+	{
+		stats.acquisitions = mAcquisitions.load(std::memory_order_relaxed);
+		stats.contended = mContended.load(std::memory_order_relaxed);
+		stats.wait_ns = mWaitNs.load(std::memory_order_relaxed);
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void AdaptiveLock::resetStats()
+	{
+		mAcquisitions.store(0, std::memory_order_relaxed);
+		mContended.store(0, std::memory_order_relaxed);
+		mWaitNs.store(0, std::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,78 @@
+#ifndef _ADAPTIVE_LOCK_H_
+#define _ADAPTIVE_LOCK_H_
+
+#include "DataTypes.h"
+#include <atomic>
+
+namespace Odin
+{
+	// Contention counters of a lock
+	struct LockStats
+	{
+		uint64 acquisitions;			// Number of times the lock was taken
+		uint64 contended;				// Acquisitions which found the lock held
+		uint64 wait_ns;					// Nanoseconds spent waiting in contended acquisitions
+	};
+
+	/*
+		Mutex which spins for a short while when it finds the lock held and then sleeps in the
+		kernel (futex on Linux, WaitOnAddress on Windows) until the holder wakes it up. An
+		uncontended lock and unlock are a CAS and an exchange. The counters are updated by
+		the holder, so they cost no atomic read-modify-write. It satisfies Lockable, so it can
+		be used with std::lock_guard.
+	*/
+	class AdaptiveLock
+	{
+	public:
+		AdaptiveLock() : mState(kUnlocked), mAcquisitions(0), mContended(0), mWaitNs(0) {}
+
+		void lock()
+		{
+			uint32 state = kUnlocked;
+			if (!mState.compare_exchange_strong(state, kLocked, std::memory_order_acquire, std::memory_order_relaxed))
+				lockContended();
+			mAcquisitions.store(mAcquisitions.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+
+		bool try_lock()
+		{
+			uint32 state = kUnlocked;
+			if (!mState.compare_exchange_strong(state, kLocked, std::memory_order_acquire, std::memory_order_relaxed))
+				return false;
+			mAcquisitions.store(mAcquisitions.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return true;
+		}
+
+		void unlock()
+		{
+			if (mState.exchange(kUnlocked, std::memory_order_release) == kLockedWithWaiters)
+				wake();
+		}
+
+		// Read the counters. They may be slightly behind if the lock is in use.
+		void getStats(LockStats& stats) const;
+
+		// Reset the counters to zero. Should be called while holding the lock.
+		void resetStats();
+	private:
+		static const uint32 kUnlocked = 0;
+		static const uint32 kLocked = 1;
+		static const uint32 kLockedWithWaiters = 2;
+
+		AdaptiveLock(const AdaptiveLock&) = delete;
+		AdaptiveLock& operator=(const AdaptiveLock&) = delete;
+
+		// Spin, then sleep until the lock is acquired
+		void lockContended();
+		// Sleep while the state is kLockedWithWaiters
+		void wait();
+		// Wake one sleeping thread
+		void wake();
+
+		std::atomic<uint32> mState;
+		std::atomic<uint64> mAcquisitions;
+		std::atomic<uint64> mContended;
+		std::atomic<uint64> mWaitNs;
+	};
+}
+#endif	// _ADAPTIVE_LOCK_H_
@@ -2,7 +2,9 @@
 #define _ALLOCATOR_H_
 
 #include <new>
+#include <cstring>
 #include "DataTypes.h"
+#include "MemoryBudget.h"
 
 // Just hardcode this for now to 4kB
 #define PAGE_SIZE	65536
@@ -14,9 +16,16 @@ namespace Odin
 	public:
 		static const uint32 kDefaultAlignment = 8;
 
-		Allocator() {}
+		Allocator() : mBudget(nullptr) {}
 		virtual ~Allocator() {}
 
+		// Charge the memory this allocator gets from the system to budget, which may be shared
+		// with other allocators. Allocations which would go over its hard limit fail. Should be
+		// called before init, the budget has to outlive the allocator.
+		void setBudget(MemoryBudget* budget) { mBudget = budget; }
+		// Return the budget of this allocator, NULL if it has none
+		MemoryBudget* getBudget() const { return mBudget; }
+
 		// Initialize the allocator
 		virtual bool init() = 0;
 		// Allocate the specified amount of memory aligned to the specified alignment
@@ -27,10 +36,31 @@ namespace Odin
 			const char* file_name = 0, uint32 line = 0, const char* func_name = 0) = 0;
 		// Free an allocation previously made with allocate
 		virtual void deallocate(void* ptr) = 0;
+		// Resize an allocation previously made with allocate, preserving its contents up to the
+		// smaller of the two sizes. Behaves like allocate if ptr is NULL. Returns NULL and leaves
+		// ptr untouched on failure. Allocators which can resize in place override this.
+		virtual void* reallocate(void* ptr, size_t size, size_t alignment,
+			const char* file_name = 0, uint32 line = 0, const char* func_name = 0)
+		{
+			void* new_ptr = allocate(size, alignment, 0, file_name, line, func_name);
+			if (new_ptr != nullptr && ptr != nullptr)
+			{
+				size_t old_size = getAllocSize(ptr);
+				memcpy(new_ptr, ptr, (old_size < size) ? old_size : size);
+				deallocate(ptr);
+			}
+			return new_ptr;
+		}
 		// Return the amount of usable memory allocated at ptr
 		virtual size_t getAllocSize(void* ptr) = 0;
 		// Return the total amount of memory allocated by this allocator
 		virtual size_t getTotalAllocated() = 0;
+		// Return the free memory cached by this allocator to the system, e.g. on memory pressure.
+		// Returns the number of bytes released.
+		virtual size_t purge() { return 0; }
+	protected:
+		// Budget charged for the memory of this allocator, if any
+		MemoryBudget* mBudget;
 	};
 
 	// Call destructor and free the allocated memory
@@ -47,17 +77,20 @@ namespace Odin
 	template <typename T, class allocator>
 	T* NewArray(allocator* alloc, size_t N, const char* file_name, uint32 line, const char* func_name)//, NonPODType)
 	{
-		void* ptr = arena->allocate(sizeof(T) * N + sizeof(size_t), Allocator::kDefaultAlignment, 0,
+		void* ptr = alloc->allocate(sizeof(T) * N + sizeof(size_t), Allocator::kDefaultAlignment, 0,
 			file_name, line, func_name);
+		if (ptr == nullptr)
+			return nullptr;
 		// Store number of instances in first size_t bytes
-		*(reinterpret_cast<size_t*>(ptr))++ = N;
+		size_t* count = reinterpret_cast<size_t*>(ptr);
+		*count++ = N;
 		// Construct instances using placement new
-		const T* const one_past_last = reinterpret_cast<size_t*>(ptr) + N;
-		T* tptr = reinterpret_cast<T*>(ptr);
-		while (tptr < one_past_last)
-			new (tptr++) T;
+		T* const first = reinterpret_cast<T*>(count);
+		T* const one_past_last = first + N;
+		for (T* tptr = first; tptr < one_past_last; ++tptr)
+			new (tptr) T;
 		// Return the pointer to the first instance
-		return (tptr - N);
+		return first;
 	}
 	// Overload for POD type
 	/*template <typename T, class allocator>
@@ -142,7 +175,7 @@ namespace Odin
 	// Instantiate an array of objects 
 	// ODIN_NEW_ARRAY(type, count, allocator) for run time count
 	// ODIN_NEW_ARRAY(type[count], allocator) for compile time count
-#define ODIN_NEW_ARRAY(...)	ODIN_JOIN(NEW_ARRAY_, NARG(__VA_ARGS__))EXPAND((__VA_ARGS__))
+#define ODIN_NEW_ARRAY(...)	EXPAND(ODIN_JOIN(NEW_ARRAY_, NARG(__VA_ARGS__))(__VA_ARGS__))
 	// Delete an object
 #define ODIN_DELETE(object, allocator)	Delete(object, allocator)
 	// Delete an array of objects
@@ -0,0 +1,351 @@
+#include "GeneralAllocator.h"
+#include "MemAlloc.h"
+#include "MemoryBudget.h"
+#include "SlabAlloc.h"
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+/*
+	Test driver for the general purpose allocator: boundary tag coalescing on free and realloc,
+	the pages decommitted inside free chunks and recommitted by later allocations, the lock-free
+	queues of cross-thread frees, batches carved out of dv and top and the footprint of many
+	mid-sized allocations. "make test" builds and runs it on Linux. Every failed check is
+	printed, and the exit code is non-zero if any failed.
+*/
+
+using namespace Odin;
+
+static int sFailures = 0;
+
+#define TEST_CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			++sFailures; \
+		} \
+	} while (0)
+
+//------------------------------------------------------------------------------------------
+// Return true if every byte of mem is value
+static bool holds(void* mem, size_t bytes, uint8 value)
+{
+	uint8* ptr = static_cast<uint8*>(mem);
+	for (size_t i = 0; i < bytes; ++i)
+	{
+		if (ptr[i] != value)
+			return false;
+	}
+	return true;
+}
+//------------------------------------------------------------------------------------------
+// Return true if the PINUSE bit is set in the head of the chunk of mem and in the head of the
+// chunk after it, i.e. the chunk and its predecessor are both seen as in use
+static bool pinuseAround(void* mem)
+{
+	size_t head = reinterpret_cast<size_t*>(mem)[-1];
+	size_t next_head = *reinterpret_cast<size_t*>(static_cast<uint8*>(mem) + (head & ~size_t(7)) - sizeof(size_t));
+	return (head & 1) != 0 && (next_head & 1) != 0;
+}
+//------------------------------------------------------------------------------------------
+// MemorySpace with 4KB pages, growing 1MB at a time. Requests above 8MB go to the system.
+static MemorySpace* createTestSpace()
+{
+	return createMemorySpace(1048576, 4096, 1048576, 8388608);
+}
+//------------------------------------------------------------------------------------------
+static void testCoalescing()
+{
+	MemorySpace* msp = createTestSpace();
+	size_t base_in_use = getInuseBytes(msp);
+
+	// Neighbours freed in any order merge into one chunk, which serves a request as large as
+	// all three of them
+	uint8* a = static_cast<uint8*>(alloc(msp, 1000));
+	uint8* b = static_cast<uint8*>(alloc(msp, 1000));
+	uint8* c = static_cast<uint8*>(alloc(msp, 1000));
+	uint8* guard = static_cast<uint8*>(alloc(msp, 1000));
+	TEST_CHECK(a != nullptr && a < b && b < c && c < guard);
+	free(msp, a);
+	free(msp, c);
+	free(msp, b);
+	uint8* merged = static_cast<uint8*>(alloc(msp, 3000));
+	TEST_CHECK(merged == a);
+	free(msp, merged);
+
+	// realloc grows into a free neighbour and shrinks in place, the tail it gives back merges
+	// with the free chunk after it
+	uint8* x = static_cast<uint8*>(alloc(msp, 1000));
+	uint8* y = static_cast<uint8*>(alloc(msp, 1000));
+	uint8* guard2 = static_cast<uint8*>(alloc(msp, 1000));
+	memset(x, 1, 1000);
+	free(msp, y);
+	TEST_CHECK(realloc(msp, x, 1900) == x);
+	TEST_CHECK(holds(x, 1000, 1));
+	TEST_CHECK(realloc(msp, x, 100) == x);
+	TEST_CHECK(holds(x, 100, 1));
+	uint8* tail = static_cast<uint8*>(alloc(msp, 1800));
+	TEST_CHECK(tail > x && tail < guard2);
+	free(msp, tail);
+	free(msp, x);
+	free(msp, guard2);
+
+	// Everything merged back into top
+	free(msp, guard);
+	validateMemorySpace(msp);
+	TEST_CHECK(getInuseBytes(msp) == base_in_use);
+	destroyMemoryRegion(msp);
+}
+//------------------------------------------------------------------------------------------
+static void testRecommit()
+{
+	MemorySpace* msp = createTestSpace();
+	setTrimThreshold(msp, 65536);
+
+	// A free chunk beyond the trim threshold gives back the whole pages inside it right away
+	const size_t kBigSize = 524288;
+	uint8* big = static_cast<uint8*>(alloc(msp, kBigSize));
+	uint8* guard = static_cast<uint8*>(alloc(msp, 1000));
+	TEST_CHECK(big != nullptr && guard != nullptr);
+	memset(big, 7, kBigSize);
+	free(msp, big);
+	size_t decommitted = getDecommittedBytes(msp);
+	TEST_CHECK(decommitted >= kBigSize - 2 * 4096);
+
+	// An allocation split off it recommits the pages it lands on, and only those
+	uint8* part = static_cast<uint8*>(alloc(msp, kBigSize / 2));
+	TEST_CHECK(part == big);
+	memset(part, 9, kBigSize / 2);
+	TEST_CHECK(holds(part, kBigSize / 2, 9));
+	TEST_CHECK(getDecommittedBytes(msp) < decommitted);
+	TEST_CHECK(getDecommittedBytes(msp) >= decommitted - kBigSize / 2 - 2 * 4096);
+	validateMemorySpace(msp);
+
+	// purge decommits it again, and the whole chunk can be used afterwards
+	free(msp, part);
+	purge(msp);
+	TEST_CHECK(getDecommittedBytes(msp) >= kBigSize - 2 * 4096);
+	big = static_cast<uint8*>(alloc(msp, kBigSize));
+	TEST_CHECK(big != nullptr);
+	memset(big, 3, kBigSize);
+	TEST_CHECK(holds(big, kBigSize, 3));
+	validateMemorySpace(msp);
+	free(msp, big);
+	free(msp, guard);
+	destroyMemoryRegion(msp);
+}
+//------------------------------------------------------------------------------------------
+static void testRemoteFrees()
+{
+	const uint32 kThreads = 4;
+	const uint32 kBlocksPerThread = 1000;
+
+	// Chunks of a MemorySpace freed by other threads are queued, and applied by the owner
+	MemorySpace* msp = createTestSpace();
+	size_t base_in_use = getInuseBytes(msp);
+	std::vector<void*> chunks(kThreads * kBlocksPerThread);
+	for (size_t i = 0; i < chunks.size(); ++i)
+		chunks[i] = alloc(msp, 64 + (i % 50) * 40);
+	size_t footprint = getTotalReservedMemory(msp);
+	std::vector<std::thread> threads;
+	for (uint32 t = 0; t < kThreads; ++t)
+	{
+		threads.emplace_back([msp, &chunks, t]()
+		{
+			for (uint32 i = 0; i < kBlocksPerThread; ++i)
+				freeRemote(msp, chunks[t * kBlocksPerThread + i]);
+		});
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+	threads.clear();
+	TEST_CHECK(getInuseBytes(msp) == base_in_use);
+	// The space is reused rather than grown
+	for (size_t i = 0; i < chunks.size(); ++i)
+		chunks[i] = alloc(msp, 64 + (i % 50) * 40);
+	TEST_CHECK(getTotalReservedMemory(msp) == footprint);
+	for (size_t i = 0; i < chunks.size(); ++i)
+		free(msp, chunks[i]);
+	validateMemorySpace(msp);
+	destroyMemoryRegion(msp);
+
+	// Slab objects are queued in batches
+	SlabSpace ssp;
+	initSlabSpace(&ssp, 64);
+	std::vector<void*> objects(kThreads * kBlocksPerThread);
+	TEST_CHECK(slabAllocBatch(&ssp, objects.size(), objects.data()) == objects.size());
+	for (uint32 t = 0; t < kThreads; ++t)
+	{
+		threads.emplace_back([&ssp, &objects, t]()
+		{
+			for (uint32 i = 0; i < kBlocksPerThread; i += 16)
+			{
+				uint32 count = (kBlocksPerThread - i < 16) ? kBlocksPerThread - i : 16;
+				slabFreeRemote(&ssp, &objects[t * kBlocksPerThread + i], count);
+			}
+		});
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+	threads.clear();
+	TEST_CHECK(getSlabInuseBytes(&ssp) == 0);
+	destroySlabSpace(&ssp);
+
+	// Blocks of the general allocator freed on other threads than the one which allocated them
+	GeneralAllocator general(65536, 65536, 33554432, 8388608, false, 0);
+	TEST_CHECK(general.init());
+	std::vector<void*> blocks(kThreads * kBlocksPerThread);
+	for (size_t i = 0; i < blocks.size(); ++i)
+	{
+		size_t size = 16 + (i * 37) % 4000;
+		blocks[i] = general.allocate(size, 8, 0);
+		memset(blocks[i], 5, size);
+	}
+	for (uint32 t = 0; t < kThreads; ++t)
+	{
+		threads.emplace_back([&general, &blocks, t]()
+		{
+			for (uint32 i = 0; i < kBlocksPerThread; ++i)
+				general.deallocate(blocks[t * kBlocksPerThread + i]);
+		});
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+	// The exiting threads drained their caches, only this thread's cache holds blocks
+	general.flushThreadCache();
+	size_t in_use = 0;
+	for (uint32 shard = 0; shard < general.getNumShards(); ++shard)
+	{
+		GeneralAllocator::ShardStats stats;
+		general.getShardStats(shard, stats);
+		in_use += stats.in_use;
+	}
+	TEST_CHECK(in_use == 0);
+}
+//------------------------------------------------------------------------------------------
+static void testBatches()
+{
+	const size_t kMaxBatch = 64;
+	void* batch[kMaxBatch];
+
+	// A run carved out of dv writes every head. Zeroed user data of a freed chunk lies where
+	// the heads of the run go, and the chunk that takes the remainder of dv is not the first.
+	MemorySpace* msp = createTestSpace();
+	size_t base_in_use = getInuseBytes(msp);
+	void* region = alloc(msp, 1000);
+	void* guard = alloc(msp, 1000);
+	size_t region_size = getChunkSize(region);
+	memset(region, 0, 1000);
+	free(msp, region);
+	// Taken from the front of the free chunk, the rest of it becomes dv
+	void* first = alloc(msp, 100);
+	TEST_CHECK(first == region);
+	size_t chunk_size = getChunkSize(first);
+	size_t count = (region_size - chunk_size) / chunk_size;
+	TEST_CHECK(count > 1 && (region_size - chunk_size) % chunk_size < 32);
+	TEST_CHECK(allocBatch(msp, 100, count, batch) == count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		TEST_CHECK(batch[i] == static_cast<uint8*>(first) + (i + 1) * chunk_size);
+		TEST_CHECK(pinuseAround(batch[i]));
+	}
+	for (size_t i = 0; i < count / 2; ++i)
+	{
+		void* swap = batch[i];
+		batch[i] = batch[count - 1 - i];
+		batch[count - 1 - i] = swap;
+	}
+	freeBatch(msp, batch, count);
+	free(msp, first);
+	free(msp, guard);
+	validateMemorySpace(msp);
+	TEST_CHECK(getInuseBytes(msp) == base_in_use);
+
+	// Aligned allocations leave their split off chunks behind, runs are carved around them
+	for (size_t size = 257; size <= 600; size += 7)
+	{
+		void* aligned = allocAligned(msp, 256, size, 0);
+		TEST_CHECK(aligned != nullptr);
+		memset(aligned, 0, size);
+		size_t num = 2 + size % 15;
+		TEST_CHECK(allocBatch(msp, size, num, batch) == num);
+		for (size_t i = 0; i < num; ++i)
+		{
+			TEST_CHECK(pinuseAround(batch[i]));
+			memset(batch[i], 0, size);
+		}
+		free(msp, aligned);
+		for (size_t i = num; i-- > 0;)
+			free(msp, batch[i]);
+	}
+	validateMemorySpace(msp);
+	TEST_CHECK(getInuseBytes(msp) == base_in_use);
+	destroyMemoryRegion(msp);
+
+	// Blocks above the largest slab class come from the dlmalloc instance of the general allocator
+	GeneralAllocator general(65536, 65536, 33554432, 8388608);
+	TEST_CHECK(general.init());
+	for (size_t size = 257; size <= 4000; size += 37)
+	{
+		size_t num = 1 + size % kMaxBatch;
+		TEST_CHECK(general.allocateBatch(size, 8, num, batch) == num);
+		for (size_t i = 0; i < num; ++i)
+			memset(batch[i], 6, size);
+		for (size_t i = 0; i < num; ++i)
+			TEST_CHECK(holds(batch[i], size, 6));
+		general.deallocateBatch(batch, num);
+	}
+	general.flushThreadCache();
+	size_t in_use = 0;
+	for (uint32 shard = 0; shard < general.getNumShards(); ++shard)
+	{
+		GeneralAllocator::ShardStats stats;
+		general.getShardStats(shard, stats);
+		in_use += stats.in_use;
+	}
+	TEST_CHECK(in_use == 0);
+}
+//------------------------------------------------------------------------------------------
+static void testFootprint()
+{
+	// Mid-sized allocations live in the dlmalloc instance, whose segments grow or are added
+	// as needed. The committed memory stays close to the bytes allocated.
+	const size_t kBlockSize = 2000;
+	const size_t kNumBlocks = 20000;
+	MemoryBudget budget;
+	GeneralAllocator general(65536, 65536, 33554432, 8388608);
+	general.setBudget(&budget);
+	TEST_CHECK(general.init());
+	std::vector<void*> blocks(kNumBlocks);
+	for (size_t i = 0; i < kNumBlocks; ++i)
+	{
+		blocks[i] = general.allocate(kBlockSize, 8, 0);
+		TEST_CHECK(blocks[i] != nullptr);
+		memset(blocks[i], 1, kBlockSize);
+	}
+	size_t live = kBlockSize * kNumBlocks;
+	TEST_CHECK(budget.getUsage() < live + live / 4);
+	for (size_t i = 0; i < kNumBlocks; ++i)
+		general.deallocate(blocks[i]);
+	general.purge();
+	TEST_CHECK(budget.getUsage() < 1048576);
+}
+//------------------------------------------------------------------------------------------
+int main()
+{
+	testCoalescing();
+	testRecommit();
+	testRemoteFrees();
+	testBatches();
+	testFootprint();
+	if (sFailures != 0)
+	{
+		printf("%d checks failed\n", sFailures);
+		return 1;
+	}
+	printf("All tests passed\n");
+	return 0;
+}
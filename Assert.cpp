@@ -4,6 +4,11 @@
 #include <cstdlib>
 #include "Assert.h"
 
+#if ODIN_COMPILER != ODIN_COMPILER_MSVC
+#define sscanf_s sscanf
+#define vsnprintf_s vsnprintf
+#endif
+
 namespace Odin
 {
 	bool _ignoreAll = false;
@@ -27,6 +27,8 @@ namespace Odin
 
 #if ODIN_COMPILER == ODIN_COMPILER_MSVC
 #define ODIN_DEBUG_BREAK __debugbreak()
+#elif ODIN_COMPILER == ODIN_COMPILER_GCC
+#define ODIN_DEBUG_BREAK __builtin_trap()
 #else
 #define ODIN_DEBUG_BREAK asm {int 3}
 #endif
@@ -59,8 +61,11 @@ namespace Odin
 			if (_ignore || ignoreAllAsserts()); \
 						else\
 					{\
-				if (handleAssert(__FILE__, __LINE__, __func__, #expression, level, _ignore, __VA_ARGS__) == AssertAction::ASSERT_ACTION_BREAK)\
-					ODIN_DEBUG_BREAK; \
+				if(!(expression)) \
+				{\
+					if (handleAssert(__FILE__, __LINE__, __func__, #expression, level, _ignore, __VA_ARGS__) == AssertAction::ASSERT_ACTION_BREAK)\
+						ODIN_DEBUG_BREAK; \
+				}\
 					}\
 				}while (false)
 
@@ -0,0 +1,189 @@
+#ifndef _BASIC_LINEAR_ALLOCATOR_H_
+#define _BASIC_LINEAR_ALLOCATOR_H_
+
+#include "DataTypes.h"
+#include "CompileOptions.h"
+#include "Assert.h"
+#include "Allocator.h"
+#include "GrowthPolicy.h"
+#include "SizeTrackingPolicy.h"
+
+namespace Odin
+{
+	/*
+		Linear allocator configured at compile time. SizeTrackingPolicy decides whether the size
+		of every allocation is stored in front of it (SizeHeaderTracking) or nothing is stored at
+		all (NoSizeTracking), Alignment is the alignment of every allocation and GrowthPolicy
+		provides the memory space (FixedGrowth or VirtualGrowth). The bump pointer always stays
+		aligned to Alignment, so allocate(size) with a constant size and no size tracking comes
+		down to an add and a compare. Allocations needing a larger alignment or an offset go
+		through the Allocator interface.
+		BasicLinearAllocator<SizeHeaderTracking, Allocator::kDefaultAlignment, FixedGrowth>
+		behaves like a fixed size LinearAllocator.
+	*/
+	template <class SizeTrackingPolicy, size_t Alignment, class GrowthPolicy>
+	class BasicLinearAllocator : public Allocator
+	{
+		static_assert(Alignment != 0 && (Alignment & (Alignment - 1)) == 0, "Alignment is not a power of 2");
+	public:
+		// Bytes in front of every allocation, keeping the allocations aligned
+		static const size_t kHeaderSize = (SizeTrackingPolicy::kHeaderSize + (Alignment - 1)) & ~(Alignment - 1);
+
+		explicit BasicLinearAllocator(const GrowthPolicy& growth) : mGrowth(growth), mStart(nullptr),
+			mCurrent(nullptr), mEnd(nullptr)
+		{
+		}
+		virtual ~BasicLinearAllocator()
+		{
+			ASSERT_ERROR(getTotalAllocated() == 0, "Linear allocator has memory leaks");
+			mGrowth.release(mBudget);
+			mStart = mCurrent = mEnd = nullptr;
+		}
+
+		// Initialize the allocator
+		virtual bool init()
+		{
+			bool success = mGrowth.init(mBudget, mStart, mEnd);
+			if (mBudget != nullptr)
+				mBudget->dispatch();
+			if (!success)
+				return false;
+			mCurrent = mStart;
+			return true;
+		}
+
+		// Allocate size bytes aligned to Alignment
+		FORCEINLINE void* allocate(size_t size)
+		{
+			size_t total_size = kHeaderSize + ((size + (Alignment - 1)) & ~(Alignment - 1));
+			if (total_size > static_cast<size_t>(mEnd - mCurrent) || total_size < size)
+				return allocateSlow(size);
+			uint8* ptr = mCurrent + kHeaderSize;
+			mCurrent += total_size;
+			SizeTrackingPolicy::store(ptr, size);
+			return ptr;
+		}
+
+		// Allocate memory aligned to alignment with offset bytes in front of the aligned address
+		virtual void* allocate(size_t size, size_t alignment, size_t offset,
+			const char* file_name = 0, uint32 line = 0, const char* func_name = 0)
+		{
+			// Make sure the alignment is a power of 2
+			ASSERT_ERROR(((alignment & (alignment - 1)) == 0), "Alignment is not a power of 2");
+			if (alignment <= Alignment && offset == 0)
+				return allocate(size);
+			return allocateAligned(size, alignment, offset);
+		}
+
+		// Allocate a continuous array of fixed sized elements, cleared to zero
+		virtual void* callocate(size_t num_elements, size_t elem_size,
+			const char* file_name = 0, uint32 line = 0, const char* func_name = 0)
+		{
+			size_t size = num_elements * elem_size;
+			if (elem_size != 0 && size / elem_size != num_elements)
+				return nullptr;
+			void* mem = allocate(size);
+			// Memory reused after a reset holds the data of the previous allocations
+			if (mem != nullptr)
+				memset(mem, 0, size);
+			return mem;
+		}
+
+		// Function to free memory
+		virtual void deallocate(void* mem)
+		{
+			// This function is empty
+		}
+
+		// Resize an allocation by copying it. Needs the size of the allocation, so it isn't
+		// available without size tracking.
+		virtual void* reallocate(void* ptr, size_t size, size_t alignment,
+			const char* file_name = 0, uint32 line = 0, const char* func_name = 0)
+		{
+			ASSERT_ERROR(SizeTrackingPolicy::kHeaderSize != 0 || ptr == nullptr,
+				"Linear allocator without size tracking can't reallocate");
+			return Allocator::reallocate(ptr, size, alignment, file_name, line, func_name);
+		}
+
+		// Return the amount of usable memory allocated at ptr, 0 without size tracking
+		virtual size_t getAllocSize(void* mem)
+		{
+			return SizeTrackingPolicy::load(mem);
+		}
+
+		// Return the total amount of memory allocated by this allocator
+		virtual size_t getTotalAllocated()
+		{
+			return mCurrent - mStart;
+		}
+
+		// Return the committed pages above the current allocation to the system
+		virtual size_t purge()
+		{
+			return mGrowth.purge(mBudget, mCurrent, mEnd);
+		}
+
+		// Function to clear all the allocated memory
+		void reset(void)
+		{
+			mGrowth.reset(mBudget, mCurrent, mEnd);
+			mCurrent = mStart;
+		}
+	private:
+		BasicLinearAllocator(const BasicLinearAllocator&) = delete;
+		BasicLinearAllocator& operator=(const BasicLinearAllocator&) = delete;
+
+		// Grow the memory space for an allocation of size bytes which doesn't fit
+		void* allocateSlow(size_t size)
+		{
+			size_t total_size = kHeaderSize + ((size + (Alignment - 1)) & ~(Alignment - 1));
+			if (total_size < size || mStart == nullptr ||
+				total_size > static_cast<size_t>(-1) - reinterpret_cast<size_t>(mCurrent))
+				return nullptr;
+			bool grown = mGrowth.grow(mBudget, mCurrent + total_size, mEnd);
+			if (mBudget != nullptr)
+				mBudget->dispatch();
+			if (!grown)
+				return nullptr;
+			uint8* ptr = mCurrent + kHeaderSize;
+			mCurrent += total_size;
+			SizeTrackingPolicy::store(ptr, size);
+			return ptr;
+		}
+
+		// Allocate with an alignment larger than Alignment or an offset, then realign the bump
+		// pointer to Alignment
+		void* allocateAligned(size_t size, size_t alignment, size_t offset)
+		{
+			// The header goes in front of the offset bytes
+			offset += SizeTrackingPolicy::kHeaderSize;
+			size_t address = reinterpret_cast<size_t>(mCurrent) + offset;
+			address = ((address + (alignment - 1)) & ~(alignment - 1)) - offset;
+			size_t end = address + SizeTrackingPolicy::kHeaderSize + size;
+			end = (end + (Alignment - 1)) & ~(Alignment - 1);
+			if (mStart == nullptr || end < address || end - address < size)
+				return nullptr;
+			if (end > reinterpret_cast<size_t>(mEnd))
+			{
+				bool grown = mGrowth.grow(mBudget, reinterpret_cast<uint8*>(end), mEnd);
+				if (mBudget != nullptr)
+					mBudget->dispatch();
+				if (!grown)
+					return nullptr;
+			}
+			uint8* ptr = reinterpret_cast<uint8*>(address) + SizeTrackingPolicy::kHeaderSize;
+			mCurrent = reinterpret_cast<uint8*>(end);
+			SizeTrackingPolicy::store(ptr, size);
+			return ptr;
+		}
+
+		GrowthPolicy mGrowth;
+		// The memory space, the current position in it and the end of the part allocations
+		// can be made from without growing
+		uint8* mStart;
+		uint8* mCurrent;
+		uint8* mEnd;
+	};
+}
+
+#endif	// _BASIC_LINEAR_ALLOCATOR_H_
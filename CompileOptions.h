@@ -5,19 +5,26 @@ namespace Odin
 {
 	// List platforms
 #define ODIN_PLATFORM_WIN32 1
+#define ODIN_PLATFORM_LINUX 2
 
 	// List of compilers
 #define ODIN_COMPILER_MSVC 1
+#define ODIN_COMPILER_GCC 2
 
 	// Find the current platform
 #if defined(_WIN32)
 #define ODIN_PLATFORM ODIN_PLATFORM_WIN32
+#elif defined(__linux__)
+#define ODIN_PLATFORM ODIN_PLATFORM_LINUX
 #endif
 
-	// Find the compiler and its version
+	// Find the compiler and its version (clang is treated as gcc)
 #if defined( _MSC_VER )
 #define ODIN_COMPILER ODIN_COMPILER_MSVC
 #define ODIN_COMPILER_VER _MSC_VER
+#elif defined( __GNUC__ )
+#define ODIN_COMPILER ODIN_COMPILER_GCC
+#define ODIN_COMPILER_VER __GNUC__
 #endif
 
 	// Find the current compiler
@@ -32,6 +39,8 @@ namespace Odin
 #	if ODIN_COMPILER_VER >= 1200
 #		define FORCEINLINE __forceinline
 #	endif
+#elif ODIN_COMPILER == ODIN_COMPILER_GCC
+#	define FORCEINLINE inline __attribute__((always_inline))
 #endif
 
 	// See if in debug mode
@@ -39,6 +48,10 @@ namespace Odin
 #	ifdef _DEBUG
 #		define ODIN_DEBUG 1
 #	endif
+#elif ODIN_COMPILER == ODIN_COMPILER_GCC
+#	ifndef NDEBUG
+#		define ODIN_DEBUG 1
+#	endif
 #endif
 }
 
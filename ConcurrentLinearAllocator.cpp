@@ -0,0 +1,190 @@
+#include "ConcurrentLinearAllocator.h"
+
+namespace Odin
+{
+	//------------------------------------------------------------------------------------------
+	// Get the offset from base at which an allocation with a header of offset bytes starts, so
+	// that the address past the header is aligned
+	static inline size_t alignOffset(uint8* base, size_t position, size_t alignment, size_t offset)
+	{
+		size_t address = reinterpret_cast<size_t>(base) + position + offset;
+		address = (address + (alignment - 1)) & ~(alignment - 1);
+		return address - offset - reinterpret_cast<size_t>(base);
+	}
+	//------------------------------------------------------------------------------------------
+	ConcurrentLinearAllocator::ConcurrentLinearAllocator(size_t size, size_t commit_size) :
+		mGrowth(size, commit_size), mStart(nullptr), mSize(0), mOffset(0), mCommitted(0)
+	{
+	}
+	//------------------------------------------------------------------------------------------
+	bool ConcurrentLinearAllocator::init()
+	{
+		if (mStart == nullptr)
+		{
+			uint8* start = nullptr;
+			uint8* end = nullptr;
+			bool success = mGrowth.init(mBudget, start, end);
+			if (mBudget != nullptr)
+				mBudget->dispatch();
+			if (!success)
+				return false;
+			mSize = mGrowth.getReservedSize();
+			mCommitted.store(end - start, std::memory_order_relaxed);
+			mStart = start;
+		}
+		return true;
+	}
+	//------------------------------------------------------------------------------------------
+	ConcurrentLinearAllocator::~ConcurrentLinearAllocator()
+	{
+		ASSERT_ERROR(getTotalAllocated() == 0, "Concurrent linear allocator has memory leaks");
+		mGrowth.release(mBudget);
+		mStart = nullptr;
+	}
+	//------------------------------------------------------------------------------------------
+	uint8* ConcurrentLinearAllocator::claim(size_t size, size_t alignment, size_t offset)
+	{
+		if (mStart == nullptr)
+			return nullptr;
+		size_t position = mOffset.load(std::memory_order_relaxed);
+		size_t start, end;
+		do
+		{
+			start = alignOffset(mStart, position, alignment, offset);
+			end = start + size;
+			if (end < start || end > mSize)
+				return nullptr;
+		} while (!mOffset.compare_exchange_weak(position, end, std::memory_order_relaxed));
+
+		// The first allocation reaching uncommitted pages commits them
+		if (end > mCommitted.load(std::memory_order_acquire) && !commit(end))
+		{
+			// Give the range back unless another claim went past it, so that a failed commit
+			// doesn't make every later allocation fail too
+			mOffset.compare_exchange_strong(end, position, std::memory_order_relaxed);
+			return nullptr;
+		}
+		return mStart + start;
+	}
+	//------------------------------------------------------------------------------------------
+	bool ConcurrentLinearAllocator::commit(size_t end)
+	{
+		bool committed = true;
+		{
+			std::lock_guard<std::mutex> guard(mCommitMutex);
+			size_t current = mCommitted.load(std::memory_order_relaxed);
+			if (end <= current)
+				return true;
+			uint8* committed_end = mStart + current;
+			committed = mGrowth.grow(mBudget, mStart + end, committed_end);
+			if (committed)
+				mCommitted.store(committed_end - mStart, std::memory_order_release);
+		}
+		// The pressure callback may allocate from this allocator, so it runs without the lock
+		if (mBudget != nullptr)
+			mBudget->dispatch();
+		return committed;
+	}
+	//------------------------------------------------------------------------------------------
+	void* ConcurrentLinearAllocator::allocate(size_t size, size_t alignment, size_t offset,
+		const char* file_name, uint32 line, const char* func_name)
+	{
+		// Make sure the alignment is a power of 2
+		ASSERT_ERROR(((alignment & (alignment - 1)) == 0), "Alignment is not a power of 2");
+		if (alignment < kDefaultAlignment)
+			alignment = kDefaultAlignment;
+		// Add sizeof(size_t) to offset and size for storing the allocation size
+		size_t total_size = size + sizeof(size_t);
+		if (total_size < size)
+			return nullptr;
+		uint8* ptr = claim(total_size, alignment, offset + sizeof(size_t));
+		if (ptr == nullptr)
+			return nullptr;
+		*(reinterpret_cast<size_t*>(ptr)) = size;
+		return static_cast<void*>(ptr + sizeof(size_t));
+	}
+	//------------------------------------------------------------------------------------------
+	void* ConcurrentLinearAllocator::callocate(size_t num_elements, size_t elem_size,
+		const char* file_name, uint32 line, const char* func_name)
+	{
+		size_t size = num_elements * elem_size;
+		if (elem_size != 0 && size / elem_size != num_elements)
+			return nullptr;
+		void* mem = allocate(size, kDefaultAlignment, 0, file_name, line, func_name);
+		// Memory reused after a reset holds the previous round's data
+		if (mem != nullptr)
+			memset(mem, 0, size);
+		return mem;
+	}
+	//------------------------------------------------------------------------------------------
+	void ConcurrentLinearAllocator::deallocate(void* mem)
+	{
+		// This function is empty
+	}
+	//------------------------------------------------------------------------------------------
+	size_t ConcurrentLinearAllocator::getAllocSize(void* mem)
+	{
+		uint8* ptr = static_cast<uint8*>(mem);
+		ptr -= sizeof(size_t);
+		return *(reinterpret_cast<size_t*>(ptr));
+	}
+	//------------------------------------------------------------------------------------------
+	size_t ConcurrentLinearAllocator::getTotalAllocated()
+	{
+		return mOffset.load(std::memory_order_relaxed);
+	}
+	//------------------------------------------------------------------------------------------
+	void ConcurrentLinearAllocator::reset()
+	{
+		size_t high_water = mOffset.load(std::memory_order_relaxed);
+		mOffset.store(0, std::memory_order_relaxed);
+		if (mStart == nullptr)
+			return;
+		uint8* end = mStart + mCommitted.load(std::memory_order_relaxed);
+		mGrowth.reset(mBudget, mStart + high_water, end);
+		mCommitted.store(end - mStart, std::memory_order_relaxed);
+	}
+	//------------------------------------------------------------------------------------------
+	size_t ConcurrentLinearAllocator::purge()
+	{
+		if (mStart == nullptr)
+			return 0;
+		uint8* end = mStart + mCommitted.load(std::memory_order_relaxed);
+		size_t released = mGrowth.purge(mBudget, mStart + mOffset.load(std::memory_order_relaxed), end);
+		mCommitted.store(end - mStart, std::memory_order_relaxed);
+		return released;
+	}
+	//------------------------------------------------------------------------------------------
+	ConcurrentLinearAllocator::Cursor::Cursor(ConcurrentLinearAllocator* allocator, size_t block_size) :
+		mAllocator(allocator), mBlockSize(block_size), mCurrent(nullptr), mEnd(nullptr)
+	{
+	}
+	//------------------------------------------------------------------------------------------
+	void* ConcurrentLinearAllocator::Cursor::allocate(size_t size, size_t alignment)
+	{
+		ASSERT_ERROR(((alignment & (alignment - 1)) == 0), "Alignment is not a power of 2");
+		if (alignment < kDefaultAlignment)
+			alignment = kDefaultAlignment;
+		size_t total_size = size + sizeof(size_t);
+		if (total_size < size)
+			return nullptr;
+		uint8* ptr = nullptr;
+		if (mCurrent != nullptr)
+			ptr = mCurrent + alignOffset(mCurrent, 0, alignment, sizeof(size_t));
+		if (ptr == nullptr || ptr > mEnd || total_size > static_cast<size_t>(mEnd - ptr))
+		{
+			// Large allocations would waste most of a block
+			if (total_size + alignment > (mBlockSize >> 2))
+				return mAllocator->allocate(size, alignment, 0);
+			uint8* block = mAllocator->claim(mBlockSize, 16, 0);
+			if (block == nullptr)
+				return nullptr;
+			mCurrent = block;
+			mEnd = block + mBlockSize;
+			ptr = mCurrent + alignOffset(mCurrent, 0, alignment, sizeof(size_t));
+		}
+		mCurrent = ptr + total_size;
+		*(reinterpret_cast<size_t*>(ptr)) = size;
+		return static_cast<void*>(ptr + sizeof(size_t));
+	}
+}
\ No newline at end of file
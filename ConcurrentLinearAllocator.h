@@ -0,0 +1,111 @@
+#ifndef _CONCURRENT_LINEAR_ALLOCATOR_H_
+#define _CONCURRENT_LINEAR_ALLOCATOR_H_
+
+#include "DataTypes.h"
+#include "Assert.h"
+#include "Allocator.h"
+#include "GrowthPolicy.h"
+#include <atomic>
+#include <mutex>
+
+namespace Odin
+{
+	/*
+		Linear allocator any number of threads can allocate from at once, e.g. the workers
+		producing the transient data of a frame. An allocation claims its bytes with a
+		compare-and-swap on the shared offset and never takes a lock, unless it is the first to
+		reach pages which aren't committed yet. The address space is a VirtualGrowth, reserved in
+		init and committed commit_size bytes at a time as the offset advances.
+		Threads making many small allocations can go through a Cursor, which claims blocks of
+		kDefaultBlockSize bytes and bumps through them without touching the shared offset.
+		As with LinearAllocator, allocations are never freed individually. reset frees all of
+		them at once and must not run while any thread is allocating.
+	*/
+	class ConcurrentLinearAllocator : public Allocator
+	{
+	public:
+		// Size of the blocks claimed by a cursor
+		static const size_t kDefaultBlockSize = 32 * 1024;
+
+		// Per-thread cursor bumping through blocks claimed from the allocator. Allocations which
+		// take more than a quarter of a block are claimed from the allocator directly. A cursor
+		// must only be used by one thread at a time, and must be reset along with the allocator.
+		class Cursor
+		{
+		public:
+			explicit Cursor(ConcurrentLinearAllocator* allocator, size_t block_size = kDefaultBlockSize);
+
+			// Allocate memory, returns NULL if the allocator is out of memory
+			void* allocate(size_t size, size_t alignment = kDefaultAlignment);
+
+			// Drop the current block, called when the allocator is reset
+			void reset() { mCurrent = mEnd = nullptr; }
+		private:
+			ConcurrentLinearAllocator* mAllocator;
+			size_t mBlockSize;
+			// Free part of the current block
+			uint8* mCurrent;
+			uint8* mEnd;
+		};
+
+		// Reserve size bytes of address space, committed commit_size bytes at a time
+		explicit ConcurrentLinearAllocator(size_t size, size_t commit_size = 65536);
+		virtual ~ConcurrentLinearAllocator();
+
+		// Initialize the allocator
+		virtual bool init();
+
+		// Allocate memory. Thread safe.
+		virtual void* allocate(size_t size, size_t alignment, size_t offset,
+			const char* file_name = 0, uint32 line = 0, const char* func_name = 0);
+
+		// Allocate a continuous array of fixed sized elements, cleared to zero. Thread safe.
+		virtual void* callocate(size_t num_elements, size_t elem_size,
+			const char* file_name = 0, uint32 line = 0, const char* func_name = 0);
+
+		// Function to free memory
+		virtual void deallocate(void* mem);
+
+		// Return the amount of usable memory allocated at ptr
+		virtual size_t getAllocSize(void* mem);
+
+		// Return the total amount of memory allocated by this allocator, including the unused
+		// parts of the blocks claimed by cursors
+		virtual size_t getTotalAllocated();
+
+		// Function to clear all the allocated memory, trimming the committed pages down to the
+		// recent high-water marks as VirtualGrowth::reset does
+		void reset();
+
+		// Return the committed pages above the allocations to the system. Returns the number of
+		// bytes released. Like reset, it must not run while any thread is allocating, so the
+		// allocator is registered with MemoryMonitor::addOwnedAllocator.
+		virtual size_t purge();
+
+		// Return the number of bytes committed
+		size_t getCommittedSize() const { return mCommitted.load(std::memory_order_relaxed); }
+	private:
+		ConcurrentLinearAllocator(const ConcurrentLinearAllocator&) = delete;
+		ConcurrentLinearAllocator& operator=(const ConcurrentLinearAllocator&) = delete;
+
+		// Claim size bytes starting offset bytes before an aligned address, committing the pages
+		// they cover. Returns NULL if the allocator is out of memory.
+		uint8* claim(size_t size, size_t alignment, size_t offset);
+		// Commit the pages up to end bytes from the start. Returns false if they could not be committed.
+		bool commit(size_t end);
+
+		// The memory space, only grown under mCommitMutex
+		VirtualGrowth mGrowth;
+		// The starting address and the total size of the memory space
+		uint8* mStart;
+		size_t mSize;
+		// Bytes claimed from the start of the memory space
+		std::atomic<size_t> mOffset;
+		// Bytes committed from the start of the memory space, published by commit so that
+		// allocations check it without the lock
+		std::atomic<size_t> mCommitted;
+		std::mutex mCommitMutex;
+	};
+}
+
+#endif	// _CONCURRENT_LINEAR_ALLOCATOR_H_
@@ -1,6 +1,7 @@
 #ifndef _DATA_TYPES_H_
 #define _DATA_TYPES_H_
 
+#include <cstddef>
 #include <cstdint>
 #include "CompileOptions.h"
 
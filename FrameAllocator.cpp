@@ -0,0 +1,121 @@
+#include "FrameAllocator.h"
+
+namespace Odin
+{
+	FrameAllocator::FrameAllocator(uint32 num_frames, size_t reserve_size, size_t commit_size,
+		bool huge_pages) : mNumFrames(num_frames), mCurrent(0), mFrameIndex(0), mPeakUsage(0)
+	{
+		ASSERT_ERROR(num_frames >= 1 && num_frames <= kMaxFramesInFlight,
+			"Frame allocator supports 1 to %d frames in flight", kMaxFramesInFlight);
+		if (mNumFrames < 1)
+			mNumFrames = 1;
+		else if (mNumFrames > kMaxFramesInFlight)
+			mNumFrames = kMaxFramesInFlight;
+		for (uint32 i = 0; i < kMaxFramesInFlight; i++)
+		{
+			mRegions[i] = nullptr;
+			mHighWater[i] = 0;
+		}
+		for (uint32 i = 0; i < mNumFrames; i++)
+			mRegions[i] = new(&mStorage[i]) LinearAllocator(reserve_size, commit_size, true, huge_pages);
+	}
+	//------------------------------------------------------------------------------------------
+	FrameAllocator::~FrameAllocator()
+	{
+		// The frames in flight are freed along with the regions
+		for (uint32 i = 0; i < mNumFrames; i++)
+		{
+			mRegions[i]->reset();
+			mRegions[i]->~LinearAllocator();
+			mRegions[i] = nullptr;
+		}
+	}
+	//------------------------------------------------------------------------------------------
+	bool FrameAllocator::init()
+	{
+		for (uint32 i = 0; i < mNumFrames; i++)
+		{
+			mRegions[i]->setBudget(mBudget);
+			if (!mRegions[i]->init())
+				return false;
+		}
+		return true;
+	}
+	//------------------------------------------------------------------------------------------
+	void* FrameAllocator::allocate(size_t size, size_t alignment, size_t offset,
+		const char* file_name, uint32 line, const char* func_name)
+	{
+		return mRegions[mCurrent]->allocate(size, alignment, offset, file_name, line, func_name);
+	}
+	//------------------------------------------------------------------------------------------
+	void* FrameAllocator::callocate(size_t num_elements, size_t elem_size,
+		const char* file_name, uint32 line, const char* func_name)
+	{
+		size_t size = num_elements * elem_size;
+		if (elem_size != 0 && size / elem_size != num_elements)
+			return nullptr;
+		void* mem = allocate(size, kDefaultAlignment, 0, file_name, line, func_name);
+		// A region holds the data of an older frame once it is reused
+		if (mem != nullptr)
+			memset(mem, 0, size);
+		return mem;
+	}
+	//------------------------------------------------------------------------------------------
+	void FrameAllocator::deallocate(void* mem)
+	{
+		// This function is empty
+	}
+	//------------------------------------------------------------------------------------------
+	size_t FrameAllocator::getAllocSize(void* mem)
+	{
+		// Every region stores the size in front of the allocation the same way
+		return mRegions[mCurrent]->getAllocSize(mem);
+	}
+	//------------------------------------------------------------------------------------------
+	size_t FrameAllocator::getTotalAllocated()
+	{
+		size_t total = 0;
+		for (uint32 i = 0; i < mNumFrames; i++)
+			total += mRegions[i]->getTotalAllocated();
+		return total;
+	}
+	//------------------------------------------------------------------------------------------
+	size_t FrameAllocator::purge()
+	{
+		size_t released = 0;
+		for (uint32 i = 0; i < mNumFrames; i++)
+			released += mRegions[i]->purge();
+		return released;
+	}
+	//------------------------------------------------------------------------------------------
+	void FrameAllocator::beginFrame()
+	{
+		// Record the usage of the frame which just ended
+		size_t usage = mRegions[mCurrent]->getTotalAllocated();
+		if (usage > mPeakUsage)
+			mPeakUsage = usage;
+		for (uint32 i = kMaxFramesInFlight - 1; i > 0; i--)
+			mHighWater[i] = mHighWater[i - 1];
+		mHighWater[0] = usage;
+
+		// The oldest region in flight becomes the region of the new frame. Only its allocation
+		// pointer moves back, its pages stay committed until purge.
+		mCurrent = (mCurrent + 1) % mNumFrames;
+		mRegions[mCurrent]->rewind();
+		mFrameIndex++;
+	}
+	//------------------------------------------------------------------------------------------
+	size_t FrameAllocator::getFrameUsage(uint32 frames_ago)
+	{
+		if (frames_ago >= mNumFrames)
+			return 0;
+		return mRegions[getRegionIndex(frames_ago)]->getTotalAllocated();
+	}
+	//------------------------------------------------------------------------------------------
+	size_t FrameAllocator::getFrameHighWater(uint32 frames_ago) const
+	{
+		if (frames_ago == 0 || frames_ago > kMaxFramesInFlight)
+			return 0;
+		return mHighWater[frames_ago - 1];
+	}
+}
\ No newline at end of file
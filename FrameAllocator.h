@@ -0,0 +1,98 @@
+#ifndef _FRAME_ALLOCATOR_H_
+#define _FRAME_ALLOCATOR_H_
+
+#include "DataTypes.h"
+#include "Allocator.h"
+#include "LinearAllocator.h"
+#include <type_traits>
+
+namespace Odin
+{
+	/*
+		Allocator for transient data which has to stay alive for a few frames after the frame
+		which made it, e.g. while the GPU or the network consumes it. It keeps a ring of
+		num_frames growable linear allocators (regions). Allocations are made from the region of
+		the current frame, and beginFrame moves on to the next region, resetting the one which
+		was filled num_frames frames ago. Nothing is ever freed individually.
+	*/
+	class FrameAllocator : public Allocator
+	{
+	public:
+		// Maximum number of frames in flight
+		static const uint32 kMaxFramesInFlight = 4;
+
+		// Keep num_frames regions, each reserving reserve_size bytes of address space committed
+		// commit_size bytes at a time. A region chains more chunks when a frame needs more.
+		FrameAllocator(uint32 num_frames, size_t reserve_size, size_t commit_size = 65536,
+			bool huge_pages = false);
+		virtual ~FrameAllocator();
+
+		// Initialize the regions
+		virtual bool init();
+
+		// Allocate memory living until the region of the current frame is reset
+		virtual void* allocate(size_t size, size_t alignment, size_t offset,
+			const char* file_name = 0, uint32 line = 0, const char* func_name = 0);
+
+		// Allocate a continuous array of fixed sized elements, cleared to zero
+		virtual void* callocate(size_t num_elements, size_t elem_size,
+			const char* file_name = 0, uint32 line = 0, const char* func_name = 0);
+
+		// Function to free memory
+		virtual void deallocate(void* mem);
+
+		// Return the amount of usable memory allocated at ptr
+		virtual size_t getAllocSize(void* mem);
+
+		// Return the total amount of memory allocated by the frames in flight
+		virtual size_t getTotalAllocated();
+
+		// Return the committed pages above the allocations of every region to the system, and
+		// the chained chunks they don't use
+		virtual size_t purge();
+
+		// Start a new frame. The region of the frame num_frames - 1 frames back retires: its
+		// allocations are freed and it becomes the region of the new frame. This only moves
+		// pointers, the pages of a region stay committed for the later frames. After a spike,
+		// purge (e.g. through MemoryMonitor::purgeOwnedAllocator) gives them back.
+		void beginFrame();
+
+		// Return the number of frames begun since init
+		uint64 getFrameIndex() const { return mFrameIndex; }
+
+		// Return the number of bytes allocated by the frame frames_ago frames back, 0 being the
+		// current frame, or 0 if that frame is no longer in flight
+		size_t getFrameUsage(uint32 frames_ago);
+
+		// Return the high-water mark of a frame which ended: the bytes it allocated, recorded by
+		// the beginFrame which ended it. frames_ago is 1 for the last frame which ended, up to
+		// kMaxFramesInFlight.
+		size_t getFrameHighWater(uint32 frames_ago) const;
+
+		// Return the highest number of bytes any single frame allocated since init
+		size_t getPeakFrameUsage() const { return mPeakUsage; }
+	private:
+		FrameAllocator(const FrameAllocator&) = delete;
+		FrameAllocator& operator=(const FrameAllocator&) = delete;
+
+		// Return the index of the region of the frame frames_ago frames back, less than mNumFrames
+		uint32 getRegionIndex(uint32 frames_ago) const
+		{
+			return (mCurrent + mNumFrames - frames_ago) % mNumFrames;
+		}
+
+		// Regions, constructed in place in mStorage
+		typedef std::aligned_storage<sizeof(LinearAllocator), alignof(LinearAllocator)>::type RegionStorage;
+		RegionStorage mStorage[kMaxFramesInFlight];
+		LinearAllocator* mRegions[kMaxFramesInFlight];
+		uint32 mNumFrames;
+		// Index of the region of the current frame
+		uint32 mCurrent;
+		uint64 mFrameIndex;
+		// Bytes allocated by the last kMaxFramesInFlight retired frames, most recent first
+		size_t mHighWater[kMaxFramesInFlight];
+		size_t mPeakUsage;
+	};
+}
+
+#endif	// _FRAME_ALLOCATOR_H_
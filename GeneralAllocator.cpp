@@ -1,164 +1,722 @@
 #include "GeneralAllocator.h"
+#include "PageMap.h"
+#include "Assert.h"
+#include <system_error>
 
 namespace Odin
 {
+	// Bytes of system memory holding num_shards shards
+	template <typename T>
+	static size_t getShardBytes(uint32 num_shards)
+	{
+		size_t page_size = SysAlloc::getSystemPageSize();
+		return ((sizeof(T) * num_shards) + (page_size - 1)) & ~(page_size - 1);
+	}
+	//------------------------------------------------------------------------------------------
 	GeneralAllocator::GeneralAllocator(size_t initialSize,
 		size_t page_size,
 		size_t segment_granularity,
-		size_t segment_threshold)
+		size_t segment_threshold,
+		bool huge_pages,
+		uint32 num_shards,
+		const SizeClassTable* size_classes) : mShards(nullptr), mNumShards(num_shards), mProcessorsPerShard(1),
+		mHugePages(huge_pages), mSizeHistogram(nullptr), mHeapProfiler(nullptr), mThreadCaches(nullptr),
+		mCacheCapacity(kDefaultCacheCapacity), mCacheBatch(kDefaultCacheBatch), mStopScavenger(false)
 	{
+		uint32 num_processors = SysAlloc::getProcessorCount();
+		if (mNumShards == 0 || mNumShards > num_processors)
+			mNumShards = num_processors;
+		mProcessorsPerShard = (num_processors + (mNumShards - 1)) / mNumShards;
+
+		if (size_classes != nullptr && isValidSizeClassTable(*size_classes))
+			mSizeClasses = *size_classes;
+		else
+		{
+			ASSERT_ERROR(size_classes == nullptr, "Invalid size class table, using the default one");
+			mSizeClasses = getDefaultSizeClassTable();
+		}
+		// Map every 8 byte bucket of request sizes to the first class large enough for it
+		uint32 index = 0;
+		for (uint32 bucket = 0; bucket < kNumSizeBuckets; ++bucket)
+		{
+			while (index < mSizeClasses.num_classes && mSizeClasses.sizes[index] < (bucket << 3))
+				++index;
+			mClassIndex[bucket] = static_cast<uint8>((index < mSizeClasses.num_classes) ? index : kLargeInstance);
+		}
 	}
 	//------------------------------------------------------------------------------------------
 	GeneralAllocator::~GeneralAllocator()
 	{
-		for (uint32 i = 0; i < 21; ++i)
+		stopScavenger();
+		// Blocks still cached by threads are released along with the runs and segments
+		ThreadCaches::detach(&mThreadCaches);
+		if (mShards == nullptr)
+			return;
+		for (uint32 shard = 0; shard < mNumShards; ++shard)
 		{
-			if (mSpace[i] != nullptr)
+			for (uint32 i = 0; i < mSizeClasses.num_classes; ++i)
+				destroySlabSpace(&mShards[shard].slab[i]);
+			MemorySpace* msp = mShards[shard].space.load(std::memory_order_relaxed);
+			if (msp != nullptr)
 			{
-				destroyMemoryRegion(mSpace[i]);
+				destroyMemoryRegion(msp);
 			}
+			mShards[shard].~Shard();
 		}
+		SysAlloc::releaseSegment(mShards, getShardBytes<Shard>(mNumShards));
 	}
 	//------------------------------------------------------------------------------------------
 	bool GeneralAllocator::init()
 	{
-		// This allocator creates 20 dlmalloc instances covering allocations at every 8 byte
-		// size interval less than 64 bytes and every 16 byte interval between 64 and 256 bytes.
-		// And it creates one dlmalloc instance for allocations larger than 256 bytes.
-		for (int32 i = 0; i < 20; ++i)
-		{
-			// The dlmalloc instances for allocations less than 256 bytes will have a segment size of 
-			// 64KB and a page size of 64KB too
-			mSpace[i] = createMemorySpace(65536,
-				65536, 65536, 8192);
-			if (mSpace[i] == NULL)
-				return false;
-		}
-		// The instance for allocations larger than 256 bytes will have a segment size of 32MB
-		// and a page size of 64KB
-		mSpace[20] = createMemorySpace(65536,
-			65536, 33554432, 8388608);
-		if (mSpace[20] == NULL)
+		// The shards live in memory obtained directly from the system
+		mShards = static_cast<Shard*>(SysAlloc::reserveCommitSegment(getShardBytes<Shard>(mNumShards)));
+		if (mShards == nullptr)
 			return false;
 
-		return true;
+		// Every shard has a slab space for each class of the size class table (by default 20
+		// spaces covering allocations at every 8 byte size interval up to 64 bytes and every
+		// 16 byte interval up to 256 bytes). And it has one dlmalloc instance for larger
+		// allocations. Slab spaces only get runs on their first allocation. The dlmalloc instance
+		// of the first shard is created up front, the others on their first use.
+		for (uint32 shard = 0; shard < mNumShards; ++shard)
+		{
+			new (&mShards[shard]) Shard();
+			for (uint32 i = 0; i < mSizeClasses.num_classes; ++i)
+			{
+				initSlabSpace(&mShards[shard].slab[i], getClassObjectSize(i));
+				mShards[shard].slab[i].tag = makeTag(shard, i);
+				mShards[shard].slab[i].budget = mBudget;
+			}
+			mShards[shard].space.store(nullptr, std::memory_order_relaxed);
+		}
+
+		return getSpace(0) != nullptr;
 	}
 	//------------------------------------------------------------------------------------------
 	void* GeneralAllocator::allocate(size_t size, size_t alignment, size_t offset,
 		const char* file_name, uint32 line, const char* func_name)
 	{
-		// Get the index of the dlmalloc instance based on the request size
+		void* mem = allocateBlock(size, alignment, offset);
+		HeapProfiler* profiler = mHeapProfiler.load(std::memory_order_relaxed);
+		if (profiler != nullptr && mem != nullptr)
+			sampleAllocation(profiler, mem, size, ODIN_RETURN_ADDRESS(), file_name, line, func_name);
+		if (mBudget != nullptr)
+			mBudget->dispatch();
+		return mem;
+	}
+	//-----------------------------------------------------------------------------------------
+	void* GeneralAllocator::allocateBlock(size_t size, size_t alignment, size_t offset)
+	{
+		SizeHistogram* histogram = mSizeHistogram.load(std::memory_order_relaxed);
+		if (histogram != nullptr)
+			recordSize(histogram, size);
+
+		// Get the index of the size class instance based on the request size
 		int32 index = getInstIndexFromSize(size);
-		if (index > -1)
+		if (index < 0)
+			return nullptr;
+
+		// Slab objects only get the default alignment, the dlmalloc instance serves the rest
+		if (index < static_cast<int32>(kLargeInstance) && alignment <= kDefaultAlignment && offset == 0)
 		{
-			std::lock_guard<std::mutex> guard(mMutex[index]);
-			return allocAligned(mSpace[index], alignment, size, offset);
+			// Serve small requests without a lock from the magazines of the calling thread
+			ThreadCache* cache = getThreadCache();
+			if (cache != nullptr)
+			{
+				Magazine& magazine = cache->magazines[index];
+				if (magazine.count > 0)
+					return magazine.blocks[--magazine.count];
+				return refillMagazine(magazine, index);
+			}
+			return slabAlloc(&mShards[getCurrentShard()].slab[index]);
 		}
-		else
-			return nullptr;
+
+		// The dlmalloc instance does its own locking
+		MemorySpace* msp = getSpace(getCurrentShard());
+		return msp ? allocAligned(msp, alignment, size, offset) : nullptr;
 	}
 	//-----------------------------------------------------------------------------------------
 	void* GeneralAllocator::callocate(size_t num_elements, size_t elem_size,
 		const char* file_name, uint32 line, const char* func_name)
 	{
-		// Get the index of the dlmalloc instance based on the request size
-		int32 index = getInstIndexFromSize(elem_size);
-		if (index > -1)
+		size_t req = num_elements * elem_size;
+		if (elem_size != 0 && req / elem_size != num_elements)
+			return nullptr;	// Overflow
+
+		// The size class is picked by the size of the whole array
+		int32 index = getInstIndexFromSize(req);
+		if (index < 0)
+			return nullptr;
+		void* mem = nullptr;
+		if (index < static_cast<int32>(kLargeInstance))
 		{
-			std::lock_guard<std::mutex> guard(mMutex[index]);
-			return calloc(mSpace[index], num_elements, elem_size);
+			mem = allocateBlock(req, kDefaultAlignment, 0);
+			if (mem != nullptr)
+				memset(mem, 0, req);
 		}
 		else
-			return nullptr;
+		{
+			// The dlmalloc instance does its own locking
+			MemorySpace* msp = getSpace(getCurrentShard());
+			mem = msp ? calloc(msp, num_elements, elem_size) : nullptr;
+		}
+
+		HeapProfiler* profiler = mHeapProfiler.load(std::memory_order_relaxed);
+		if (profiler != nullptr && mem != nullptr)
+			sampleAllocation(profiler, mem, req, ODIN_RETURN_ADDRESS(), file_name, line, func_name);
+		if (mBudget != nullptr)
+			mBudget->dispatch();
+		return mem;
 	}
 	//-----------------------------------------------------------------------------------------
 	void GeneralAllocator::deallocate(void* mem)
+	{
+		HeapProfiler* profiler = mHeapProfiler.load(std::memory_order_relaxed);
+		if (profiler != nullptr && mem != nullptr)
+			profiler->recordFree(mem);
+		deallocateBlock(mem);
+	}
+	//-----------------------------------------------------------------------------------------
+	void GeneralAllocator::deallocateBlock(void* mem)
 	{
 		if (mem)
 		{
-			// Get the address of the MemorySpace from the footer
-			MemorySpace* msp = getMemorySpaceAddr(mem);
-			if (msp)
+			// Look up the owner in the page map. This also routes the block back to the shard
+			// it was allocated from.
+			MemorySpace* msp = PageMap::getOwner(mem);
+			if (msp == PageMap::kSlabRun)
 			{
-				free(msp, mem);
+				// Keep slab objects in the magazines of the calling thread
+				SlabSpace* ssp = getSlabSpace(mem);
+				ThreadCache* cache = getThreadCache();
+				if (cache != nullptr && ownsSlab(ssp))
+				{
+					Magazine& magazine = cache->magazines[getTagIndex(ssp->tag)];
+					if (magazine.count >= mCacheCapacity.load(std::memory_order_relaxed))
+						flushMagazine(magazine, mCacheBatch.load(std::memory_order_relaxed));
+					magazine.blocks[magazine.count++] = mem;
+					return;
+				}
+				if (ownsSlab(ssp) && getTagShard(ssp->tag) != getCurrentShard())
+					slabFreeRemote(ssp, &mem, 1);
+				else
+					slabFree(mem);
 			}
+			else if (msp == PageMap::kDirectChunk)
+			{
+				// This address was allocated directly from the system since the size
+				// request was greater than the threshold. It doesn't belong to any segment.
+				size_t size = freeDirect(mem);
+				if (mBudget != nullptr)
+					mBudget->release(size);
+			}
+			else if (msp)
+			{
+				// Blocks of another shard are queued for its owner instead of contending on its lock
+				if (getTagShard(msp->tag) != getCurrentShard())
+					freeRemote(msp, mem);
+				else
+					free(msp, mem);
+			}
+			else
+			{
+				ASSERT_ERROR(false, "Address was not allocated by the general allocator");
+			}
+		}
+	}
+	//-----------------------------------------------------------------------------------------
+	size_t GeneralAllocator::allocateBatch(size_t size, size_t alignment, size_t count, void** out,
+		const char* file_name, uint32 line, const char* func_name)
+	{
+		size_t done = 0;
+		int32 index = getInstIndexFromSize(size);
+		if (alignment > kDefaultAlignment)
+		{
+			// Carved chunks only get the default alignment
+			while (done < count && (out[done] = allocateBlock(size, alignment, 0)) != nullptr)
+				++done;
+		}
+		else if (index >= 0)
+		{
+			uint32 shard = getCurrentShard();
+			if (index < static_cast<int32>(kLargeInstance))
+				done = slabAllocBatch(&mShards[shard].slab[index], count, out);
 			else
 			{
-				// This address was allocated from one of the segments with size 
-				// request greater than threshold. So just call free from 
-				// the first available segment.
-				for (uint32 i = 0; i < 21; ++i)
+				MemorySpace* msp = getSpace(shard);
+				done = msp ? allocBatch(msp, size, count, out) : 0;
+			}
+		}
+
+		HeapProfiler* profiler = mHeapProfiler.load(std::memory_order_relaxed);
+		if (profiler != nullptr)
+		{
+			for (size_t i = 0; i < done; ++i)
+				sampleAllocation(profiler, out[i], size, ODIN_RETURN_ADDRESS(), file_name, line, func_name);
+		}
+		if (mBudget != nullptr)
+			mBudget->dispatch();
+		return done;
+	}
+	//-----------------------------------------------------------------------------------------
+	void GeneralAllocator::deallocateBatch(void** mem, size_t count)
+	{
+		HeapProfiler* profiler = mHeapProfiler.load(std::memory_order_relaxed);
+		if (profiler != nullptr)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (mem[i] != nullptr)
+					profiler->recordFree(mem[i]);
+			}
+		}
+
+		uint32 current_shard = getCurrentShard();
+		size_t i = 0;
+		while (i < count)
+		{
+			if (mem[i] == nullptr)
+			{
+				++i;
+				continue;
+			}
+			MemorySpace* msp = PageMap::getOwner(mem[i]);
+			if (msp == PageMap::kDirectChunk)
+			{
+				size_t size = freeDirect(mem[i++]);
+				if (mBudget != nullptr)
+					mBudget->release(size);
+				continue;
+			}
+			if (msp == nullptr)
+			{
+				ASSERT_ERROR(false, "Address was not allocated by the general allocator");
+				++i;
+				continue;
+			}
+			// Gather the run of blocks belonging to the same instance and free them together
+			size_t end = i + 1;
+			if (msp == PageMap::kSlabRun)
+			{
+				SlabSpace* ssp = getSlabSpace(mem[i]);
+				while (end < count && (mem[end] == nullptr ||
+					(PageMap::getOwner(mem[end]) == PageMap::kSlabRun && getSlabSpace(mem[end]) == ssp)))
+					++end;
+				if (ownsSlab(ssp) && getTagShard(ssp->tag) != current_shard)
+					slabFreeRemote(ssp, mem + i, end - i);
+				else
+					slabFreeBatch(ssp, mem + i, end - i);
+			}
+			else
+			{
+				while (end < count && (mem[end] == nullptr || PageMap::getOwner(mem[end]) == msp))
+					++end;
+				if (getTagShard(msp->tag) != current_shard)
 				{
-					std::lock_guard<std::mutex> guard(mMutex[i]);
-					if (mSpace[i])
-					{
-						free(mSpace[i], mem);
-						break;
-					}
+					for (size_t j = i; j < end; ++j)
+						freeRemote(msp, mem[j]);
 				}
+				else
+					freeBatch(msp, mem + i, end - i);
 			}
+			i = end;
 		}
 	}
 	//-----------------------------------------------------------------------------------------
+	void* GeneralAllocator::reallocate(void* mem, size_t size, size_t alignment,
+		const char* file_name, uint32 line, const char* func_name)
+	{
+		HeapProfiler* profiler = mHeapProfiler.load(std::memory_order_relaxed);
+		void* new_mem = reallocateBlock(mem, size, alignment, profiler);
+		// The sample of the old block goes away only if the block was resized or moved. A moved
+		// block lost it before it was freed.
+		if (profiler != nullptr && new_mem != nullptr)
+		{
+			if (new_mem == mem)
+				profiler->recordFree(mem);
+			sampleAllocation(profiler, new_mem, size, ODIN_RETURN_ADDRESS(), file_name, line, func_name);
+		}
+		if (mBudget != nullptr)
+			mBudget->dispatch();
+		return new_mem;
+	}
+	//-----------------------------------------------------------------------------------------
+	void* GeneralAllocator::reallocateBlock(void* mem, size_t size, size_t alignment, HeapProfiler* profiler)
+	{
+		if (mem == nullptr)
+			return allocateBlock(size, alignment, 0);
+
+		MemorySpace* msp = PageMap::getOwner(mem);
+		ASSERT_ERROR(msp != nullptr, "Address was not allocated by the general allocator");
+		int32 index = getInstIndexFromSize(size);
+		if (index < 0)
+			return nullptr;
+		// Requests which need more than the default alignment are served by the dlmalloc instance
+		if (alignment > kDefaultAlignment)
+			index = kLargeInstance;
+
+		if (msp == PageMap::kSlabRun)
+		{
+			// Objects can't grow or shrink, but any request of the same class fits
+			if (getTagIndex(getSlabSpace(mem)->tag) == static_cast<uint32>(index))
+				return mem;
+		}
+		else if (index == static_cast<int32>(kLargeInstance))
+		{
+			// Chunks obtained directly from the system are resized through the dlmalloc instance
+			// of the calling thread's shard. Other chunks are resized within the shard owning them.
+			uint32 shard = (msp == PageMap::kDirectChunk) ? getCurrentShard() : getTagShard(msp->tag);
+			msp = getSpace(shard);
+			if (msp != nullptr)
+			{
+				// realloc frees a moved block itself, the profiler needs to see it first. Every
+				// chunk it returns has kChunkAlignment.
+				if (alignment <= kChunkAlignment && profiler == nullptr)
+					return realloc(msp, mem, size);
+				// Resizing in place keeps the address, which is only good if it has the alignment
+				if ((reinterpret_cast<size_t>(mem) & (alignment - 1)) == 0)
+				{
+					void* new_mem = reallocInPlace(msp, mem, size);
+					if (new_mem != nullptr)
+						return new_mem;
+				}
+			}
+		}
+
+		// The size class changed, move the allocation to the instance of the new class
+		void* new_mem = allocateBlock(size, alignment, 0);
+		if (new_mem != nullptr)
+		{
+			size_t old_size = getAllocSize(mem);
+			memcpy(new_mem, mem, (old_size < size) ? old_size : size);
+			if (profiler != nullptr)
+				profiler->recordFree(mem);
+			deallocateBlock(mem);
+		}
+		return new_mem;
+	}
+	//-----------------------------------------------------------------------------------------
+	void GeneralAllocator::sampleAllocation(HeapProfiler* profiler, void* mem, size_t size, void* caller,
+		const char* file_name, uint32 line, const char* func_name)
+	{
+		// Threads with a cache keep their own countdown, the others share one
+		ThreadCache* cache = ThreadCaches::find(this);
+		bool take = (cache != nullptr) ? profiler->takeSample(cache->bytes_until_sample, size) : profiler->takeSample(size);
+		if (take)
+			profiler->recordAllocation(mem, size, caller, file_name, line, func_name);
+	}
+	//-----------------------------------------------------------------------------------------
 	size_t GeneralAllocator::getAllocSize(void* mem)
 	{
-		return getChunkSize(mem);
+		if (PageMap::getOwner(mem) == PageMap::kSlabRun)
+			return getSlabSpace(mem)->object_size;
+		return getUsableSize(mem);
 	}
 	//-----------------------------------------------------------------------------------------
 	size_t GeneralAllocator::getTotalAllocated()
 	{
 		size_t total_footprint = 0;
-		for(uint32 i = 0; i < 21; ++i)
+		for (uint32 shard = 0; shard < mNumShards; ++shard)
 		{
-			std::lock_guard<std::mutex> guard(mMutex[i]);
-			if(mSpace[i])
-				total_footprint += mSpace[i]->footprint;
+			for (uint32 i = 0; i < mSizeClasses.num_classes; ++i)
+			{
+				std::lock_guard<AdaptiveLock> guard(mShards[shard].slab[i].slab_lock);
+				total_footprint += mShards[shard].slab[i].footprint;
+			}
+			MemorySpace* msp = mShards[shard].space.load(std::memory_order_acquire);
+			if (msp)
+				total_footprint += getTotalReservedMemory(msp);
 		}
 		return total_footprint;
 	}
 	//-----------------------------------------------------------------------------------------
-	int32 GeneralAllocator::getInstIndexFromSize(size_t size)
+	void GeneralAllocator::getShardStats(uint32 shard, ShardStats& stats)
 	{
-		uint32 index = 0;
-		if (size < 64)
-			index = size >> 3;
-		else if (size >= 64 && size < 256)
-			uint32 index = (size >> 4) + 4; // Since 16 byte allocations are housed between index 8 and index 18
-		else
-			// Allocation request is greater than of equal to 256
-			index = 20;
-
-		// Lock the particular dlmalloc instance
-		std::lock_guard<std::mutex> guard(mMutex[index]);
-		// See if the segment exists. Since, each segment is released as soon as it contains no
-		// allocations, this particular segment may not exist
-		if (mSpace[index])
-			return index;
-		else
+		stats.footprint = stats.max_footprint = stats.in_use = 0;
+		if (shard >= mNumShards)
+			return;
+		for (uint32 i = 0; i < mSizeClasses.num_classes; ++i)
+		{
+			SlabSpace* ssp = &mShards[shard].slab[i];
+			// Frees queued by other shards are applied first
+			stats.in_use += getSlabInuseBytes(ssp);
+			std::lock_guard<AdaptiveLock> guard(ssp->slab_lock);
+			stats.footprint += ssp->footprint;
+			stats.max_footprint += ssp->max_footprint;
+		}
+		MemorySpace* msp = mShards[shard].space.load(std::memory_order_acquire);
+		if (msp)
+		{
+			stats.in_use += getInuseBytes(msp);
+			stats.footprint += getTotalReservedMemory(msp);
+			stats.max_footprint += getMaxReservedMemory(msp);
+		}
+	}
+	//-----------------------------------------------------------------------------------------
+	bool GeneralAllocator::getLockStats(uint32 shard, uint32 index, LockStats& stats)
+	{
+		stats.acquisitions = stats.contended = stats.wait_ns = 0;
+		if (shard >= mNumShards)
+			return false;
+		if (index < mSizeClasses.num_classes)
+		{
+			mShards[shard].slab[index].slab_lock.getStats(stats);
+			return true;
+		}
+		MemorySpace* msp = mShards[shard].space.load(std::memory_order_acquire);
+		if (index != kLargeInstance || msp == nullptr)
+			return false;
+		msp->memory_lock.getStats(stats);
+		return true;
+	}
+	//-----------------------------------------------------------------------------------------
+	size_t GeneralAllocator::scavenge()
+	{
+		size_t released = 0;
+		for (uint32 shard = 0; shard < mNumShards; ++shard)
+		{
+			for (uint32 i = 0; i < mSizeClasses.num_classes; ++i)
+				released += slabDecay(&mShards[shard].slab[i], kNumDecaySteps);
+			MemorySpace* msp = mShards[shard].space.load(std::memory_order_acquire);
+			if (msp)
+				released += decay(msp, 0);
+		}
+		return released + SysAlloc::decaySegmentCache();
+	}
+	//-----------------------------------------------------------------------------------------
+	size_t GeneralAllocator::trim(size_t pad)
+	{
+		size_t released = 0;
+		for (uint32 shard = 0; shard < mNumShards; ++shard)
+		{
+			MemorySpace* msp = mShards[shard].space.load(std::memory_order_acquire);
+			if (msp)
+				released += Odin::trim(msp, pad);
+		}
+		return released;
+	}
+	//-----------------------------------------------------------------------------------------
+	size_t GeneralAllocator::purge()
+	{
+		size_t released = 0;
+		for (uint32 shard = 0; shard < mNumShards; ++shard)
+		{
+			for (uint32 i = 0; i < mSizeClasses.num_classes; ++i)
+				released += slabTrim(&mShards[shard].slab[i]);
+			MemorySpace* msp = mShards[shard].space.load(std::memory_order_acquire);
+			if (msp)
+				released += Odin::purge(msp);
+		}
+		return released + SysAlloc::purgeSegmentCache();
+	}
+	//-----------------------------------------------------------------------------------------
+	bool GeneralAllocator::startScavenger(uint32 decay_ms)
+	{
+		std::lock_guard<std::mutex> guard(mScavengerMutex);
+		if (mScavenger.joinable() || mShards == nullptr)
+			return false;
+		uint32 interval_ms = decay_ms / kNumDecaySteps;
+		if (interval_ms == 0)
+			interval_ms = 1;
+		mStopScavenger = false;
+		try
 		{
-			// Segment doesn't exist, create it again
-			if (index == 20)
+			mScavenger = std::thread(&GeneralAllocator::runScavenger, this, interval_ms);
+		}
+		catch (const std::system_error&)
+		{
+			return false;
+		}
+		return true;
+	}
+	//-----------------------------------------------------------------------------------------
+	void GeneralAllocator::stopScavenger()
+	{
+		{
+			std::lock_guard<std::mutex> guard(mScavengerMutex);
+			if (!mScavenger.joinable())
+				return;
+			mStopScavenger = true;
+		}
+		mScavengerCondition.notify_one();
+		mScavenger.join();
+	}
+	//-----------------------------------------------------------------------------------------
+	void GeneralAllocator::lockAll()
+	{
+		// Same order as the paths nesting them: instance creation, slab spaces, dlmalloc instance
+		for (uint32 shard = 0; shard < mNumShards; ++shard)
+		{
+			mShards[shard].mutex.lock();
+			for (uint32 i = 0; i < mSizeClasses.num_classes; ++i)
+				mShards[shard].slab[i].slab_lock.lock();
+			MemorySpace* msp = mShards[shard].space.load(std::memory_order_acquire);
+			if (msp)
+				msp->memory_lock.lock();
+		}
+	}
+	//-----------------------------------------------------------------------------------------
+	void GeneralAllocator::unlockAll()
+	{
+		for (uint32 shard = mNumShards; shard > 0; --shard)
+		{
+			// The instance can't have been created since lockAll, its shard mutex is held
+			MemorySpace* msp = mShards[shard - 1].space.load(std::memory_order_acquire);
+			if (msp)
+				msp->memory_lock.unlock();
+			for (uint32 i = mSizeClasses.num_classes; i > 0; --i)
+				mShards[shard - 1].slab[i - 1].slab_lock.unlock();
+			mShards[shard - 1].mutex.unlock();
+		}
+	}
+	//-----------------------------------------------------------------------------------------
+	void GeneralAllocator::runScavenger(uint32 interval_ms)
+	{
+		std::unique_lock<std::mutex> lock(mScavengerMutex);
+		while (!mScavengerCondition.wait_for(lock, std::chrono::milliseconds(interval_ms),
+			[this] { return mStopScavenger; }))
+		{
+			// Don't hold up stopScavenger while walking the instances
+			lock.unlock();
+			scavenge();
+			lock.lock();
+		}
+	}
+	//-----------------------------------------------------------------------------------------
+	uint32 GeneralAllocator::getCurrentShard() const
+	{
+		if (mNumShards == 1)
+			return 0;
+		// Consecutive processors usually share caches, so they share a shard too
+		return (SysAlloc::getCurrentProcessor() / mProcessorsPerShard) % mNumShards;
+	}
+	//-----------------------------------------------------------------------------------------
+	MemorySpace* GeneralAllocator::getSpace(uint32 shard)
+	{
+		// The instance is created on first use and lives as long as the allocator, so only
+		// its creation needs the shard mutex
+		MemorySpace* msp = mShards[shard].space.load(std::memory_order_acquire);
+		if (msp == nullptr)
+		{
+			std::lock_guard<std::mutex> guard(mShards[shard].mutex);
+			msp = mShards[shard].space.load(std::memory_order_relaxed);
+			if (msp == nullptr)
 			{
-				mSpace[index] = createMemorySpace(65536,
-					65536, 33554432, 8388608);
-				if (mSpace[index])
-					// Created the segment, go ahead and return the index
-					return index;
-				else
-					// Something went wrong, return -1
-					return -1;
+				// The instance for allocations larger than the largest size class will have a
+				// segment size of 32MB and a page size of 64KB (2MB in huge page mode). The first
+				// segment is only reserved, its pages are committed as they are used.
+				msp = createMemorySpace(33554432,
+					65536, 33554432, 8388608, mHugePages);
+				if (msp != nullptr && !Odin::setBudget(msp, mBudget))
+				{
+					destroyMemoryRegion(msp);
+					msp = nullptr;
+				}
+				if (msp)
+				{
+					msp->tag = makeTag(shard, kLargeInstance);
+					mShards[shard].space.store(msp, std::memory_order_release);
+				}
 			}
+		}
+		return msp;
+	}
+	//-----------------------------------------------------------------------------------------
+	bool GeneralAllocator::ownsSlab(SlabSpace* ssp) const
+	{
+		uint32 shard = getTagShard(ssp->tag);
+		uint32 index = getTagIndex(ssp->tag);
+		return shard < mNumShards && index < mSizeClasses.num_classes && &mShards[shard].slab[index] == ssp;
+	}
+	//-----------------------------------------------------------------------------------------
+	void GeneralAllocator::configureThreadCache(uint32 capacity, uint32 batch_size)
+	{
+		if (capacity > kMaxMagazineCapacity)
+			capacity = kMaxMagazineCapacity;
+		if (batch_size > capacity)
+			batch_size = capacity;
+		if (batch_size == 0)
+			batch_size = 1;
+		mCacheBatch.store(batch_size, std::memory_order_relaxed);
+		mCacheCapacity.store(capacity, std::memory_order_relaxed);
+	}
+	//-----------------------------------------------------------------------------------------
+	void GeneralAllocator::flushThreadCache()
+	{
+		ThreadCache* cache = ThreadCaches::find(this);
+		if (cache != nullptr)
+			drainThreadCache(cache);
+	}
+	//-----------------------------------------------------------------------------------------
+	void GeneralAllocator::setSizeHistogram(SizeHistogram* histogram)
+	{
+		mSizeHistogram.store(histogram, std::memory_order_relaxed);
+	}
+	//-----------------------------------------------------------------------------------------
+	void GeneralAllocator::setHeapProfiler(HeapProfiler* profiler)
+	{
+		mHeapProfiler.store(profiler, std::memory_order_relaxed);
+	}
+	//-----------------------------------------------------------------------------------------
+	ThreadCache* GeneralAllocator::getThreadCache()
+	{
+		if (mCacheCapacity.load(std::memory_order_relaxed) == 0)
+			return nullptr;
+		ThreadCache* cache = ThreadCaches::find(this);
+		if (cache == nullptr)
+			cache = ThreadCaches::create(this, &mThreadCaches);
+		return cache;
+	}
+	//-----------------------------------------------------------------------------------------
+	void* GeneralAllocator::refillMagazine(Magazine& magazine, uint32 index)
+	{
+		uint32 batch_size = mCacheBatch.load(std::memory_order_relaxed);
+		magazine.count = static_cast<uint32>(slabAllocBatch(&mShards[getCurrentShard()].slab[index],
+			batch_size, magazine.blocks));
+		if (magazine.count == 0)
+			return nullptr;
+		return magazine.blocks[--magazine.count];
+	}
+	//-----------------------------------------------------------------------------------------
+	void GeneralAllocator::flushMagazine(Magazine& magazine, uint32 count)
+	{
+		if (count > magazine.count)
+			count = magazine.count;
+		// Blocks freed by this thread may come from the slab spaces of any shard. Free each run
+		// of blocks owned by the same slab space together, queueing the runs of other shards.
+		uint32 current_shard = getCurrentShard();
+		uint32 i = 0;
+		while (i < count)
+		{
+			SlabSpace* ssp = getSlabSpace(magazine.blocks[i]);
+			uint32 end = i + 1;
+			while (end < count && getSlabSpace(magazine.blocks[end]) == ssp)
+				++end;
+			if (getTagShard(ssp->tag) != current_shard)
+				slabFreeRemote(ssp, magazine.blocks + i, end - i);
 			else
-			{
-				// Segment doesn't exist, create it again
-				mSpace[index] = createMemorySpace(65536,
-					65536, 65536, 8192);
-				if (mSpace[index])
-					return index;
-				else
-					// Something went wrong, return -1
-					return -1;
-			}
+				slabFreeBatch(ssp, magazine.blocks + i, end - i);
+			i = end;
+		}
+		// Keep the most recently freed blocks, they are the likeliest to be in the cache
+		magazine.count -= count;
+		memmove(magazine.blocks, magazine.blocks + count, magazine.count * sizeof(void*));
+	}
+	//-----------------------------------------------------------------------------------------
+	void GeneralAllocator::drainThreadCache(ThreadCache* cache)
+	{
+		for (uint32 i = 0; i < kNumCachedClasses; ++i)
+		{
+			if (cache->magazines[i].count > 0)
+				flushMagazine(cache->magazines[i], cache->magazines[i].count);
 		}
 	}
-}
\ No newline at end of file
+	//-----------------------------------------------------------------------------------------
+	int32 GeneralAllocator::getInstIndexFromSize(size_t size) const
+	{
+		// Requests up to the largest class are looked up by their 8 byte bucket
+		if (size <= kMaxSmallClassSize)
+			return mClassIndex[(size + 7) >> 3];
+		return kLargeInstance;
+	}
+}
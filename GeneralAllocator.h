@@ -3,19 +3,52 @@
 
 #include "DataTypes.h"
 #include "Allocator.h"
+#include "HeapProfiler.h"
 #include "MemAlloc.h"
+#include "SizeClass.h"
+#include "SlabAlloc.h"
 #include "SysAlloc.h"
+#include "ThreadCache.h"
+#include <atomic>
+#include <condition_variable>
 #include <mutex>
+#include <thread>
 
 namespace Odin
 {
 	class GeneralAllocator : public Allocator
 	{
 	public:
+		// Number of size class instances in a shard. The first kNumSmallClasses are slab spaces
+		// for the classes of the size class table, the last one is the dlmalloc instance for
+		// larger requests. Tables with fewer classes leave the remaining slab spaces unused.
+		static const uint32 kNumInstances = kMaxSizeClasses + 1;
+		static const uint32 kNumSmallClasses = kNumCachedClasses;
+		static const uint32 kLargeInstance = kNumSmallClasses;
+
+		// Occupancy of one shard
+		struct ShardStats
+		{
+			size_t footprint;			// Bytes reserved by the instances of the shard
+			size_t max_footprint;		// Highest footprint of the instances of the shard
+			size_t in_use;				// Bytes held by allocated blocks, including the blocks sitting in thread caches
+		};
+
+		// If huge_pages is true, the instance for allocations larger than the largest size class
+		// uses segments backed by huge pages.
+		// num_shards is the number of sets of size class instances. Each allocation is served by
+		// the shard of the processor the calling thread runs on, with consecutive processors
+		// sharing a shard when there are fewer shards than processors. 0 creates one shard per
+		// processor.
+		// size_classes sets the object sizes of the slab spaces, the default table is used if
+		// it is NULL or invalid. The table is copied.
 		explicit GeneralAllocator(size_t initialSize,
 			size_t page_size,
 			size_t segment_granularity,
-			size_t segment_threshold);
+			size_t segment_threshold,
+			bool huge_pages = false,
+			uint32 num_shards = 1,
+			const SizeClassTable* size_classes = nullptr);
 		virtual ~GeneralAllocator();
 
 		// Initialize
@@ -32,19 +65,161 @@ namespace Odin
 		// Free an allocation previously made with allocate
 		virtual void deallocate(void* mem);
 
+		// Allocate count blocks of size bytes into out with a single lock acquisition.
+		// Returns the number of blocks allocated.
+		size_t allocateBatch(size_t size, size_t alignment, size_t count, void** out,
+			const char* file_name = 0, uint32 line = 0, const char* func_name = 0);
+
+		// Free count blocks, taking each instance lock once per run of blocks owned by that instance
+		void deallocateBatch(void** mem, size_t count);
+
+		// Resize an allocation in place if possible, moving it to the instance of the new size
+		// class if the size class changes
+		virtual void* reallocate(void* mem, size_t size, size_t alignment,
+			const char* file_name = 0, uint32 line = 0, const char* func_name = 0);
+
 		// Return the amount of usable memory allocated at ptr
 		virtual size_t getAllocSize(void* mem);
 
 		// Return the total amount of memory allocated by this allocator
 		virtual size_t getTotalAllocated();
 
-		// Get the dlmalloc instance index based on size request
-		int32 getInstIndexFromSize(size_t size);
+		// Get the size class instance index based on size request
+		int32 getInstIndexFromSize(size_t size) const;
+
+		// Get the size class table of this allocator
+		const SizeClassTable& getSizeClassTable() const { return mSizeClasses; }
+
+		// Count the size of every allocation request in histogram, or stop counting if it is NULL.
+		// Feed the histogram to buildSizeClassTable to derive a table for this workload.
+		void setSizeHistogram(SizeHistogram* histogram);
+
+		// Sample the allocations with profiler, or stop sampling if it is NULL. The profiler
+		// should outlive the allocations it sampled or be detached before they are freed.
+		void setHeapProfiler(HeapProfiler* profiler);
+
+		// Set the number of blocks each thread caches per size class below 256 bytes and the
+		// number of blocks moved between a thread cache and its slab space at once.
+		// A capacity of 0 disables thread caching.
+		void configureThreadCache(uint32 capacity, uint32 batch_size);
+
+		// Return the blocks cached by the calling thread to their slab spaces
+		void flushThreadCache();
+
+		// Return the number of shards
+		uint32 getNumShards() const { return mNumShards; }
+
+		// Fill stats with the occupancy of a shard. Walks every chunk of the shard's instances.
+		void getShardStats(uint32 shard, ShardStats& stats);
+
+		// Fill stats with the contention counters of the lock of one size class instance of a
+		// shard, index kLargeInstance being the dlmalloc instance. Returns false if the shard,
+		// the index or the instance doesn't exist.
+		bool getLockStats(uint32 shard, uint32 index, LockStats& stats);
+
+		// Advance the decay of every instance by one step. Free pages at the top of the dlmalloc
+		// instances and empty slab runs go back to the system over the next kNumDecaySteps
+		// steps, as do the cached segments older than the segment cache decay time. Called by
+		// the scavenger thread, or at a steady rate by the application (e.g. once per frame)
+		// if the thread isn't running. Returns the number of bytes released.
+		size_t scavenge();
+
+		// Decommit the free pages at the top of every dlmalloc instance, keeping pad bytes of
+		// each top committed. Returns the number of bytes decommitted.
+		size_t trim(size_t pad);
+
+		// Return every free page to the system right away: the tops of the dlmalloc instances,
+		// the empty slab runs and the segment cache. Returns the number of bytes released.
+		virtual size_t purge();
+
+		// Start a thread calling scavenge every decay_ms / kNumDecaySteps milliseconds, so that
+		// pages go back to the system about decay_ms after they were freed. Returns false if
+		// the scavenger is already running or the thread could not be created.
+		bool startScavenger(uint32 decay_ms);
+
+		// Stop the scavenger thread and wait for it to exit
+		void stopScavenger();
+
+		// Take every lock of the instances, so that fork() doesn't copy a lock held by another
+		// thread into the child. unlockAll releases them, in the parent and in the child.
+		void lockAll();
+		void unlockAll();
 	private:
-		// Array of mutexes for all the dlmalloc instances
-		std::mutex mMutex[21];
-		// Array of dlmalloc instances
-		MemorySpace* mSpace[21];
+		friend struct ThreadCacheList;
+
+		// One set of size class instances
+		struct Shard
+		{
+			// Mutex guarding the creation of the dlmalloc instance
+			std::mutex mutex;
+			// Slab spaces of the small size classes, they do their own locking
+			SlabSpace slab[kNumSmallClasses];
+			// dlmalloc instance for allocations larger than the largest size class
+			std::atomic<MemorySpace*> space;
+		};
+
+		// The tag of a SlabSpace or MemorySpace records its shard and instance index
+		static uint32 makeTag(uint32 shard, uint32 index) { return (shard * kNumInstances) + index; }
+		static uint32 getTagShard(uint32 tag) { return tag / kNumInstances; }
+		static uint32 getTagIndex(uint32 tag) { return tag % kNumInstances; }
+
+		// allocate and deallocate without the heap profiler
+		void* allocateBlock(size_t size, size_t alignment, size_t offset);
+		void deallocateBlock(void* mem);
+		// reallocate without sampling the new block. The sample of mem is removed from profiler,
+		// if set, before a moved block is freed.
+		void* reallocateBlock(void* mem, size_t size, size_t alignment, HeapProfiler* profiler);
+		// Count an allocation against the sample countdown of the calling thread and record it
+		// with the heap profiler when the countdown runs out
+		void sampleAllocation(HeapProfiler* profiler, void* mem, size_t size, void* caller,
+			const char* file_name, uint32 line, const char* func_name);
+
+		// Get the shard of the calling thread
+		uint32 getCurrentShard() const;
+		// Get the dlmalloc instance of a shard, creating it if required
+		MemorySpace* getSpace(uint32 shard);
+		// Return true if ssp is one of the slab spaces of this allocator
+		bool ownsSlab(SlabSpace* ssp) const;
+
+		// Object size of a small size class, the largest request of the class
+		uint32 getClassObjectSize(uint32 index) const { return mSizeClasses.sizes[index]; }
+
+		// Get the cache of the calling thread, creating it if required
+		ThreadCache* getThreadCache();
+		// Fill a magazine from its slab space and pop a block off it
+		void* refillMagazine(Magazine& magazine, uint32 index);
+		// Return the oldest count blocks of a magazine to their slab spaces
+		void flushMagazine(Magazine& magazine, uint32 count);
+		// Return all the blocks of a cache to the slab spaces
+		void drainThreadCache(ThreadCache* cache);
+		// Scavenger thread function
+		void runScavenger(uint32 interval_ms);
+
+		// Sets of size class instances, obtained directly from the system
+		Shard* mShards;
+		uint32 mNumShards;
+		// Number of consecutive processors sharing a shard
+		uint32 mProcessorsPerShard;
+		// Use huge pages for the large allocation instance
+		bool mHugePages;
+		// Object sizes of the slab spaces
+		SizeClassTable mSizeClasses;
+		// Size class index of every 8 byte bucket of request sizes up to the largest class
+		uint8 mClassIndex[kNumSizeBuckets];
+		// Histogram counting the requests, if any
+		std::atomic<SizeHistogram*> mSizeHistogram;
+		// Profiler sampling the allocations, if any
+		std::atomic<HeapProfiler*> mHeapProfiler;
+		// Caches of all the threads using this allocator
+		ThreadCache* mThreadCaches;
+		// Blocks per magazine and blocks per refill or flush
+		std::atomic<uint32> mCacheCapacity;
+		std::atomic<uint32> mCacheBatch;
+		// Thread calling scavenge periodically, and the flag and condition stopping it
+		std::thread mScavenger;
+		std::mutex mScavengerMutex;
+		std::condition_variable mScavengerCondition;
+		bool mStopScavenger;
 	};
 }
-#endif	// _GENERAL_ALLOCATOR_H_
\ No newline at end of file
+#endif	// _GENERAL_ALLOCATOR_H_
@@ -0,0 +1,197 @@
+#include "GrowthPolicy.h"
+#include "SysAlloc.h"
+
+namespace Odin
+{
+	// Granularity of reservations and commits without huge pages, hardcoded to 64kB
+	static const size_t kGranularity = 65536;
+
+	//------------------------------------------------------------------------------------------
+	// Release bytes charged to a budget, never more than were charged
+	static void releaseCharge(MemoryBudget* budget, size_t& charged, size_t size)
+	{
+		if (size > charged)
+			size = charged;
+		if (size != 0 && budget != nullptr)
+		{
+			budget->release(size);
+			charged -= size;
+		}
+	}
+	//------------------------------------------------------------------------------------------
+	FixedGrowth::FixedGrowth(size_t size, bool huge_pages) : mSize(size), mStart(nullptr),
+		mHugePages(huge_pages), mHugeBacked(false), mCharged(0)
+	{
+	}
+	//------------------------------------------------------------------------------------------
+	bool FixedGrowth::init(MemoryBudget* budget, uint8*& start, uint8*& end)
+	{
+		if (mStart == nullptr)
+		{
+			// Align the size to page granularity
+			size_t granularity = mHugePages ? SysAlloc::kHugePageSize : kGranularity;
+			size_t size = (mSize + (granularity - 1)) & ~(granularity - 1);
+			// The whole memory space is committed up front, so the whole of it is charged
+			if (budget != nullptr && !budget->charge(size))
+				return false;
+			if (mHugePages)
+				mStart = static_cast<uint8*>(SysAlloc::reserveCommitHugeSegment(size, mHugeBacked));
+			else
+				mStart = static_cast<uint8*>(SysAlloc::reserveCommitSegment(size));
+			if (mStart == nullptr)
+			{
+				if (budget != nullptr)
+					budget->release(size);
+				return false;
+			}
+			mSize = size;
+			if (budget != nullptr)
+				mCharged = size;
+		}
+		start = mStart;
+		end = mStart + mSize;
+		return true;
+	}
+	//------------------------------------------------------------------------------------------
+	void FixedGrowth::release(MemoryBudget* budget)
+	{
+		if (mStart == nullptr)
+			return;
+		if (mHugePages)
+			SysAlloc::releaseHugeSegment(mStart, mSize, mHugeBacked);
+		else
+			SysAlloc::releaseSegment(mStart, mSize);
+		releaseCharge(budget, mCharged, mCharged);
+		mStart = nullptr;
+	}
+	//------------------------------------------------------------------------------------------
+	VirtualGrowth::VirtualGrowth(size_t reserve_size, size_t commit_size, bool huge_pages) :
+		mSize(reserve_size), mCommitSize(commit_size), mStart(nullptr), mHugePages(huge_pages),
+		mHugeBacked(false), mCommitted(0), mCharged(0), mResetIndex(0)
+	{
+		for (uint32 i = 0; i < kResetHistory; ++i)
+			mHighWater[i] = 0;
+	}
+	//------------------------------------------------------------------------------------------
+	bool VirtualGrowth::init(MemoryBudget* budget, uint8*& start, uint8*& end)
+	{
+		if (mStart == nullptr)
+		{
+			// Reserve and commit whole pages
+			size_t granularity = getGranularity();
+			mSize = (mSize + (granularity - 1)) & ~(granularity - 1);
+			mCommitSize = (mCommitSize + (granularity - 1)) & ~(granularity - 1);
+			if (mCommitSize == 0)
+				mCommitSize = granularity;
+			if (mHugePages)
+				mStart = static_cast<uint8*>(SysAlloc::reserveHugeSegment(mSize, mHugeBacked));
+			else
+				mStart = static_cast<uint8*>(SysAlloc::reserveSegment(mSize));
+			if (mStart == nullptr)
+				return false;
+			mCommitted = 0;
+			end = mStart;
+			if (!grow(budget, mStart + 1, end))
+			{
+				if (mHugePages)
+					SysAlloc::releaseHugeSegment(mStart, mSize, mHugeBacked);
+				else
+					SysAlloc::releaseSegment(mStart, mSize);
+				mStart = nullptr;
+				return false;
+			}
+		}
+		start = mStart;
+		end = mStart + mCommitted;
+		return true;
+	}
+	//------------------------------------------------------------------------------------------
+	void VirtualGrowth::release(MemoryBudget* budget)
+	{
+		if (mStart == nullptr)
+			return;
+		if (mHugePages)
+			SysAlloc::releaseHugeSegment(mStart, mSize, mHugeBacked);
+		else
+			SysAlloc::releaseSegment(mStart, mSize);
+		releaseCharge(budget, mCharged, mCharged);
+		mStart = nullptr;
+		mCommitted = 0;
+	}
+	//------------------------------------------------------------------------------------------
+	bool VirtualGrowth::grow(MemoryBudget* budget, uint8* required_end, uint8*& end)
+	{
+		if (mStart == nullptr || required_end < mStart ||
+			static_cast<size_t>(required_end - mStart) > mSize)
+			return false;
+		size_t offset = required_end - mStart;
+		if (offset <= mCommitted)
+			return true;
+		// Commit commit_size bytes at a time, the reservation may not be a multiple of it
+		size_t committed = ((offset + (mCommitSize - 1)) / mCommitSize) * mCommitSize;
+		if (committed > mSize)
+			committed = mSize;
+		size_t size = committed - mCommitted;
+		if (budget != nullptr && !budget->charge(size))
+			return false;
+		if (!SysAlloc::commitPage(mStart + mCommitted, size))
+		{
+			if (budget != nullptr)
+				budget->release(size);
+			return false;
+		}
+		if (budget != nullptr)
+			mCharged += size;
+		mCommitted = committed;
+		end = mStart + committed;
+		return true;
+	}
+	//------------------------------------------------------------------------------------------
+	void VirtualGrowth::reset(MemoryBudget* budget, uint8* high_water, uint8*& end)
+	{
+		if (mStart == nullptr)
+			return;
+		// Keep the pages of the largest of the last rounds committed, so that a workload
+		// alternating between large and small rounds doesn't fault the same pages in on every
+		// round. A quarter of it above it is kept too, so that a slightly larger next round
+		// doesn't commit the pages again.
+		mHighWater[mResetIndex] = high_water - mStart;
+		mResetIndex = (mResetIndex + 1) % kResetHistory;
+		size_t used = 0;
+		for (uint32 i = 0; i < kResetHistory; ++i)
+		{
+			if (mHighWater[i] > used)
+				used = mHighWater[i];
+		}
+		decommit(budget, used + (used >> 2), end);
+	}
+	//------------------------------------------------------------------------------------------
+	size_t VirtualGrowth::purge(MemoryBudget* budget, uint8* current, uint8*& end)
+	{
+		if (mStart == nullptr)
+			return 0;
+		return decommit(budget, current - mStart, end);
+	}
+	//------------------------------------------------------------------------------------------
+	size_t VirtualGrowth::decommit(MemoryBudget* budget, size_t offset, uint8*& end)
+	{
+		// Keep the page holding offset, and at least one page
+		size_t granularity = getGranularity();
+		if (offset == 0)
+			offset = 1;
+		offset = (offset + (granularity - 1)) & ~(granularity - 1);
+		if (offset >= mCommitted)
+			return 0;
+		size_t size = mCommitted - offset;
+		SysAlloc::decommitPage(mStart + offset, size);
+		releaseCharge(budget, mCharged, size);
+		mCommitted = offset;
+		end = mStart + offset;
+		return size;
+	}
+	//------------------------------------------------------------------------------------------
+	size_t VirtualGrowth::getGranularity() const
+	{
+		return mHugePages ? SysAlloc::kHugePageSize : kGranularity;
+	}
+}
\ No newline at end of file
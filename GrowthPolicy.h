@@ -0,0 +1,102 @@
+#ifndef _GROWTH_POLICY_H_
+#define _GROWTH_POLICY_H_
+
+#include "DataTypes.h"
+#include "MemoryBudget.h"
+
+namespace Odin
+{
+	/*
+		Growth policies provide the memory space of a BasicLinearAllocator. The allocator bumps
+		through [start, end) and only calls the policy when an allocation doesn't fit or on
+		reset, so none of these calls are on the fast path. Memory committed by a policy is
+		charged to the budget passed to it. The policies never dispatch the budget events, the
+		caller does once it released its locks.
+	*/
+
+	// Commits the whole memory space in init, it can never grow
+	class FixedGrowth
+	{
+	public:
+		// Allocate virtual memory for the given size. If huge_pages is true, the memory
+		// is backed by huge pages when the system has them available.
+		explicit FixedGrowth(size_t size, bool huge_pages = false);
+
+		// Get the memory space. Returns false if it could not be allocated.
+		bool init(MemoryBudget* budget, uint8*& start, uint8*& end);
+		// Return the memory space to the system
+		void release(MemoryBudget* budget);
+
+		// The memory space can't grow
+		bool grow(MemoryBudget* budget, uint8* required_end, uint8*& end) { return false; }
+		// Nothing to give back, every page stays committed
+		void reset(MemoryBudget* budget, uint8* high_water, uint8*& end) {}
+		size_t purge(MemoryBudget* budget, uint8* current, uint8*& end) { return 0; }
+
+		// Return the number of bytes committed
+		size_t getCommittedSize() const { return (mStart != nullptr) ? mSize : 0; }
+	private:
+		size_t mSize;
+		uint8* mStart;
+		bool mHugePages;
+		bool mHugeBacked;
+		// Bytes charged to the budget
+		size_t mCharged;
+	};
+
+	// Reserves the memory space in init and commits it commit_size bytes at a time as the
+	// allocations advance. On reset, the pages above the largest high-water mark of the last
+	// kResetHistory rounds plus a quarter of it are decommitted, so a page only goes back to the
+	// system once several rounds in a row didn't use it. If huge_pages is true, the memory space
+	// is backed by huge pages when the system has them available and is committed in whole
+	// huge pages.
+	class VirtualGrowth
+	{
+	public:
+		// Number of rounds whose high-water marks are kept committed
+		static const uint32 kResetHistory = 8;
+
+		explicit VirtualGrowth(size_t reserve_size, size_t commit_size = 65536, bool huge_pages = false);
+
+		// Reserve the memory space and commit its first pages. Returns false if it could not
+		// be reserved.
+		bool init(MemoryBudget* budget, uint8*& start, uint8*& end);
+		// Return the memory space to the system
+		void release(MemoryBudget* budget);
+
+		// Commit the pages up to required_end and move end past them. Returns false if
+		// required_end is beyond the reservation or the pages could not be committed.
+		bool grow(MemoryBudget* budget, uint8* required_end, uint8*& end);
+		// Record the high-water mark of the round and decommit the pages above the largest one
+		// of the last kResetHistory rounds plus the retained slack
+		void reset(MemoryBudget* budget, uint8* high_water, uint8*& end);
+		// Decommit the pages above current. Returns the number of bytes released.
+		size_t purge(MemoryBudget* budget, uint8* current, uint8*& end);
+
+		// Return the number of bytes reserved, and the number of them committed
+		size_t getReservedSize() const { return mSize; }
+		size_t getCommittedSize() const { return mCommitted; }
+	private:
+		// Return the granularity of commits and reservations
+		size_t getGranularity() const;
+		// Decommit the pages from offset bytes into the memory space up. Returns the number of
+		// bytes decommitted.
+		size_t decommit(MemoryBudget* budget, size_t offset, uint8*& end);
+
+		size_t mSize;
+		size_t mCommitSize;
+		uint8* mStart;
+		bool mHugePages;
+		// The memory space is mapped on huge pages (MAP_HUGETLB or MEM_LARGE_PAGES)
+		bool mHugeBacked;
+		// Bytes committed from the start of the memory space
+		size_t mCommitted;
+		// Bytes charged to the budget
+		size_t mCharged;
+		// High-water marks of the last rounds, mResetIndex being the slot of the next one
+		size_t mHighWater[kResetHistory];
+		uint32 mResetIndex;
+	};
+}
+
+#endif	// _GROWTH_POLICY_H_
@@ -0,0 +1,451 @@
+#include "HeapProfiler.h"
+#include "SysAlloc.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
+#include <Windows.h>
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Odin
+{
+	// Call stack and call site shared by samples, with the counts of its sampled allocations
+	struct HeapProfiler::Bucket
+	{
+		Bucket* next;					// Next bucket in the hash chain
+		size_t hash;
+		const char* file_name;
+		const char* func_name;
+		uint32 line;
+		uint32 depth;					// Number of frames in stack
+		uint64 live_count;				// Sampled allocations not freed yet
+		uint64 live_bytes;
+		uint64 total_count;				// All sampled allocations
+		uint64 total_bytes;
+		void* stack[kMaxSampleFrames];
+	};
+
+	// A sampled block which is still allocated
+	struct HeapProfiler::Sample
+	{
+		Sample* next;					// Next sample in the hash chain or in the free list
+		size_t hash;
+		void* mem;
+		size_t size;
+		Bucket* bucket;
+	};
+
+	// Size of the blocks nodes are carved from and initial number of slots of the hash tables
+	const size_t kNodeBlockSize = 65536;
+	const size_t kInitialTableSize = 1024;
+	// Largest distance between two frames of a frame pointer walk
+	const size_t kMaxFrameSize = 1048576;
+
+	//--------------------------------------------------------------------------------------------------------------
+	static FORCEINLINE size_t getPointerHash(const void* mem)
+	{
+		uint64 key = static_cast<uint64>(reinterpret_cast<size_t>(mem) >> 3);
+		return static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> 20);
+	}
+
+	// Bytes of system memory holding count entries of size bytes
+	static size_t getTableBytes(size_t count, size_t size)
+	{
+		size_t page_size = SysAlloc::getSystemPageSize();
+		return ((count * size) + (page_size - 1)) & ~(page_size - 1);
+	}
+
+	// Walk the call stack of the calling thread into frames. Returns the number of frames found.
+	static uint32 captureStack(void** frames, uint32 max_frames)
+	{
+#if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
+		return RtlCaptureStackBackTrace(0, max_frames, frames, nullptr);
+#elif ODIN_COMPILER == ODIN_COMPILER_GCC
+		// Each frame starts with the frame pointer of its caller followed by the return address.
+		// Stop at anything which doesn't look like the next frame up the stack.
+		void** fp = static_cast<void**>(__builtin_frame_address(0));
+		uint32 depth = 0;
+		while (fp != nullptr && depth < max_frames)
+		{
+			void** next = static_cast<void**>(fp[0]);
+			void* ret = fp[1];
+			if (ret == nullptr)
+				break;
+			frames[depth++] = ret;
+			if (next <= fp || reinterpret_cast<uint8*>(next) - reinterpret_cast<uint8*>(fp) > static_cast<ptrdiff_t>(kMaxFrameSize) ||
+				(reinterpret_cast<size_t>(next) & (sizeof(void*) - 1)) != 0)
+				break;
+			fp = next;
+		}
+		return depth;
+#else
+		return 0;
+#endif
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	HeapProfiler::HeapProfiler(size_t sample_interval, bool capture_stacks) :
+		mSampleInterval(sample_interval != 0 ? sample_interval : 1), mCaptureStacks(capture_stacks),
+		mRandomState(static_cast<uint64>(reinterpret_cast<size_t>(this))), mSharedCountdown(0), mFilter(nullptr),
+		mBuckets(nullptr), mBucketTableSize(0), mNumBuckets(0), mSamples(nullptr), mSampleTableSize(0),
+		mNumSamples(0), mFreeSamples(nullptr), mNodeBlocks(nullptr), mNodeCursor(nullptr), mNodeBytesLeft(0)
+	{
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	HeapProfiler::~HeapProfiler()
+	{
+		while (mNodeBlocks != nullptr)
+		{
+			void* next = *static_cast<void**>(mNodeBlocks);
+			SysAlloc::releaseSegment(mNodeBlocks, kNodeBlockSize);
+			mNodeBlocks = next;
+		}
+		if (mBuckets != nullptr)
+			SysAlloc::releaseSegment(mBuckets, getTableBytes(mBucketTableSize, sizeof(Bucket*)));
+		if (mSamples != nullptr)
+			SysAlloc::releaseSegment(mSamples, getTableBytes(mSampleTableSize, sizeof(Sample*)));
+		if (mFilter != nullptr)
+			SysAlloc::releaseSegment(mFilter, getTableBytes(kFilterSize, sizeof(std::atomic<uint32>)));
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	bool HeapProfiler::init()
+	{
+		// Memory from the system is zero filled, so the tables start out empty
+		mBuckets = static_cast<Bucket**>(SysAlloc::reserveCommitSegment(getTableBytes(kInitialTableSize, sizeof(Bucket*))));
+		mSamples = static_cast<Sample**>(SysAlloc::reserveCommitSegment(getTableBytes(kInitialTableSize, sizeof(Sample*))));
+		if (mBuckets == nullptr || mSamples == nullptr)
+			return false;
+		mBucketTableSize = mSampleTableSize = kInitialTableSize;
+		void* filter = SysAlloc::reserveCommitSegment(getTableBytes(kFilterSize, sizeof(std::atomic<uint32>)));
+		if (filter == nullptr)
+			return false;
+		mFilter = static_cast<std::atomic<uint32>*>(filter);
+		for (uint32 i = 0; i < kFilterSize; ++i)
+			new (&mFilter[i]) std::atomic<uint32>(0);
+		mSharedCountdown.store(getNextInterval(), std::memory_order_relaxed);
+		return true;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	bool HeapProfiler::takeSample(size_t size)
+	{
+		int64 left = mSharedCountdown.fetch_sub(static_cast<int64>(size), std::memory_order_relaxed) - static_cast<int64>(size);
+		if (left >= 0)
+			return false;
+		// Threads racing past zero together are all sampled, which only happens on rare occasions
+		mSharedCountdown.store(getNextInterval(), std::memory_order_relaxed);
+		return true;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	int64 HeapProfiler::getNextInterval()
+	{
+		// splitmix64 turns a counter into uniformly distributed bits
+		uint64 x = mRandomState.fetch_add(0x9E3779B97F4A7C15ULL, std::memory_order_relaxed) + 0x9E3779B97F4A7C15ULL;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		x ^= x >> 31;
+		// Uniform in (0, 1], then exponentially distributed with the sample interval as mean
+		float64 uniform = static_cast<float64>((x >> 11) + 1) * (1.0 / 9007199254740992.0);
+		float64 interval = -std::log(uniform) * static_cast<float64>(mSampleInterval);
+		return (interval < 1.0) ? 1 : static_cast<int64>(interval);
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void HeapProfiler::recordAllocation(void* mem, size_t size, void* caller,
+		const char* file_name, uint32 line, const char* func_name)
+	{
+		if (mFilter == nullptr)
+			return;
+
+		// Walk the stack before taking the lock. The frames of the allocator itself are
+		// dropped, the stack starts at its caller.
+		void* stack[kMaxSampleFrames];
+		uint32 depth = 0;
+		if (mCaptureStacks)
+		{
+			void* frames[kMaxSampleFrames + 8];
+			uint32 num_frames = captureStack(frames, kMaxSampleFrames + 8);
+			uint32 first = 0;
+			while (first < num_frames && frames[first] != caller)
+				++first;
+			if (first == num_frames)
+				first = 0;
+			for (uint32 i = first; i < num_frames && depth < kMaxSampleFrames; ++i)
+				stack[depth++] = frames[i];
+		}
+		if (depth == 0)
+			stack[depth++] = caller;
+
+		std::lock_guard<AdaptiveLock> guard(mLock);
+		Bucket* bucket = findBucket(stack, depth, file_name, line, func_name);
+		Sample* sample = mFreeSamples;
+		if (sample != nullptr)
+			mFreeSamples = sample->next;
+		else
+			sample = static_cast<Sample*>(allocNode(sizeof(Sample)));
+		if (bucket == nullptr || sample == nullptr)
+		{
+			if (sample != nullptr)
+			{
+				sample->next = mFreeSamples;
+				mFreeSamples = sample;
+			}
+			return;
+		}
+
+		bucket->live_count++;
+		bucket->live_bytes += size;
+		bucket->total_count++;
+		bucket->total_bytes += size;
+
+		growTable(mSamples, mSampleTableSize, mNumSamples);
+		sample->hash = getPointerHash(mem);
+		size_t slot = sample->hash & (mSampleTableSize - 1);
+		sample->mem = mem;
+		sample->size = size;
+		sample->bucket = bucket;
+		sample->next = mSamples[slot];
+		mSamples[slot] = sample;
+		++mNumSamples;
+		mFilter[getFilterIndex(mem)].fetch_add(1, std::memory_order_relaxed);
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void HeapProfiler::removeSample(void* mem)
+	{
+		std::lock_guard<AdaptiveLock> guard(mLock);
+		Sample** link = &mSamples[getPointerHash(mem) & (mSampleTableSize - 1)];
+		while (*link != nullptr && (*link)->mem != mem)
+			link = &(*link)->next;
+		// Another block hashing to the same counter was sampled
+		if (*link == nullptr)
+			return;
+
+		Sample* sample = *link;
+		*link = sample->next;
+		--mNumSamples;
+		mFilter[getFilterIndex(mem)].fetch_sub(1, std::memory_order_relaxed);
+		sample->bucket->live_count--;
+		sample->bucket->live_bytes -= sample->size;
+		sample->next = mFreeSamples;
+		mFreeSamples = sample;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	HeapProfiler::Bucket* HeapProfiler::findBucket(void** stack, uint32 depth,
+		const char* file_name, uint32 line, const char* func_name)
+	{
+		size_t hash = getPointerHash(file_name) ^ getPointerHash(func_name) ^ (line * 0x9E3779B1U);
+		for (uint32 i = 0; i < depth; ++i)
+			hash = (hash * 31) + getPointerHash(stack[i]);
+
+		size_t slot = hash & (mBucketTableSize - 1);
+		for (Bucket* bucket = mBuckets[slot]; bucket != nullptr; bucket = bucket->next)
+		{
+			if (bucket->hash == hash && bucket->depth == depth && bucket->line == line &&
+				bucket->file_name == file_name && bucket->func_name == func_name &&
+				memcmp(bucket->stack, stack, depth * sizeof(void*)) == 0)
+				return bucket;
+		}
+
+		Bucket* bucket = static_cast<Bucket*>(allocNode(sizeof(Bucket)));
+		if (bucket == nullptr)
+			return nullptr;
+		bucket->hash = hash;
+		bucket->file_name = file_name;
+		bucket->func_name = func_name;
+		bucket->line = line;
+		bucket->depth = depth;
+		bucket->live_count = bucket->live_bytes = bucket->total_count = bucket->total_bytes = 0;
+		memcpy(bucket->stack, stack, depth * sizeof(void*));
+
+		growTable(mBuckets, mBucketTableSize, mNumBuckets);
+		slot = hash & (mBucketTableSize - 1);
+		bucket->next = mBuckets[slot];
+		mBuckets[slot] = bucket;
+		++mNumBuckets;
+		return bucket;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void* HeapProfiler::allocNode(size_t size)
+	{
+		size = (size + 15) & ~static_cast<size_t>(15);
+		if (mNodeBytesLeft < size)
+		{
+			// The first 16 bytes of a block link it to the previous one
+			void* block = SysAlloc::reserveCommitSegment(kNodeBlockSize);
+			if (block == nullptr)
+				return nullptr;
+			*static_cast<void**>(block) = mNodeBlocks;
+			mNodeBlocks = block;
+			mNodeCursor = static_cast<uint8*>(block) + 16;
+			mNodeBytesLeft = kNodeBlockSize - 16;
+		}
+		void* node = mNodeCursor;
+		mNodeCursor += size;
+		mNodeBytesLeft -= size;
+		return node;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	template <typename T>
+	void HeapProfiler::growTable(T**& table, size_t& table_size, size_t count)
+	{
+		if (count < table_size)
+			return;
+		size_t new_size = table_size * 2;
+		T** new_table = static_cast<T**>(SysAlloc::reserveCommitSegment(getTableBytes(new_size, sizeof(T*))));
+		// Longer chains are better than no sample
+		if (new_table == nullptr)
+			return;
+		for (size_t i = 0; i < table_size; ++i)
+		{
+			T* node = table[i];
+			while (node != nullptr)
+			{
+				T* next = node->next;
+				size_t slot = node->hash & (new_size - 1);
+				node->next = new_table[slot];
+				new_table[slot] = node;
+				node = next;
+			}
+		}
+		SysAlloc::releaseSegment(table, getTableBytes(table_size, sizeof(T*)));
+		table = new_table;
+		table_size = new_size;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	HeapProfiler::Bucket* HeapProfiler::copyBuckets(size_t& count, size_t& bytes)
+	{
+		std::lock_guard<AdaptiveLock> guard(mLock);
+		count = mNumBuckets;
+		if (count == 0)
+			return nullptr;
+		bytes = getTableBytes(count, sizeof(Bucket));
+		Bucket* copy = static_cast<Bucket*>(SysAlloc::reserveCommitSegment(bytes));
+		if (copy == nullptr)
+			return nullptr;
+		size_t index = 0;
+		for (size_t i = 0; i < mBucketTableSize; ++i)
+		{
+			for (Bucket* bucket = mBuckets[i]; bucket != nullptr; bucket = bucket->next)
+				copy[index++] = *bucket;
+		}
+		return copy;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void HeapProfiler::writeProfile(ProfileWriter writer, void* user_data)
+	{
+		// The buckets are written without holding the lock, since the writer may allocate
+		size_t count = 0;
+		size_t bytes = 0;
+		Bucket* buckets = copyBuckets(count, bytes);
+
+		uint64 live_count = 0, live_bytes = 0, total_count = 0, total_bytes = 0;
+		for (size_t i = 0; buckets != nullptr && i < count; ++i)
+		{
+			live_count += buckets[i].live_count;
+			live_bytes += buckets[i].live_bytes;
+			total_count += buckets[i].total_count;
+			total_bytes += buckets[i].total_bytes;
+		}
+
+		char line[128 + (kMaxSampleFrames * 20)];
+		int length = snprintf(line, sizeof(line), "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%llu\n",
+			static_cast<unsigned long long>(live_count), static_cast<unsigned long long>(live_bytes),
+			static_cast<unsigned long long>(total_count), static_cast<unsigned long long>(total_bytes),
+			static_cast<unsigned long long>(mSampleInterval));
+		writer(line, length, user_data);
+
+		for (size_t i = 0; buckets != nullptr && i < count; ++i)
+		{
+			length = snprintf(line, sizeof(line), "%llu: %llu [%llu: %llu] @",
+				static_cast<unsigned long long>(buckets[i].live_count), static_cast<unsigned long long>(buckets[i].live_bytes),
+				static_cast<unsigned long long>(buckets[i].total_count), static_cast<unsigned long long>(buckets[i].total_bytes));
+			for (uint32 j = 0; j < buckets[i].depth; ++j)
+				length += snprintf(line + length, sizeof(line) - length, " 0x%llx",
+					static_cast<unsigned long long>(reinterpret_cast<size_t>(buckets[i].stack[j])));
+			line[length++] = '\n';
+			writer(line, length, user_data);
+		}
+		if (buckets != nullptr)
+			SysAlloc::releaseSegment(buckets, bytes);
+
+#if ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+		// pprof maps the addresses back to the binaries with the memory map of the process
+		static const char kMapsHeader[] = "\nMAPPED_LIBRARIES:\n";
+		writer(kMapsHeader, sizeof(kMapsHeader) - 1, user_data);
+		int fd = open("/proc/self/maps", O_RDONLY);
+		if (fd >= 0)
+		{
+			char buffer[4096];
+			ssize_t read_bytes;
+			while ((read_bytes = read(fd, buffer, sizeof(buffer))) > 0)
+				writer(buffer, static_cast<size_t>(read_bytes), user_data);
+			close(fd);
+		}
+#endif
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	static void writeToFile(const char* text, size_t length, void* user_data)
+	{
+		fwrite(text, 1, length, static_cast<FILE*>(user_data));
+	}
+
+	bool HeapProfiler::writeProfile(const char* path)
+	{
+		FILE* file = fopen(path, "w");
+		if (file == nullptr)
+			return false;
+		writeProfile(&writeToFile, file);
+		bool written = (ferror(file) == 0);
+		return (fclose(file) == 0) && written;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void HeapProfiler::writeCallSites(ProfileWriter writer, void* user_data)
+	{
+		size_t count = 0;
+		size_t bytes = 0;
+		Bucket* buckets = copyBuckets(count, bytes);
+		if (buckets == nullptr)
+			return;
+
+		// Fold the buckets of the same call site into the first one, they only differ by stack
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (buckets[i].depth == 0)
+				continue;
+			for (size_t j = i + 1; j < count; ++j)
+			{
+				if (buckets[j].depth != 0 && buckets[j].line == buckets[i].line &&
+					buckets[j].file_name == buckets[i].file_name && buckets[j].func_name == buckets[i].func_name)
+				{
+					buckets[i].live_count += buckets[j].live_count;
+					buckets[i].live_bytes += buckets[j].live_bytes;
+					buckets[i].total_count += buckets[j].total_count;
+					buckets[i].total_bytes += buckets[j].total_bytes;
+					buckets[j].depth = 0;
+				}
+			}
+
+			char line[512];
+			int length;
+			if (buckets[i].file_name != nullptr)
+				length = snprintf(line, sizeof(line), "%llu: %llu [%llu: %llu] @ %s:%u %s\n",
+					static_cast<unsigned long long>(buckets[i].live_count), static_cast<unsigned long long>(buckets[i].live_bytes),
+					static_cast<unsigned long long>(buckets[i].total_count), static_cast<unsigned long long>(buckets[i].total_bytes),
+					buckets[i].file_name, buckets[i].line, (buckets[i].func_name != nullptr) ? buckets[i].func_name : "");
+			else
+				length = snprintf(line, sizeof(line), "%llu: %llu [%llu: %llu] @ unknown\n",
+					static_cast<unsigned long long>(buckets[i].live_count), static_cast<unsigned long long>(buckets[i].live_bytes),
+					static_cast<unsigned long long>(buckets[i].total_count), static_cast<unsigned long long>(buckets[i].total_bytes));
+			if (length >= static_cast<int>(sizeof(line)))
+			{
+				length = sizeof(line) - 1;
+				line[length - 1] = '\n';
+			}
+			writer(line, length, user_data);
+		}
+		SysAlloc::releaseSegment(buckets, bytes);
+	}
+}
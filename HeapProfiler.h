@@ -0,0 +1,147 @@
+#ifndef _HEAP_PROFILER_H_
+#define _HEAP_PROFILER_H_
+
+#include "DataTypes.h"
+#include "CompileOptions.h"
+#include "AdaptiveLock.h"
+#include <atomic>
+
+#if ODIN_COMPILER == ODIN_COMPILER_MSVC
+#include <intrin.h>
+#define ODIN_RETURN_ADDRESS() _ReturnAddress()
+#elif ODIN_COMPILER == ODIN_COMPILER_GCC
+#define ODIN_RETURN_ADDRESS() __builtin_return_address(0)
+#endif
+
+namespace Odin
+{
+	// Default mean number of bytes allocated between two samples
+	const size_t kDefaultSampleInterval = 524288;
+	// Deepest call stack recorded with a sample
+	const uint32 kMaxSampleFrames = 32;
+
+	/*
+		Sampling heap profiler. About one allocation every sample_interval bytes is sampled, the
+		bytes between two samples following an exponential distribution so that every byte has
+		the same chance of being picked. A sample records the call site passed to the allocator
+		and the address it was called from, or the whole call stack if stacks are captured.
+		Samples sharing a call stack and call site are gathered in one bucket counting its live
+		and its total allocations. Freeing a sampled block removes its sample, a filter keeps
+		the frees of other blocks from taking the lock.
+		All the memory of the profiler comes directly from the system, so it can profile the
+		allocator backing malloc.
+	*/
+	class HeapProfiler
+	{
+	public:
+		// Receives the text of a profile, piece by piece
+		typedef void (*ProfileWriter)(const char* text, size_t length, void* user_data);
+
+		// sample_interval is the mean number of bytes allocated between two samples. If
+		// capture_stacks is true, the call stack of a sample is found by walking the frame
+		// pointers (on Windows the unwind tables are used instead). Code built without frame
+		// pointers (-fno-omit-frame-pointer with gcc) yields truncated stacks.
+		explicit HeapProfiler(size_t sample_interval = kDefaultSampleInterval, bool capture_stacks = false);
+		~HeapProfiler();
+
+		// Allocate the tables of the profiler. Returns false if the system is out of memory.
+		bool init();
+
+		// Count size bytes allocated against countdown, the number of bytes left until the next
+		// sample of the calling thread, 0 if none was drawn yet. Returns true if the allocation
+		// should be sampled.
+		FORCEINLINE bool takeSample(int64& countdown, size_t size)
+		{
+			if (countdown == 0)
+				countdown = getNextInterval();
+			countdown -= static_cast<int64>(size);
+			if (countdown >= 0)
+				return false;
+			countdown = getNextInterval();
+			return true;
+		}
+
+		// Same as above with a countdown shared by the threads which don't keep their own
+		bool takeSample(size_t size);
+
+		// Record a sampled allocation of size bytes at mem. caller is the address the allocator
+		// was called from.
+		void recordAllocation(void* mem, size_t size, void* caller,
+			const char* file_name, uint32 line, const char* func_name);
+
+		// Remove the sample of mem, if it was sampled. Should be called before mem is freed.
+		FORCEINLINE void recordFree(void* mem)
+		{
+			if (mFilter != nullptr && mFilter[getFilterIndex(mem)].load(std::memory_order_relaxed) != 0)
+				removeSample(mem);
+		}
+
+		// Write the samples in the legacy pprof heap profile format (heap_v2). Every line holds
+		// the live and the total sampled allocations of a call stack, so the same profile
+		// shows the live heap (pprof -inuse_space) and the cumulative one (pprof -alloc_space).
+		// pprof scales the sampled counts back up. On Linux the mapped libraries are appended
+		// for symbolization.
+		void writeProfile(ProfileWriter writer, void* user_data);
+
+		// Write the profile to a file. Returns false if the file could not be written.
+		bool writeProfile(const char* path);
+
+		// Write the same counts grouped by the file, line and function passed to the allocator,
+		// one "live_count: live_bytes [total_count: total_bytes] @ file:line function" line
+		// per call site. Allocations made without a call site are shown as "unknown".
+		void writeCallSites(ProfileWriter writer, void* user_data);
+
+		// Return the mean number of bytes allocated between two samples
+		size_t getSampleInterval() const { return mSampleInterval; }
+	private:
+		struct Bucket;
+		struct Sample;
+
+		// Number of counters of the filter of sampled addresses
+		static const uint32 kFilterSize = 16384;
+
+		HeapProfiler(const HeapProfiler&) = delete;
+		HeapProfiler& operator=(const HeapProfiler&) = delete;
+
+		static FORCEINLINE uint32 getFilterIndex(const void* mem)
+		{
+			return static_cast<uint32>(((reinterpret_cast<size_t>(mem) >> 4) * 0x9E3779B1U) >> 8) & (kFilterSize - 1);
+		}
+
+		// Draw the number of bytes until the next sample
+		int64 getNextInterval();
+		// Remove the sample of mem if it has one
+		void removeSample(void* mem);
+		// Find the bucket of a call stack and call site, creating it if required. Lock should be held.
+		Bucket* findBucket(void** stack, uint32 depth, const char* file_name, uint32 line, const char* func_name);
+		// Carve a node out of the node blocks. Lock should be held.
+		void* allocNode(size_t size);
+		// Double the size of a hash table once it holds as many entries as it has slots. Lock should be held.
+		template <typename T>
+		void growTable(T**& table, size_t& table_size, size_t count);
+		// Copy the buckets out under the lock, for writing them without it. The copy is released
+		// with releaseSegment. Returns NULL if there are no buckets or no memory.
+		Bucket* copyBuckets(size_t& count, size_t& bytes);
+
+		size_t mSampleInterval;
+		bool mCaptureStacks;
+		std::atomic<uint64> mRandomState;
+		std::atomic<int64> mSharedCountdown;
+		// Number of sampled blocks hashing to every counter
+		std::atomic<uint32>* mFilter;
+
+		AdaptiveLock mLock;
+		Bucket** mBuckets;
+		size_t mBucketTableSize;
+		size_t mNumBuckets;
+		Sample** mSamples;
+		size_t mSampleTableSize;
+		size_t mNumSamples;
+		Sample* mFreeSamples;
+		// Blocks the nodes are carved from, linked through their first word
+		void* mNodeBlocks;
+		uint8* mNodeCursor;
+		size_t mNodeBytesLeft;
+	};
+}
+#endif	// _HEAP_PROFILER_H_
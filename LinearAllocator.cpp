@@ -3,12 +3,34 @@
 
 namespace Odin
 {
-	LinearAllocator::LinearAllocator(size_t size) : mStart(nullptr), mSize(size)
+	//------------------------------------------------------------------------------------------
+	// Get the address at which an allocation with a header of offset bytes starts, so that the
+	// address past the header is aligned
+	static inline uint8* alignAllocation(uint8* ptr, size_t alignment, size_t offset)
+	{
+		ptr += offset;
+		ptr = reinterpret_cast<uint8*>(((reinterpret_cast<size_t>(ptr) + (alignment - 1)) & ~(alignment - 1)));
+		return ptr - offset;
+	}
+	//------------------------------------------------------------------------------------------
+	LinearAllocator::LinearAllocator(size_t size, bool huge_pages) : mSize(size), mStart(nullptr),
+		mCurrent(nullptr), mEnd(nullptr), mFixedGrowth(size, huge_pages), mHugePages(huge_pages),
+		mGrowable(false), mChainChunks(false), mCommitSize(0), mFirstChunk(nullptr), mChunk(nullptr),
+		mUsedBefore(0)
+	{
+	}
+	//------------------------------------------------------------------------------------------
+	LinearAllocator::LinearAllocator(size_t reserve_size, size_t commit_size, bool chain_chunks,
+		bool huge_pages) : mSize(reserve_size), mStart(nullptr), mCurrent(nullptr), mEnd(nullptr),
+		mFixedGrowth(0), mHugePages(huge_pages), mGrowable(true), mChainChunks(chain_chunks),
+		mCommitSize(commit_size), mFirstChunk(nullptr), mChunk(nullptr), mUsedBefore(0)
 	{
 	}
 	//------------------------------------------------------------------------------------------
-	LinearAllocator::LinearAllocator(void* start, size_t size) : mStart(static_cast<uint8*>(start)),
-		mSize(size)
+	LinearAllocator::LinearAllocator(void* start, size_t size) : mSize(size),
+		mStart(static_cast<uint8*>(start)), mCurrent(static_cast<uint8*>(start)), mEnd(static_cast<uint8*>(start) + size),
+		mFixedGrowth(0), mHugePages(false), mGrowable(false), mChainChunks(false), mCommitSize(0),
+		mFirstChunk(nullptr), mChunk(nullptr), mUsedBefore(0)
 	{
 	}
 	//------------------------------------------------------------------------------------------
@@ -16,13 +38,26 @@ namespace Odin
 	{
 		if (mStart == nullptr)
 		{
-			// Align the size to page granularity
-			// Hardcode it for now to 64kB
-			size_t granularity = 65536;
-			size_t size = (mSize + (granularity - 1)) & ~(granularity - 1);
-			mStart = static_cast<uint8*>(SysAlloc::reserveCommitSegment(size));
-			if (!mStart)
+			if (mGrowable)
+			{
+				Chunk* chunk = createChunk(mSize);
+				if (mBudget != nullptr)
+					mBudget->dispatch();
+				if (chunk == nullptr)
+					return false;
+				// Chained chunks are reserved with the size of the first one
+				mSize = chunk->growth.getReservedSize();
+				mFirstChunk = chunk;
+				enterChunk(chunk);
+				return true;
+			}
+
+			bool success = mFixedGrowth.init(mBudget, mStart, mEnd);
+			if (mBudget != nullptr)
+				mBudget->dispatch();
+			if (!success)
 				return false;
+			mSize = mEnd - mStart;
 			mCurrent = mStart;
 		}
 		return true;
@@ -31,11 +66,23 @@ namespace Odin
 	LinearAllocator::~LinearAllocator()
 	{
 		ASSERT_ERROR(getTotalAllocated() == 0, "Linear allocator has memory leaks");
-		if (mStart)
+		if (mGrowable)
+		{
+			Chunk* chunk = mFirstChunk;
+			while (chunk != nullptr)
+			{
+				Chunk* next = chunk->next;
+				releaseChunk(chunk);
+				chunk = next;
+			}
+			mFirstChunk = mChunk = nullptr;
+		}
+		else
 		{
-			SysAlloc::releaseSegment(static_cast<void*>(mStart), mSize);
-			mStart = mCurrent = nullptr;
+			// Memory passed to the constructor belongs to the caller, the policy holds none of it
+			mFixedGrowth.release(mBudget);
 		}
+		mStart = mCurrent = mEnd = nullptr;
 	}
 	//------------------------------------------------------------------------------------------
 	void* LinearAllocator::allocate(size_t size, size_t alignment, size_t offset,
@@ -45,24 +92,26 @@ namespace Odin
 		ASSERT_ERROR(((alignment & (alignment - 1)) == 0), "Alignment is not a power of 2");
 		if (alignment < kDefaultAlignment)
 			alignment = kDefaultAlignment;
-		// Add sizeof(size_t) to offset for storing the chunk size
+		// Add sizeof(size_t) to offset and size for storing the chunk size
 		offset += sizeof(size_t);
+		size_t total_size = size + sizeof(size_t);
+		if (total_size < size)
+			return nullptr;
 		// Offset pointer first, align it, and offset it back
-		mCurrent += offset;
-		// Get the nearest aligned address
-		mCurrent = reinterpret_cast<uint8*>(((reinterpret_cast<size_t>(mCurrent)+
-			(alignment - 1)) & ~(alignment - 1)));
-		// Now subtract the offset
-		mCurrent -= offset;
-
-		uint8* user_ptr = mCurrent;
-		mCurrent += size;
+		uint8* user_ptr = alignAllocation(mCurrent, alignment, offset);
 
-		if (mCurrent >= (mStart + mSize))
+		if (user_ptr > mEnd || total_size > static_cast<size_t>(mEnd - user_ptr))
 		{
-			// We're out of memory
-			return nullptr;
+			// We're out of memory, unless a growable allocator can commit more
+			if (!mGrowable || mChunk == nullptr)
+				return nullptr;
+			user_ptr = grow(total_size, alignment, offset);
+			if (mBudget != nullptr)
+				mBudget->dispatch();
+			if (user_ptr == nullptr)
+				return nullptr;
 		}
+		mCurrent = user_ptr + total_size;
 
 		// Store the size
 		*(reinterpret_cast<size_t*>(user_ptr)) = size;
@@ -75,6 +124,79 @@ namespace Odin
 		return static_cast<void*>(user_ptr);
 	}
 	//------------------------------------------------------------------------------------------
+	uint8* LinearAllocator::grow(size_t size, size_t alignment, size_t offset)
+	{
+		// Commit more of the current chunk if the allocation fits in its reservation
+		uint8* base = reinterpret_cast<uint8*>(mChunk);
+		uint8* ptr = alignAllocation(mCurrent, alignment, offset);
+		size_t start = ptr - base;
+		size_t reserved = mChunk->growth.getReservedSize();
+		if (start <= reserved && size <= reserved - start)
+			return mChunk->growth.grow(mBudget, ptr + size, mEnd) ? ptr : nullptr;
+		if (!mChainChunks)
+			return nullptr;
+
+		// Move on to the next chunk, reserving one if there is none or it is too small
+		size_t required = sizeof(Chunk) + offset + alignment + size;
+		if (required < size)
+			return nullptr;
+		Chunk* next = mChunk->next;
+		if (next == nullptr || next->growth.getReservedSize() < required)
+		{
+			next = createChunk(required > mSize ? required : mSize);
+			if (next == nullptr)
+				return nullptr;
+			next->next = mChunk->next;
+			mChunk->next = next;
+		}
+		// Stay in the current chunk if the pages can't be committed
+		ptr = alignAllocation(reinterpret_cast<uint8*>(next) + sizeof(Chunk), alignment, offset);
+		uint8* end = nullptr;
+		if (!next->growth.grow(mBudget, ptr + size, end))
+			return nullptr;
+		if (mChunk->high_water < static_cast<size_t>(mCurrent - base))
+			mChunk->high_water = mCurrent - base;
+		mUsedBefore += mCurrent - mStart;
+		enterChunk(next);
+		return ptr;
+	}
+	//------------------------------------------------------------------------------------------
+	LinearAllocator::Chunk* LinearAllocator::createChunk(size_t size)
+	{
+		// The header goes in the first pages, which init commits
+		VirtualGrowth growth(size, mCommitSize, mHugePages);
+		uint8* start = nullptr;
+		uint8* end = nullptr;
+		if (!growth.init(mBudget, start, end))
+			return nullptr;
+		return new (start) Chunk(growth);
+	}
+	//------------------------------------------------------------------------------------------
+	void LinearAllocator::releaseChunk(Chunk* chunk)
+	{
+		// The chunk header goes away with the memory space
+		VirtualGrowth growth = chunk->growth;
+		growth.release(mBudget);
+	}
+	//------------------------------------------------------------------------------------------
+	void LinearAllocator::enterChunk(Chunk* chunk)
+	{
+		uint8* base = reinterpret_cast<uint8*>(chunk);
+		mChunk = chunk;
+		mStart = mCurrent = base + sizeof(Chunk);
+		mEnd = base + chunk->growth.getCommittedSize();
+	}
+	//------------------------------------------------------------------------------------------
+	size_t LinearAllocator::getCommittedSize() const
+	{
+		if (!mGrowable)
+			return mFixedGrowth.getCommittedSize();
+		size_t committed = 0;
+		for (Chunk* chunk = mFirstChunk; chunk != nullptr; chunk = chunk->next)
+			committed += chunk->growth.getCommittedSize();
+		return committed;
+	}
+	//------------------------------------------------------------------------------------------
 	void* LinearAllocator::callocate(size_t num_elements, size_t elem_size,
 		const char* file_name, uint32 line, const char* func_name)
 	{
@@ -88,8 +210,74 @@ namespace Odin
 	//------------------------------------------------------------------------------------------
 	void LinearAllocator::reset(void)
 	{
-		// Reset the pointer to the start
-		mCurrent = mStart;
+		if (!mGrowable || mChunk == nullptr)
+		{
+			// Reset the pointer to the start
+			mCurrent = mStart;
+			return;
+		}
+		uint8* base = reinterpret_cast<uint8*>(mChunk);
+		if (mChunk->high_water < static_cast<size_t>(mCurrent - base))
+			mChunk->high_water = mCurrent - base;
+
+		// Trim every chunk down to its recent high-water marks. The first chunk is always kept.
+		// A chained one is released once it went unused for as many rounds as the pages of a
+		// chunk are kept, except for the first unused one which stays as a spare.
+		bool kept_spare = false;
+		Chunk** link = &mFirstChunk;
+		while (*link != nullptr)
+		{
+			Chunk* chunk = *link;
+			if (chunk != mFirstChunk && chunk->high_water == 0)
+			{
+				if (kept_spare && ++chunk->idle_resets >= VirtualGrowth::kResetHistory)
+				{
+					*link = chunk->next;
+					releaseChunk(chunk);
+					continue;
+				}
+				kept_spare = true;
+			}
+			else
+				chunk->idle_resets = 0;
+			uint8* end = nullptr;
+			chunk->growth.reset(mBudget, reinterpret_cast<uint8*>(chunk) + chunk->high_water, end);
+			chunk->high_water = 0;
+			link = &chunk->next;
+		}
+		mUsedBefore = 0;
+		enterChunk(mFirstChunk);
+	}
+	//------------------------------------------------------------------------------------------
+	void LinearAllocator::rewind()
+	{
+		if (!mGrowable || mChunk == nullptr)
+		{
+			mCurrent = mStart;
+			return;
+		}
+		// The high-water mark keeps growing until the next reset
+		uint8* base = reinterpret_cast<uint8*>(mChunk);
+		if (mChunk->high_water < static_cast<size_t>(mCurrent - base))
+			mChunk->high_water = mCurrent - base;
+		mUsedBefore = 0;
+		enterChunk(mFirstChunk);
+	}
+	//------------------------------------------------------------------------------------------
+	size_t LinearAllocator::purge()
+	{
+		if (!mGrowable || mChunk == nullptr)
+			return 0;
+		// Nothing is allocated above the current position or in the chunks after the current one
+		size_t released = mChunk->growth.purge(mBudget, mCurrent, mEnd);
+		while (mChunk->next != nullptr)
+		{
+			Chunk* next = mChunk->next;
+			mChunk->next = next->next;
+			released += next->growth.getCommittedSize();
+			releaseChunk(next);
+		}
+		return released;
 	}
 	//------------------------------------------------------------------------------------------
 	size_t LinearAllocator::getAllocSize(void* mem)
@@ -101,6 +289,6 @@ namespace Odin
 	//------------------------------------------------------------------------------------------
 	size_t LinearAllocator::getTotalAllocated()
 	{
-		return (mCurrent - mStart);
+		return mUsedBefore + (mCurrent - mStart);
 	}
 }
\ No newline at end of file
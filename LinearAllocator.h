@@ -5,17 +5,27 @@
 #include "Assert.h"
 #include "SysAlloc.h"
 #include "Allocator.h"
+#include "GrowthPolicy.h"
 
 namespace Odin
 {
-	// The memory region handled by this allocator can never grow. Also, individual
-	// allocations can never be freed. All allocations are freed at once by calling "reset".
-	// "free" is just an empty function.
+	// Individual allocations can never be freed. All allocations are freed at once by calling
+	// "reset". "free" is just an empty function.
+	// A fixed allocator commits its whole memory region up front and can never grow (FixedGrowth).
+	// A growable allocator reserves a region of address space and commits it as the allocations
+	// advance (VirtualGrowth), optionally chaining more regions (chunks) once the reservation is
+	// used up.
 	class LinearAllocator : public Allocator
 	{
 	public:
-		// Allocate virtual memory for the given size
-		explicit LinearAllocator(size_t size);
+		// Allocate virtual memory for the given size. If huge_pages is true, the memory
+		// is backed by huge pages when the system has them available.
+		explicit LinearAllocator(size_t size, bool huge_pages = false);
+
+		// Growable allocator reserving reserve_size bytes of address space and committing them
+		// commit_size bytes at a time as the allocations advance. If chain_chunks is true, another
+		// chunk of at least reserve_size bytes is reserved when the reservation runs out.
+		LinearAllocator(size_t reserve_size, size_t commit_size, bool chain_chunks, bool huge_pages = false);
 		virtual ~LinearAllocator();
 
 		// Initialize the allocator
@@ -41,16 +51,70 @@ namespace Odin
 		// Return the total amount of memory allocated by this allocator
 		virtual size_t getTotalAllocated();
 
-		// Function to clear all the allocated memory
-		void reset(void);
-	private:
-		// The total size of memory Space
+		// Return the committed pages above the current allocation and the chained chunks which
+		// aren't in use to the system. Returns the number of bytes released.
+		virtual size_t purge();
+
+		// Function to clear all the allocated memory. A growable allocator trims every chunk
+		// down to its recent high-water marks as VirtualGrowth::reset does, and releases the
+		// chained chunks which went unused for as many resets, keeping one spare.
+		virtual void reset(void);
+
+		// Free all the allocations without giving any memory back: only the allocation pointer
+		// moves back to the start of the first chunk. The committed pages and chained chunks stay
+		// for the next round until reset or purge trims them.
+		void rewind();
+
+		// Return the number of bytes committed
+		size_t getCommittedSize() const;
+	protected:
+		// The total size of memory Space, or the reservation of a chunk for growable allocators
 		size_t mSize;
-		// The starting address of Memory Space
+		// The starting address of Memory Space, or of the current chunk past its header
 		uint8* mStart;
 		// The current starting address of the free chunk
 		uint8* mCurrent;
+		// The end of the memory allocations can be made from without committing more
+		uint8* mEnd;
+	private:
+		// Header at the start of every chunk of a growable allocator
+		struct Chunk
+		{
+			explicit Chunk(const VirtualGrowth& chunk_growth) : next(nullptr), growth(chunk_growth),
+				high_water(0), idle_resets(0) {}
+
+			Chunk* next;			// Next chunk in allocation order
+			VirtualGrowth growth;	// Memory space of the chunk, starting at the header
+			size_t high_water;		// Highest offset allocated from since the last reset
+			uint32 idle_resets;		// Resets in a row the chunk went unused
+		};
+
+		// Growable allocator slow path: commit more of the current chunk or move to a chunk with
+		// room for size bytes at alignment and offset. Returns the new start of the allocation,
+		// or NULL if the memory could not be committed.
+		uint8* grow(size_t size, size_t alignment, size_t offset);
+		// Reserve a chunk of at least size bytes and commit its first pages
+		Chunk* createChunk(size_t size);
+		// Return a chunk to the system
+		void releaseChunk(Chunk* chunk);
+		// Make chunk the one allocations are made from
+		void enterChunk(Chunk* chunk);
+
+		// Memory space of a fixed allocator, unused for memory passed to the constructor
+		FixedGrowth mFixedGrowth;
+		// Back the chunks of a growable allocator with huge pages
+		bool mHugePages;
+		// Commit the memory space as it is used, chaining chunks if chain_chunks is set
+		bool mGrowable;
+		bool mChainChunks;
+		// Bytes committed at a time by a growable allocator
+		size_t mCommitSize;
+		// Chunks of a growable allocator, and the one allocations are made from
+		Chunk* mFirstChunk;
+		Chunk* mChunk;
+		// Bytes allocated from the chunks before the current one
+		size_t mUsedBefore;
 	};
 }
 
-#endif	_LINEAR_ALLOCATOR_H_
\ No newline at end of file
+#endif	// _LINEAR_ALLOCATOR_H_
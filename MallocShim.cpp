@@ -0,0 +1,443 @@
+#include "GeneralAllocator.h"
+#include "PageMap.h"
+#include "SizeClass.h"
+#include "SysAlloc.h"
+#include "ThreadCache.h"
+
+/*
+	Replaces malloc, free and the global operator new and delete of the whole process with a
+	process-wide GeneralAllocator. Build this file together with the allocator sources as a
+	shared library and load it with LD_PRELOAD (see the README). Linux only.
+
+	The allocator is created on the first call. Calls made while it is being created, for
+	instance by the C library while the processor count is read, are served from a small
+	static arena whose blocks are never freed.
+
+	fork() is bracketed by pthread_atfork handlers which hold every lock of the allocator, so
+	that the child never starts with a lock owned by a thread that doesn't exist there. Blocks
+	in the thread caches of the other threads are lost to the child.
+*/
+
+#if ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <pthread.h>
+#include <unistd.h>
+
+#define ODIN_SHIM_EXPORT extern "C" __attribute__((visibility("default")))
+
+namespace Odin
+{
+	namespace MallocShim
+	{
+		// Alignment malloc guarantees
+		const size_t kMallocAlignment = alignof(std::max_align_t);
+		static_assert(kChunkAlignment >= kMallocAlignment, "dlmalloc chunks don't have the alignment of malloc");
+
+		// Size classes which are all multiples of kMallocAlignment, so that slab objects are
+		// aligned to it without asking for alignment
+		static const SizeClassTable kShimSizeClasses =
+		{
+			20,
+			{
+				16, 32, 48, 64, 80, 96, 112, 128, 160, 192,
+				224, 256, 320, 384, 448, 512, 640, 768, 896, 1024
+			}
+		};
+
+		//------------------------------------------------------------------------------------------
+		// Bootstrap arena
+		// Every block is preceded by a header holding its size
+		const size_t kBootstrapBytes = 65536;
+		const size_t kBootstrapHeader = 16;
+		alignas(16) static uint8 sBootstrap[kBootstrapBytes];
+		static std::atomic<size_t> sBootstrapUsed(0);
+
+		static bool isBootstrapBlock(void* mem)
+		{
+			uint8* ptr = static_cast<uint8*>(mem);
+			return ptr >= sBootstrap && ptr < sBootstrap + kBootstrapBytes;
+		}
+
+		static void* bootstrapAlloc(size_t size, size_t alignment)
+		{
+			if (alignment < kBootstrapHeader)
+				alignment = kBootstrapHeader;
+			size_t used = sBootstrapUsed.load(std::memory_order_relaxed);
+			size_t start;
+			size_t end;
+			do
+			{
+				start = (used + kBootstrapHeader + (alignment - 1)) & ~(alignment - 1);
+				end = start + ((size + (kBootstrapHeader - 1)) & ~(kBootstrapHeader - 1));
+				if (end > kBootstrapBytes || end < start)
+					return nullptr;
+			} while (!sBootstrapUsed.compare_exchange_weak(used, end, std::memory_order_relaxed));
+			*reinterpret_cast<size_t*>(sBootstrap + start - sizeof(size_t)) = size;
+			return sBootstrap + start;
+		}
+
+		static size_t getBootstrapSize(void* mem)
+		{
+			return *reinterpret_cast<size_t*>(static_cast<uint8*>(mem) - sizeof(size_t));
+		}
+
+		//------------------------------------------------------------------------------------------
+		// Process-wide allocator
+		// It is never destroyed, since frees keep coming until the very end of the process
+		enum AllocatorState
+		{
+			STATE_UNINITIALIZED,
+			STATE_INITIALIZING,
+			STATE_READY,
+			STATE_FAILED
+		};
+
+		static std::atomic<int> sState(STATE_UNINITIALIZED);
+		alignas(GeneralAllocator) static uint8 sAllocatorStorage[sizeof(GeneralAllocator)];
+		static GeneralAllocator* sAllocator = nullptr;
+
+		//------------------------------------------------------------------------------------------
+		// fork handlers
+		// The locks are taken in the order the allocator nests them: thread cache registry,
+		// the instances, segment cache
+
+		static void prepareFork()
+		{
+			ThreadCaches::lockRegistry();
+			sAllocator->lockAll();
+			SysAlloc::lockSegmentCache();
+		}
+
+		static void resumeParentAfterFork()
+		{
+			SysAlloc::unlockSegmentCache();
+			sAllocator->unlockAll();
+			ThreadCaches::unlockRegistry();
+		}
+
+		static void resumeChildAfterFork()
+		{
+			// The only thread of the child is a copy of the one which took the locks
+			SysAlloc::unlockSegmentCache();
+			sAllocator->unlockAll();
+			ThreadCaches::unlockRegistry();
+		}
+
+		// Get the allocator, creating it on the first call. Returns NULL while it is being
+		// created or if it couldn't be created.
+		static GeneralAllocator* getAllocator()
+		{
+			if (sState.load(std::memory_order_acquire) == STATE_READY)
+				return sAllocator;
+
+			int state = STATE_UNINITIALIZED;
+			if (!sState.compare_exchange_strong(state, STATE_INITIALIZING, std::memory_order_acquire))
+				return (state == STATE_READY) ? sAllocator : nullptr;
+
+			// One shard per processor
+			GeneralAllocator* allocator = new (sAllocatorStorage) GeneralAllocator(0, 0, 0, 0, false, 0, &kShimSizeClasses);
+			if (!allocator->init())
+			{
+				sState.store(STATE_FAILED, std::memory_order_release);
+				return nullptr;
+			}
+			sAllocator = allocator;
+			sState.store(STATE_READY, std::memory_order_release);
+			// Registered once the allocator is ready, since the handlers use it
+			pthread_atfork(prepareFork, resumeParentAfterFork, resumeChildAfterFork);
+			return allocator;
+		}
+
+		// Get the allocator if it has been created
+		static GeneralAllocator* getReadyAllocator()
+		{
+			return (sState.load(std::memory_order_acquire) == STATE_READY) ? sAllocator : nullptr;
+		}
+
+		//------------------------------------------------------------------------------------------
+		// Route a request to the allocator. alignment is a power of two.
+		static void* allocate(size_t size, size_t alignment)
+		{
+			GeneralAllocator* allocator = getAllocator();
+			if (allocator == nullptr)
+				return bootstrapAlloc(size, alignment);
+			if (alignment > kMallocAlignment)
+				return allocator->allocate(size, alignment, 0);
+			// Slab objects are multiples of kMallocAlignment and dlmalloc chunks are aligned to it
+			return allocator->allocate(size, kDefaultAlignment, 0);
+		}
+
+		static void deallocate(void* mem)
+		{
+			if (mem == nullptr || isBootstrapBlock(mem))
+				return;
+			// Blocks which don't belong to the allocator can't be freed, leak them
+			GeneralAllocator* allocator = getReadyAllocator();
+			if (allocator == nullptr || PageMap::getOwner(mem) == nullptr)
+				return;
+			allocator->deallocate(mem);
+		}
+
+		static size_t getSize(void* mem)
+		{
+			if (mem == nullptr)
+				return 0;
+			if (isBootstrapBlock(mem))
+				return getBootstrapSize(mem);
+			GeneralAllocator* allocator = getReadyAllocator();
+			if (allocator == nullptr || PageMap::getOwner(mem) == nullptr)
+				return 0;
+			return allocator->getAllocSize(mem);
+		}
+
+		static void* reallocate(void* mem, size_t size)
+		{
+			if (mem == nullptr)
+				return allocate(size, kMallocAlignment);
+			if (size == 0)
+			{
+				deallocate(mem);
+				return nullptr;
+			}
+
+			GeneralAllocator* allocator = getAllocator();
+			if (allocator == nullptr || isBootstrapBlock(mem))
+			{
+				// Move bootstrap blocks to the allocator as soon as it is up
+				void* new_mem = allocate(size, kMallocAlignment);
+				if (new_mem != nullptr)
+				{
+					size_t old_size = getSize(mem);
+					memcpy(new_mem, mem, (old_size < size) ? old_size : size);
+					deallocate(mem);
+				}
+				return new_mem;
+			}
+			if (PageMap::getOwner(mem) == nullptr)
+				return nullptr;
+			return allocator->reallocate(mem, size, kDefaultAlignment);
+		}
+
+		static bool isValidAlignment(size_t alignment)
+		{
+			return alignment != 0 && (alignment & (alignment - 1)) == 0;
+		}
+
+		// operator new loops on the new handler until the allocation succeeds
+		static void* allocateOrThrow(size_t size, size_t alignment)
+		{
+			for (;;)
+			{
+				void* mem = allocate(size, alignment);
+				if (mem != nullptr)
+					return mem;
+				std::new_handler handler = std::get_new_handler();
+				if (handler == nullptr)
+					throw std::bad_alloc();
+				handler();
+			}
+		}
+	}
+}
+
+using namespace Odin;
+
+//------------------------------------------------------------------------------------------
+// C allocation functions
+
+ODIN_SHIM_EXPORT void* malloc(size_t size)
+{
+	void* mem = MallocShim::allocate(size, MallocShim::kMallocAlignment);
+	if (mem == nullptr)
+		errno = ENOMEM;
+	return mem;
+}
+
+ODIN_SHIM_EXPORT void free(void* mem)
+{
+	MallocShim::deallocate(mem);
+}
+
+ODIN_SHIM_EXPORT void* calloc(size_t num_elements, size_t elem_size)
+{
+	size_t size = num_elements * elem_size;
+	if (elem_size != 0 && size / elem_size != num_elements)
+	{
+		errno = ENOMEM;
+		return nullptr;
+	}
+	void* mem = MallocShim::allocate(size, MallocShim::kMallocAlignment);
+	if (mem == nullptr)
+	{
+		errno = ENOMEM;
+		return nullptr;
+	}
+	// Blocks are recycled, so they have to be cleared
+	memset(mem, 0, size);
+	return mem;
+}
+
+ODIN_SHIM_EXPORT void* realloc(void* mem, size_t size)
+{
+	void* new_mem = MallocShim::reallocate(mem, size);
+	if (new_mem == nullptr && size != 0)
+		errno = ENOMEM;
+	return new_mem;
+}
+
+ODIN_SHIM_EXPORT int posix_memalign(void** out, size_t alignment, size_t size)
+{
+	if (!MallocShim::isValidAlignment(alignment) || (alignment % sizeof(void*)) != 0)
+		return EINVAL;
+	void* mem = MallocShim::allocate(size, alignment);
+	if (mem == nullptr)
+		return ENOMEM;
+	*out = mem;
+	return 0;
+}
+
+ODIN_SHIM_EXPORT void* aligned_alloc(size_t alignment, size_t size)
+{
+	if (!MallocShim::isValidAlignment(alignment))
+	{
+		errno = EINVAL;
+		return nullptr;
+	}
+	void* mem = MallocShim::allocate(size, alignment);
+	if (mem == nullptr)
+		errno = ENOMEM;
+	return mem;
+}
+
+// Obsolete glibc functions, replaced too so that their blocks never reach the glibc free
+ODIN_SHIM_EXPORT void* memalign(size_t alignment, size_t size)
+{
+	return aligned_alloc(alignment, size);
+}
+
+ODIN_SHIM_EXPORT void* valloc(size_t size)
+{
+	return aligned_alloc(static_cast<size_t>(sysconf(_SC_PAGESIZE)), size);
+}
+
+ODIN_SHIM_EXPORT void* pvalloc(size_t size)
+{
+	size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	return aligned_alloc(page_size, (size + (page_size - 1)) & ~(page_size - 1));
+}
+
+ODIN_SHIM_EXPORT size_t malloc_usable_size(void* mem)
+{
+	return MallocShim::getSize(mem);
+}
+
+//------------------------------------------------------------------------------------------
+// Global operator new and delete
+
+void* operator new(size_t size)
+{
+	return MallocShim::allocateOrThrow(size, MallocShim::kMallocAlignment);
+}
+
+void* operator new[](size_t size)
+{
+	return MallocShim::allocateOrThrow(size, MallocShim::kMallocAlignment);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return MallocShim::allocate(size, MallocShim::kMallocAlignment);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return MallocShim::allocate(size, MallocShim::kMallocAlignment);
+}
+
+void operator delete(void* mem) noexcept
+{
+	MallocShim::deallocate(mem);
+}
+
+void operator delete[](void* mem) noexcept
+{
+	MallocShim::deallocate(mem);
+}
+
+void operator delete(void* mem, const std::nothrow_t&) noexcept
+{
+	MallocShim::deallocate(mem);
+}
+
+void operator delete[](void* mem, const std::nothrow_t&) noexcept
+{
+	MallocShim::deallocate(mem);
+}
+
+void operator delete(void* mem, size_t) noexcept
+{
+	MallocShim::deallocate(mem);
+}
+
+void operator delete[](void* mem, size_t) noexcept
+{
+	MallocShim::deallocate(mem);
+}
+
+#if defined(__cpp_aligned_new)
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	return MallocShim::allocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+	return MallocShim::allocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return MallocShim::allocate(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return MallocShim::allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* mem, std::align_val_t) noexcept
+{
+	MallocShim::deallocate(mem);
+}
+
+void operator delete[](void* mem, std::align_val_t) noexcept
+{
+	MallocShim::deallocate(mem);
+}
+
+void operator delete(void* mem, size_t, std::align_val_t) noexcept
+{
+	MallocShim::deallocate(mem);
+}
+
+void operator delete[](void* mem, size_t, std::align_val_t) noexcept
+{
+	MallocShim::deallocate(mem);
+}
+
+void operator delete(void* mem, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	MallocShim::deallocate(mem);
+}
+
+void operator delete[](void* mem, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	MallocShim::deallocate(mem);
+}
+#endif
+
+#endif	// ODIN_PLATFORM == ODIN_PLATFORM_LINUX
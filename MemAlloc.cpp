@@ -1,6 +1,9 @@
 #include "DataTypes.h"
 #include "MemAlloc.h"
 #include "Assert.h"
+#include "PageMap.h"
+#include <ctime>
+#include <cstring>
 
 #if ODIN_COMPILER == ODIN_COMPILER_MSVC
 // Store the current warning settings
@@ -16,7 +19,7 @@ namespace Odin
 	const uint32 kTreeBinShift = 8;
 	const size_t kSizeTBitSize = sizeof(size_t) << 3;
 	// Alignment mask
-	const size_t kAlignmentMask = (kDefaultAlignment - 1);
+	const size_t kAlignmentMask = (kChunkAlignment - 1);
 	// Chunk overhead for any allocation
 	const size_t kChunkOverhead = sizeof(size_t) << 1;
 	const size_t kMinLargeSize = 1 << kTreeBinShift;
@@ -47,6 +50,7 @@ namespace Odin
 		MemoryTreeChunk* child[2];	// The two children of this node
 		MemoryTreeChunk* parent;	// Parent of this node
 		uint32 index;				// Index in the tree bin
+		uint32 decay_step;			// Decay step at which the chunk was put in the tree bin
 	};
 
 	const size_t kMinChunkSize = (sizeof(MemoryChunk)+kAlignmentMask)  & ~kAlignmentMask;
@@ -55,16 +59,22 @@ namespace Odin
 	const size_t kMaxRequest = (-kMinChunkSize) << 2;
 	const size_t kMinRequest = kMinChunkSize - kChunkOverhead - 1;
 
+	// Number of bytes at the end of top kept committed after a free
+	const size_t kDefaultTrimThreshold = 2097152;
+	// Bytes at the start of a free chunk holding its links, they are never decommitted
+	const size_t kFreeChunkHeaderSize = sizeof(MemoryTreeChunk);
+
 	// Pad requested number of bytes into a usable size
 	static FORCEINLINE size_t padRequest(size_t size)
 	{
 		return ((size + kChunkOverhead + kAlignmentMask) & ~kAlignmentMask);
 	}
 
-	// Pad request, checking for minimum or maximum
+	// Pad request, checking for minimum or maximum. Requests up to kMinRequest bytes fit in a
+	// minimum size chunk, larger ones are padded as alloc pads them.
 	static FORCEINLINE size_t requestToSize(size_t size)
 	{
-		if (size < kMinChunkSize)
+		if (size < kMinRequest)
 			return kMinChunkSize;
 		else
 			return padRequest(size);
@@ -121,7 +131,7 @@ namespace Odin
 	static FORCEINLINE size_t alignmentOffset(size_t ptr_addr)
 	{
 		return ((ptr_addr & kAlignmentMask) == 0) ? 0 :
-			((kDefaultAlignment - (ptr_addr & kAlignmentMask)) & kAlignmentMask);
+			((kChunkAlignment - (ptr_addr & kAlignmentMask)) & kAlignmentMask);
 	}
 	//--------------------------------------------------------------------------------------------------------------
 	// Bin Indexing
@@ -168,6 +178,18 @@ namespace Odin
 				((static_cast<uint32>(size) >> (static_cast<uint32>(bit_index)+
 				(kTreeBinShift - 1)) & 1)));
 		}
+#elif ODIN_COMPILER == ODIN_COMPILER_GCC
+		size_t index = size >> kTreeBinShift;
+		if (index == 0)
+			return 0;
+		else if (index > 0xFFFF)
+			return kNumTreeBins - 1;
+		else
+		{
+			uint32 bit_index = 31 - static_cast<uint32>(__builtin_clz(static_cast<uint32>(index)));
+			return static_cast<uint32>((bit_index << 1) +
+				((static_cast<uint32>(size) >> (bit_index + (kTreeBinShift - 1)) & 1)));
+		}
 #endif
 	}
 
@@ -310,9 +332,28 @@ namespace Odin
 		unsigned long index;
 		_BitScanForward(&index, mask);
 		return static_cast<uint32>(index);
+#elif ODIN_COMPILER == ODIN_COMPILER_GCC
+		return static_cast<uint32>(__builtin_ctz(mask));
 #endif
 	}
 	//--------------------------------------------------------------------------------------------------------------
+	// Helper functions to walk segments
+
+	// Return the first chunk of a segment, which follows the chunk holding the MemorySpace in
+	// the first segment and the one holding the MemorySegment in the others
+	static FORCEINLINE MemoryChunk* firstChunk(MemorySpace* msp, MemorySegment* seg)
+	{
+		void* record = (seg == &msp->seg) ? static_cast<void*>(msp) : static_cast<void*>(seg);
+		return nextChunk(memoryToChunk(record));
+	}
+
+	// Return the fencepost closing a segment which doesn't hold top. The chunks of the segment
+	// end there, or right at the end of the segment if the old top was too small to be freed.
+	static FORCEINLINE uint8* segmentFence(MemorySegment* seg)
+	{
+		return seg->base + seg->size - kChunkOverhead;
+	}
+	//--------------------------------------------------------------------------------------------------------------
 	// Helper functions to validate chunks
 
 	// Check properties of top chunk
@@ -359,7 +400,7 @@ namespace Odin
 				ASSERT_ERROR((ptr->bk->fd == ptr), "Fd/bk pointer error");
 			}
 			else
-				ASSERT_ERROR((size == sizeof(size_t), "Marker is not equal to sizeof(size_t)"));
+				ASSERT_ERROR(size == sizeof(size_t), "Marker is not equal to sizeof(size_t)");
 		}
 	}
 
@@ -529,28 +570,29 @@ namespace Odin
 	{
 		size_t size_sum = 0;
 		size_sum += msp->top_size;
-		MemoryChunk* curr_ptr = memoryToChunk(reinterpret_cast<void*>(msp));	// Get the chunk for MemorySpace struct
-		curr_ptr = nextChunk(curr_ptr);											// Get the next chunk (first allocatable chunk)
-		MemoryChunk* last_ptr = nullptr;
-		ASSERT_ERROR(getPInuse(curr_ptr), "The first chunk in the segment does not have its PINUSE bit set");
-		while (reinterpret_cast<uint8*>(curr_ptr) >= msp->least_addr && 
-			reinterpret_cast<uint8*>(curr_ptr) <= msp->least_addr + msp->footprint && 
-			curr_ptr != msp->top)
-		{
-			size_sum += chunkSize(curr_ptr);
-			if(isInuse(curr_ptr))
-			{
-				ASSERT_ERROR(!findInBin(msp, curr_ptr), "In use chunk present in free bin");
-				checkInuseChunk(msp, curr_ptr);
-			}
-			else
+		for (MemorySegment* seg = &msp->seg; seg != nullptr; seg = seg->next)
+		{
+			MemoryChunk* curr_ptr = firstChunk(msp, seg);		// Get the first allocatable chunk of the segment
+			MemoryChunk* last_ptr = nullptr;
+			ASSERT_ERROR(getPInuse(curr_ptr), "The first chunk in the segment does not have its PINUSE bit set");
+			// The segment holding top ends with it, the others with a fencepost
+			while (reinterpret_cast<uint8*>(curr_ptr) < segmentFence(seg) && curr_ptr != msp->top)
 			{
-				ASSERT_ERROR((curr_ptr == msp->dv) || (findInBin(msp, curr_ptr)), "Free chunk is neither DV nor is present in free bin");
-				ASSERT_ERROR((last_ptr == 0) || isInuse(last_ptr), "Two consecutive free chunks present");
-				checkFreeChunk(msp, curr_ptr);
+				size_sum += chunkSize(curr_ptr);
+				if(isInuse(curr_ptr))
+				{
+					ASSERT_ERROR(!findInBin(msp, curr_ptr), "In use chunk present in free bin");
+					checkInuseChunk(msp, curr_ptr);
+				}
+				else
+				{
+					ASSERT_ERROR((curr_ptr == msp->dv) || (findInBin(msp, curr_ptr)), "Free chunk is neither DV nor is present in free bin");
+					ASSERT_ERROR((last_ptr == 0) || isInuse(last_ptr), "Two consecutive free chunks present");
+					checkFreeChunk(msp, curr_ptr);
+				}
+				last_ptr = curr_ptr;
+				curr_ptr = nextChunk(curr_ptr);
 			}
-			last_ptr = curr_ptr;
-			curr_ptr = nextChunk(curr_ptr);
 		}
 		return size_sum;
 	}
@@ -613,6 +655,7 @@ namespace Odin
 		uint32 index = computeTreeIndex(size);
 		MemoryTreeChunk** ptr_to_bin = treeBinAt(msp, index);
 		ptr->index = index;
+		ptr->decay_step = msp->decay_step;
 		ptr->child[0] = ptr->child[1] = 0;
 		if (!isTreeMapMarked(msp, index))
 		{
@@ -766,6 +809,197 @@ namespace Odin
 		msp->dv = ptr;
 	}
 	//--------------------------------------------------------------------------------------------------------------
+	// Charge bytes to the budget of msp, if it has one. Returns false if the hard limit refuses them.
+	static FORCEINLINE bool chargeBudget(MemorySpace* msp, size_t bytes)
+	{
+		return (msp->budget == nullptr) || msp->budget->charge(bytes);
+	}
+
+	static FORCEINLINE void releaseBudget(MemorySpace* msp, size_t bytes)
+	{
+		if (msp->budget != nullptr)
+			msp->budget->release(bytes);
+	}
+
+	// Bytes of the pages committed in all the segments. Lock should be held by the caller.
+	static size_t getCommittedBytes(MemorySpace* msp)
+	{
+		size_t pages = 0;
+		for (MemorySegment* seg = &msp->seg; seg != nullptr; seg = seg->next)
+			pages += seg->curr_page_index - seg->decommitted_pages;
+		return pages * msp->page_size;
+	}
+
+	// Return the segment holding addr. Most lookups are for chunks near top, so its segment
+	// is tried first.
+	static FORCEINLINE MemorySegment* segmentHolding(MemorySpace* msp, uint8* addr)
+	{
+		MemorySegment* seg = msp->top_seg;
+		if (addr >= seg->base && addr < seg->base + seg->size)
+			return seg;
+		for (seg = &msp->seg; seg != nullptr; seg = seg->next)
+		{
+			if (addr >= seg->base && addr < seg->base + seg->size)
+				return seg;
+		}
+		ASSERT_ERROR(false, "Address is outside of the segments of the MemorySpace");
+		return msp->top_seg;
+	}
+
+	//--------------------------------------------------------------------------------------------------------------
+	// Commit every page of the top segment lying below end_addr which is not committed yet.
+	// Pages are committed one at a time since the range may span several adjacent reservations.
+	// Returns false if the system refused to commit the pages.
+	static bool commitPagesUpTo(MemorySpace* msp, uint8* end_addr)
+	{
+		MemorySegment* seg = msp->top_seg;
+		uint8* segment_end = seg->base + seg->size;
+		if (end_addr > segment_end)
+			end_addr = segment_end;
+		uint8* committed_end = seg->base + (seg->curr_page_index * msp->page_size);
+		while (committed_end < end_addr)
+		{
+			if (!chargeBudget(msp, msp->page_size))
+				return false;
+			if (!SysAlloc::commitPage(reinterpret_cast<void*>(committed_end), msp->page_size))
+			{
+				releaseBudget(msp, msp->page_size);
+				return false;
+			}
+			committed_end += msp->page_size;
+			++seg->curr_page_index;
+		}
+		return true;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	// Decommitted page bookkeeping. A free chunk gives back the whole pages between its links and
+	// the page holding its footer, and a bit in the decommit_map of its segment records each of
+	// them. Splitting a free chunk recommits the pages the allocated part and the links of the
+	// remainder land on.
+
+	static FORCEINLINE bool isPageDecommitted(MemorySegment* seg, size_t index)
+	{
+		return (seg->decommit_map[index >> 5] & (1U << (index & 31))) != 0;
+	}
+
+	static FORCEINLINE void setPageDecommitted(MemorySegment* seg, size_t index, bool decommitted)
+	{
+		if (decommitted)
+		{
+			seg->decommit_map[index >> 5] |= (1U << (index & 31));
+			++seg->decommitted_pages;
+		}
+		else
+		{
+			seg->decommit_map[index >> 5] &= ~(1U << (index & 31));
+			--seg->decommitted_pages;
+		}
+	}
+
+	// Recommit the decommitted pages overlapping begin to end, which lie in one segment.
+	// Returns false if the system refused to commit the pages.
+	static bool recommitPages(MemorySpace* msp, uint8* begin, uint8* end)
+	{
+		MemorySegment* seg = segmentHolding(msp, begin);
+		if (seg->decommitted_pages == 0)
+			return true;
+		size_t first = (begin - seg->base) / msp->page_size;
+		size_t last = (end - seg->base + (msp->page_size - 1)) / msp->page_size;
+		if (last > kMaxDecommitPages)
+			last = kMaxDecommitPages;
+		for (size_t i = first; i < last; ++i)
+		{
+			if (isPageDecommitted(seg, i))
+			{
+				if (!chargeBudget(msp, msp->page_size))
+					return false;
+				if (!SysAlloc::commitPage(seg->base + (i * msp->page_size), msp->page_size))
+				{
+					releaseBudget(msp, msp->page_size);
+					return false;
+				}
+				setPageDecommitted(seg, i, false);
+			}
+		}
+		return true;
+	}
+
+	// Recommit the pages of a size bytes free chunk which a split of its first nb bytes touches
+	static FORCEINLINE bool recommitSplit(MemorySpace* msp, MemoryChunk* ptr, size_t size, size_t nb)
+	{
+		size_t used = nb + kFreeChunkHeaderSize;
+		if (used > size)
+			used = size;
+		return recommitPages(msp, reinterpret_cast<uint8*>(ptr), reinterpret_cast<uint8*>(ptr) + used);
+	}
+
+	// Make the pages from begin to end usable, whether they were decommitted inside a free chunk
+	// or lie past the committed end of the segment
+	static FORCEINLINE bool commitPages(MemorySpace* msp, uint8* begin, uint8* end)
+	{
+		return recommitPages(msp, begin, end) && commitPagesUpTo(msp, end);
+	}
+
+	// Decommit the whole pages inside a free chunk which are still committed. The pages are
+	// purged rather than decommitted so that scattered free chunks don't split the segment into
+	// a mapping each. Returns the number of bytes decommitted.
+	static size_t decommitFreeChunk(MemorySpace* msp, MemoryChunk* ptr, size_t size)
+	{
+		MemorySegment* seg = segmentHolding(msp, reinterpret_cast<uint8*>(ptr));
+		size_t first = (reinterpret_cast<uint8*>(ptr) + kFreeChunkHeaderSize - seg->base +
+			(msp->page_size - 1)) / msp->page_size;
+		size_t last = (reinterpret_cast<uint8*>(ptr) + size - seg->base) / msp->page_size;
+		if (last > seg->curr_page_index)
+			last = seg->curr_page_index;
+		if (last > kMaxDecommitPages)
+			last = kMaxDecommitPages;
+		size_t released = 0;
+		for (size_t i = first; i < last; ++i)
+		{
+			if (!isPageDecommitted(seg, i))
+			{
+				SysAlloc::purgePage(seg->base + (i * msp->page_size), msp->page_size);
+				setPageDecommitted(seg, i, true);
+				released += msp->page_size;
+			}
+		}
+		releaseBudget(msp, released);
+		return released;
+	}
+
+	// Decommit the pages inside the tree bin chunks which were put in their bin at least
+	// min_age decay steps ago. Returns the number of bytes decommitted.
+	static size_t decommitTreeBins(MemorySpace* msp, uint32 min_age)
+	{
+		size_t released = 0;
+		// Smaller chunks can't hold a whole page
+		for (uint32 index = computeTreeIndex(msp->page_size); index < kNumTreeBins; ++index)
+		{
+			MemoryTreeChunk* stack[kSizeTBitSize * 2];
+			uint32 depth = 0;
+			if (*treeBinAt(msp, index) != 0)
+				stack[depth++] = *treeBinAt(msp, index);
+			while (depth > 0)
+			{
+				MemoryTreeChunk* node = stack[--depth];
+				for (uint32 i = 0; i < 2; ++i)
+				{
+					if (node->child[i] != 0)
+						stack[depth++] = node->child[i];
+				}
+				// Visit the chunks of the same size chained to the node
+				MemoryTreeChunk* tptr = node;
+				do
+				{
+					if (msp->decay_step - tptr->decay_step >= min_age)
+						released += decommitFreeChunk(msp, reinterpret_cast<MemoryChunk*>(tptr), chunkSize(tptr));
+					tptr = tptr->fd;
+				} while (tptr != node);
+			}
+		}
+		return released;
+	}
+	//--------------------------------------------------------------------------------------------------------------
 	// Helper functions for alloc
 	static void* treeAllocLarge(MemorySpace* msp, size_t nb)
 	{
@@ -834,6 +1068,8 @@ namespace Odin
 		// Check if dv is a better fit. If no, go ahead. Else, return nullptr so that malloc can use dv
 		if (prev_ptr != 0 && rem_size < (msp->dv_size - nb))
 		{
+			if (!recommitSplit(msp, reinterpret_cast<MemoryChunk*>(prev_ptr), rem_size + nb, nb))
+				return nullptr;
 			unlinkLargeChunk(msp, prev_ptr);
 			MemoryChunk* ptr = reinterpret_cast<MemoryChunk*>(prev_ptr);
 			MemoryChunk* rem_ptr = chunkPlusOffset(ptr, nb);
@@ -873,6 +1109,8 @@ namespace Odin
 		}
 		MemoryChunk* rem_ptr = chunkPlusOffset(reinterpret_cast<MemoryChunk*>(curr_ptr), nb);
 		ASSERT_ERROR(chunkSize(curr_ptr) == rem_size + nb, "Remainder size and requested size don't add up to the original chunk size");
+		if (!recommitSplit(msp, reinterpret_cast<MemoryChunk*>(curr_ptr), rem_size + nb, nb))
+			return nullptr;
 		unlinkLargeChunk(msp, curr_ptr);
 		if (rem_size < kMinChunkSize)
 		{
@@ -881,21 +1119,264 @@ namespace Odin
 		else
 		{
 			setSizePinuseOfInuseChunk(msp, reinterpret_cast<MemoryChunk*>(curr_ptr), nb);
-			setSizePinuseOfFreeChunk(msp, reinterpret_cast<MemoryChunk*>(curr_ptr), rem_size);
+			setSizePinuseOfFreeChunk(msp, rem_ptr, rem_size);
 			replaceDV(msp, rem_ptr, rem_size);
 		}
 		return chunkToMemory(reinterpret_cast<MemoryChunk*>(curr_ptr));
 	}
 	//-----------------------------------------------------------------------------------------------------------------
-	void* alloc(MemorySpace* msp, size_t bytes)
+	// Allocate a chunk of bytes. Lock should be held by the caller.
+	// Allocate a chunk directly from the system with its user pointer plus offset aligned to
+	// alignment. A chunk which had to be moved into the segment to be aligned keeps the offset
+	// from the start of the segment in its prev_foot. It is 0 for all the others.
+	static void* allocDirect(MemorySpace* msp, size_t bytes, size_t alignment, size_t offset)
+	{
+		// The user pointer of a chunk at the start of the segment is aligned to kChunkOverhead
+		size_t lead_room = (alignment > kChunkOverhead || (offset & (alignment - 1)) != 0) ? alignment : 0;
+		// The additional kChunkOverhead is for the imaginary trailing chunk after this chunk
+		size_t map_size = (padRequest(bytes) + kChunkOverhead + lead_room + (msp->page_size - 1)) & ~(msp->page_size - 1);
+		if (!chargeBudget(msp, map_size))
+			return nullptr;
+		// The whole chunk is handed out at once, so commit it along with the reservation
+		uint8* segment = reinterpret_cast<uint8*>(SysAlloc::reserveCommitSegment(map_size));
+		if (segment == nullptr)
+		{
+			releaseBudget(msp, map_size);
+			return nullptr;
+		}
+		size_t lead = 0;
+		if (lead_room != 0)
+			lead = ((reinterpret_cast<size_t>(segment) + kChunkOverhead + offset + (alignment - 1)) & ~(alignment - 1)) -
+				offset - kChunkOverhead - reinterpret_cast<size_t>(segment);
+		MemoryChunk* ptr = reinterpret_cast<MemoryChunk*>(segment + lead);
+		ptr->prev_foot = lead;
+		size_t nb = map_size - lead - kChunkOverhead;
+		setSizePinuseOfInuseChunk(msp, ptr, nb);
+		markInuseFootNull(ptr, nb);
+		void* mem = chunkToMemory(ptr);
+		// Only the page holding the user pointer needs to be found by the page map
+		if (!PageMap::setOwner(mem, 1, PageMap::kDirectChunk))
+		{
+			SysAlloc::releaseSegment(segment, map_size);
+			releaseBudget(msp, map_size);
+			return nullptr;
+		}
+		checkAllocedChunk(msp, mem, nb);
+		return mem;
+	}
+
+	// Return a segment added to msp to the system. Its budget charge is released by the caller.
+	static void releaseSpaceSegment(MemorySpace* msp, uint8* base, size_t size)
 	{
-		// Acquire lock
-		std::lock_guard<std::mutex> guard(msp->memory_lock);
+		PageMap::clearOwner(base, size);
+		// Added segments are never reported as mapped on huge pages
+		if (msp->huge_pages)
+			SysAlloc::releaseHugeSegment(base, size, false);
+		else
+			SysAlloc::releaseSegment(base, size);
+	}
 
+	// Reserve a segment for msp, starting at ptr if it is specified, and map its pages to msp.
+	// Returns NULL if the system could not reserve it.
+	static uint8* reserveSpaceSegment(MemorySpace* msp, size_t size, void* ptr)
+	{
+		void* segment = nullptr;
+		if (msp->huge_pages)
+		{
+			bool huge_backed = false;
+			segment = SysAlloc::reserveHugeSegment(size, huge_backed, ptr);
+		}
+		else
+			segment = SysAlloc::reserveSegment(size, ptr);
+		if (segment != nullptr && !PageMap::setOwner(segment, size, msp))
+		{
+			releaseSpaceSegment(msp, reinterpret_cast<uint8*>(segment), size);
+			segment = nullptr;
+		}
+		return reinterpret_cast<uint8*>(segment);
+	}
+
+	// Turn top into a free chunk closed by a fencepost at the end of its segment, before top
+	// moves to a new segment. The pages of the chunk which were never committed are recorded as
+	// decommitted, so that allocations split off the chunk commit them like the pages a free
+	// chunk gave back. Returns false if the system refused to commit the links and the fencepost.
+	static bool retireTop(MemorySpace* msp)
+	{
+		MemorySegment* seg = msp->top_seg;
+		MemoryChunk* old_top = msp->top;
+		size_t old_size = msp->top_size;
+		ASSERT_ERROR(reinterpret_cast<uint8*>(old_top) + old_size == seg->base + seg->size, "Top does not end its segment");
+		if (old_size < kMinChunkSize + kChunkOverhead)
+		{
+			// Too small to be a chunk, it stays in use for good
+			old_top->head = old_size | kInuseBits;
+			return true;
+		}
+		size_t free_size = old_size - kChunkOverhead;
+		MemoryChunk* fence = chunkPlusOffset(old_top, free_size);
+		if (!commitPagesUpTo(msp, reinterpret_cast<uint8*>(old_top) + kFreeChunkHeaderSize))
+			return false;
+		size_t fence_page = (reinterpret_cast<uint8*>(fence) - seg->base) / msp->page_size;
+		if (seg->curr_page_index <= fence_page)
+		{
+			if (fence_page > kMaxDecommitPages)
+			{
+				// The pages can't all be tracked, commit the rest of the segment
+				if (!commitPagesUpTo(msp, seg->base + seg->size))
+					return false;
+			}
+			else
+			{
+				// Only the page holding the footer and the fencepost is needed
+				if (!chargeBudget(msp, msp->page_size))
+					return false;
+				if (!SysAlloc::commitPage(seg->base + (fence_page * msp->page_size), msp->page_size))
+				{
+					releaseBudget(msp, msp->page_size);
+					return false;
+				}
+				for (size_t i = seg->curr_page_index; i < fence_page; ++i)
+					setPageDecommitted(seg, i, true);
+				seg->curr_page_index = static_cast<uint32>(fence_page + 1);
+			}
+		}
+		// The fencepost is an in-use chunk the chunks of the segment can't merge with
+		fence->head = kChunkOverhead | kCinuseBit;
+		setSizePinuseOfFreeChunk(msp, old_top, free_size);
+		insertChunk(msp, old_top, free_size);
+		if (free_size > msp->trim_threshold)
+			decommitFreeChunk(msp, old_top, free_size);
+		return true;
+	}
+
+	// Add a segment large enough for a chunk of nb bytes and move top there. The segment starts
+	// with an in-use chunk holding its MemorySegment. Returns false if the system refused to
+	// provide the memory.
+	static bool addSegment(MemorySpace* msp, size_t nb)
+	{
+		size_t page_mask = msp->page_size - 1;
+		size_t record_size = padRequest(sizeof(MemorySegment));
+		size_t size = (record_size + nb + kChunkOverhead + page_mask) & ~page_mask;
+		// Grow by whole segments, within the pages a decommit map tracks
+		size_t segment_size = msp->segment_granularity;
+		if (segment_size > kMaxDecommitPages * msp->page_size)
+			segment_size = kMaxDecommitPages * msp->page_size;
+		if (size < segment_size)
+			size = segment_size;
+		uint8* base = reserveSpaceSegment(msp, size, nullptr);
+		if (base == nullptr)
+			return false;
+		// Commit the page holding the MemorySegment and the header of the new top
+		if (!chargeBudget(msp, msp->page_size))
+		{
+			releaseSpaceSegment(msp, base, size);
+			return false;
+		}
+		// The old top is only closed once the new segment is usable
+		if (!SysAlloc::commitPage(base, msp->page_size) || !retireTop(msp))
+		{
+			releaseBudget(msp, msp->page_size);
+			releaseSpaceSegment(msp, base, size);
+			return false;
+		}
+		MemoryChunk* record_chunk = reinterpret_cast<MemoryChunk*>(base);
+		record_chunk->head = record_size | kInuseBits;
+		MemorySegment* seg = reinterpret_cast<MemorySegment*>(chunkToMemory(record_chunk));
+		seg->base = base;
+		seg->size = size;
+		seg->curr_page_index = 1;
+		seg->decommitted_pages = 0;
+		for (uint32 i = 0; i < kMaxDecommitPages / 32; ++i)
+			seg->decommit_map[i] = 0;
+		seg->next = msp->seg.next;
+		msp->seg.next = seg;
+		msp->top_seg = seg;
+		msp->top = chunkPlusOffset(record_chunk, record_size);
+		msp->top_size = size - record_size;
+		msp->top->head = msp->top_size | kPinuseBit;
+		msp->decay_dirty = 0;
+		msp->footprint += size;
+		if (msp->footprint > msp->max_footprint)
+			msp->max_footprint = msp->footprint;
+		return true;
+	}
+
+	// Make top large enough for a chunk of nb bytes and the header of the new top. The segment
+	// holding top grows into the address range after it if that range is free, otherwise a new
+	// segment is added. Returns false if the system refused to provide the memory.
+	static bool growTop(MemorySpace* msp, size_t nb)
+	{
+		MemorySegment* seg = msp->top_seg;
+		size_t page_mask = msp->page_size - 1;
+		size_t grow_size = (nb + kChunkOverhead + page_mask) & ~page_mask;
+		if (grow_size < msp->segment_granularity)
+			grow_size = msp->segment_granularity;
+		// A segment only grows as long as its decommit map tracks all its pages
+		if (seg->size + grow_size <= kMaxDecommitPages * msp->page_size &&
+			reserveSpaceSegment(msp, grow_size, seg->base + seg->size) != nullptr)
+		{
+			seg->size += grow_size;
+			msp->footprint += grow_size;
+			if (msp->footprint > msp->max_footprint)
+				msp->max_footprint = msp->footprint;
+			msp->top_size += grow_size;
+			return true;
+		}
+		return addSegment(msp, nb);
+	}
+
+	// Return the added segments holding nothing but a free chunk to the system, if the chunk was
+	// put in its bin at least min_age decay steps ago (dv only goes when min_age is 0). The
+	// segment holding top is kept. Returns the number of committed bytes released.
+	static size_t releaseUnusedSegments(MemorySpace* msp, uint32 min_age)
+	{
+		size_t released = 0;
+		MemorySegment* prev = &msp->seg;
+		MemorySegment* seg = prev->next;
+		while (seg != nullptr)
+		{
+			MemorySegment* next = seg->next;
+			MemoryChunk* ptr = firstChunk(msp, seg);
+			size_t size = chunkSize(ptr);
+			bool unused = (seg != msp->top_seg) && !isInuse(ptr) &&
+				(reinterpret_cast<uint8*>(ptr) + size == segmentFence(seg));
+			if (unused)
+			{
+				if (ptr == msp->dv)
+					unused = (min_age == 0);
+				else if (!isSmall(size))
+					unused = (msp->decay_step - reinterpret_cast<MemoryTreeChunk*>(ptr)->decay_step >= min_age);
+			}
+			if (!unused)
+			{
+				prev = seg;
+				seg = next;
+				continue;
+			}
+			if (ptr == msp->dv)
+			{
+				msp->dv = 0;
+				msp->dv_size = 0;
+			}
+			else
+				unlinkChunk(msp, ptr, size);
+			size_t committed = (seg->curr_page_index - seg->decommitted_pages) * msp->page_size;
+			releaseBudget(msp, committed);
+			released += committed;
+			msp->footprint -= seg->size;
+			prev->next = next;
+			releaseSpaceSegment(msp, seg->base, seg->size);
+			seg = next;
+		}
+		return released;
+	}
+
+	static void* allocChunk(MemorySpace* msp, size_t bytes)
+	{
 		void* mem = 0;
 		size_t nb;
 
-		if (bytes <= kMaxRequest)
+		if (bytes <= kMaxSmallRequest)
 		{
 			if (bytes < kMinRequest)
 				nb = kMinChunkSize;
@@ -941,18 +1422,18 @@ namespace Odin
 					{
 						setSizePinuseOfInuseChunk(msp, ptr, nb);
 						rem_ptr = chunkPlusOffset(ptr, nb);
-						setSizePinuseOfFreeChunk(msp, ptr, rem_size);
+						setSizePinuseOfFreeChunk(msp, rem_ptr, rem_size);
 						replaceDV(msp, rem_ptr, rem_size);
 					}
 					mem = chunkToMemory(ptr);
 					checkAllocedChunk(msp, mem, nb);
 					return mem;
 				}
-			}
-			else if (msp->tree_map != 0 && (mem = treeAllocSmall(msp, nb)) != 0)
-			{
-				checkAllocedChunk(msp, mem, nb);
-				return mem;
+				else if (msp->tree_map != 0 && (mem = treeAllocSmall(msp, nb)) != 0)
+				{
+					checkAllocedChunk(msp, mem, nb);
+					return mem;
+				}
 			}
 		}
 		else if (bytes >= kMaxRequest)
@@ -974,6 +1455,8 @@ namespace Odin
 		{
 			size_t rem_size = msp->dv_size - nb;
 			MemoryChunk* ptr = msp->dv;
+			if (!recommitSplit(msp, ptr, msp->dv_size, nb))
+				return nullptr;
 			if (rem_size >= kMinChunkSize)
 			{
 				// Split dv
@@ -988,33 +1471,23 @@ namespace Odin
 				size_t dv_size = msp->dv_size;
 				msp->dv_size = 0;
 				msp->dv = 0;
-				setSizeInusePinuse(msp, ptr, nb);
+				setSizeInusePinuse(msp, ptr, dv_size);
 			}
 			mem = chunkToMemory(ptr);
 			checkAllocedChunk(msp, mem, nb);
 			return mem;
 		}
-		else if (nb < msp->top_size)
+		else if (nb + kChunkOverhead <= msp->top_size)
 		{
+			// Top keeps room for its header inside the segment.
+			// Commit the pages the split chunk and the header of the new top move over to.
+			// The rest of top stays reserved only.
+			if (!commitPages(msp, reinterpret_cast<uint8*>(msp->top), reinterpret_cast<uint8*>(chunkPlusOffset(msp->top, nb + kChunkOverhead))))
+				return nullptr;
 			// Split top
 			size_t rem_size = msp->top_size -= nb;
 			MemoryChunk* ptr = msp->top;
 			MemoryChunk* rem_ptr = msp->top = chunkPlusOffset(ptr, nb);
-			// Check if top has moved over to the next non committed page
-			//if (msp->commit_page_func != 0)
-			//{
-				if (reinterpret_cast<uint8*>(msp->top) >(msp->least_addr + (msp->curr_page_index * msp->page_size)))
-				{
-					// Commit the next page in this segment
-					void* next_page_ptr = reinterpret_cast<void*>(msp->least_addr + (msp->curr_page_index * msp->page_size));
-					//size_t bytes_committed = msp->commit_page_func(next_page_ptr, msp->page_size);
-					//ASSERT_ERROR(bytes_committed == msp->page_size, "Number of bytes committed is not equal to the page size");
-					//msp->commit_page_func(next_page_ptr, msp->page_size);
-					SysAlloc::commitPage(next_page_ptr, msp->page_size);
-					// Increment the current page index
-					++msp->curr_page_index;
-				}
-			//}
 			rem_ptr->head = rem_size | kPinuseBit;
 			setSizePinuseOfInuseChunk(msp, ptr, nb);
 			mem = chunkToMemory(ptr);
@@ -1023,201 +1496,425 @@ namespace Odin
 		}
 
 		// Still no luck! Request additional memory from the system
-		if (bytes < msp->segment_threshold)
-		{
-			// Allocate from system (request for memory from system will have a granularity of page size)
-			size_t page_aligned_nb = (nb + (msp->page_size - 1)) & ~(msp->page_size - 1);
-			void* adjacentSeg = reinterpret_cast<void*>(msp->least_addr + msp->footprint);
-			// Reserve address space starting from the end of this segment
-			adjacentSeg = SysAlloc::reserveSegment(msp->page_size, adjacentSeg);
-			if (adjacentSeg != nullptr) // If address space is reserved
+		if (bytes < msp->segment_threshold && growTop(msp, nb))
+		{
+			// Commit the pages up to the header of the new top
+			if (!commitPages(msp, reinterpret_cast<uint8*>(msp->top), reinterpret_cast<uint8*>(chunkPlusOffset(msp->top, nb + kChunkOverhead))))
+				return nullptr;
+			// Now split the top
+			size_t rem_size = msp->top_size -= nb;
+			MemoryChunk* ptr = msp->top;
+			MemoryChunk* rem_ptr = msp->top = chunkPlusOffset(ptr, nb);
+			rem_ptr->head = rem_size | kPinuseBit;
+			setSizePinuseOfInuseChunk(msp, ptr, nb);
+			mem = chunkToMemory(ptr);
+			checkAllocedChunk(msp, mem, nb);
+			return mem;
+		}
+
+		// Allocate the requested space from system directly
+		return allocDirect(msp, bytes, kChunkAlignment, 0);
+	}
+
+	static bool freeChunk(MemorySpace* msp, MemoryChunk* ptr);
+
+	// Free the blocks queued by freeRemote. Lock should be held by the caller.
+	// Returns true if no allocations exist in the segment after the last free.
+	static bool freeRemoteChunks(MemorySpace* msp)
+	{
+		if (msp->remote_frees.load(std::memory_order_relaxed) == nullptr)
+			return false;
+		// Take the whole list at once, pushes made from now on go to a new list
+		void* mem = msp->remote_frees.exchange(nullptr, std::memory_order_acquire);
+		bool empty = false;
+		while (mem != nullptr)
+		{
+			void* next = *reinterpret_cast<void**>(mem);
+			empty = freeChunk(msp, memoryToChunk(mem));
+			mem = next;
+		}
+		return empty;
+	}
+
+	void* alloc(MemorySpace* msp, size_t bytes)
+	{
+		// Acquire lock
+		std::lock_guard<AdaptiveLock> guard(msp->memory_lock);
+		freeRemoteChunks(msp);
+		return allocChunk(msp, bytes);
+	}
+
+	// Split up to count chunks of size nb off the front of dv, or of top if dv is too small.
+	// The chunks are contiguous, so only the header and footer of each chunk are written.
+	// Lock should be held by the caller. Returns the number of chunks stored in out.
+	static size_t carveRun(MemorySpace* msp, size_t nb, size_t count, void** out)
+	{
+		size_t n;
+		MemoryChunk* ptr;
+		if (nb <= msp->dv_size)
+		{
+			n = msp->dv_size / nb;
+			if (n > count)
+				n = count;
+			size_t rem_size = msp->dv_size - (n * nb);
+			ptr = msp->dv;
+			if (!recommitSplit(msp, ptr, msp->dv_size, n * nb))
+				return 0;
+			for (size_t i = 0; i < n - 1; ++i)
 			{
-				// Set the new segment size
-				msp->footprint += page_aligned_nb;
-				if (msp->footprint > msp->max_footprint)
-					msp->max_footprint = msp->footprint;
-				// Commit this page
-				//if (msp->commit_page_func != 0)
-				//{
-					SysAlloc::commitPage(adjacentSeg, page_aligned_nb);
-					++msp->curr_page_index;
-				//}
-				msp->top_size += page_aligned_nb;
-				// Now split the top
-				size_t rem_size = msp->top_size -= nb;
-				MemoryChunk* ptr = msp->top;
-				MemoryChunk* rem_ptr = msp->top = chunkPlusOffset(ptr, nb);
-				rem_ptr->head = rem_size | kPinuseBit;
 				setSizePinuseOfInuseChunk(msp, ptr, nb);
-				mem = chunkToMemory(ptr);
-				checkAllocedChunk(msp, mem, nb);
-				return mem;
+				out[i] = chunkToMemory(ptr);
+				checkAllocedChunk(msp, out[i], nb);
+				ptr = chunkPlusOffset(ptr, nb);
+			}
+			if (rem_size >= kMinChunkSize)
+			{
+				// Whatever is left over stays the dv
+				MemoryChunk* rem_ptr = msp->dv = chunkPlusOffset(ptr, nb);
+				msp->dv_size = rem_size;
+				setSizePinuseOfFreeChunk(msp, rem_ptr, rem_size);
+				setSizePinuseOfInuseChunk(msp, ptr, nb);
+			}
+			else
+			{
+				// Exhaust dv, the last chunk takes the remainder. Unless it is the first chunk of
+				// the run, its head word holds stale data, so PINUSE is set rather than kept.
+				msp->dv_size = 0;
+				msp->dv = 0;
+				setSizePinuseOfInuseChunk(msp, ptr, nb + rem_size);
+				chunkPlusOffset(ptr, nb + rem_size)->head |= kPinuseBit;
 			}
+			out[n - 1] = chunkToMemory(ptr);
+			checkAllocedChunk(msp, out[n - 1], nb);
+			return n;
 		}
+		else if (nb + kChunkOverhead <= msp->top_size)
+		{
+			// Top must keep at least its header
+			n = (msp->top_size - kChunkOverhead) / nb;
+			if (n > count)
+				n = count;
+			// Commit the pages the whole run and the header of the new top move over to
+			if (!commitPages(msp, reinterpret_cast<uint8*>(msp->top), reinterpret_cast<uint8*>(chunkPlusOffset(msp->top, (n * nb) + kChunkOverhead))))
+				return 0;
+			ptr = msp->top;
+			for (size_t i = 0; i < n; ++i)
+			{
+				setSizePinuseOfInuseChunk(msp, ptr, nb);
+				out[i] = chunkToMemory(ptr);
+				ptr = chunkPlusOffset(ptr, nb);
+			}
+			size_t rem_size = msp->top_size -= (n * nb);
+			msp->top = ptr;
+			ptr->head = rem_size | kPinuseBit;
+			for (size_t i = 0; i < n; ++i)
+				checkAllocedChunk(msp, out[i], nb);
+			return n;
+		}
+		return 0;
+	}
 
-		// Allocate the requested space from system directly
-		nb = padRequest(bytes + kChunkOverhead);	// The additional kChunkOverhead is for the imaginary trailing chunk after this chunk
-		//MemoryChunk* ptr = reinterpret_cast<MemoryChunk*>(msp->reserve_segment_func(nb, NULL));
-		MemoryChunk* ptr = reinterpret_cast<MemoryChunk*>(SysAlloc::reserveSegment(nb, NULL));
-		setSizePinuseOfInuseChunk(msp, ptr, bytes);
-		markInuseFootNull(ptr, bytes);
-		mem = chunkToMemory(ptr);
-		checkAllocedChunk(msp, mem, nb);
-		return mem;
+	size_t allocBatch(MemorySpace* msp, size_t bytes, size_t count, void** out)
+	{
+		if (count == 0 || bytes >= kMaxRequest)
+			return 0;
+		size_t nb = (bytes < kMinRequest) ? kMinChunkSize : padRequest(bytes);
+
+		// Acquire lock once for the whole batch
+		std::lock_guard<AdaptiveLock> guard(msp->memory_lock);
+		freeRemoteChunks(msp);
+
+		size_t done = 0;
+		while (done < count)
+		{
+			size_t carved = carveRun(msp, nb, count - done, out + done);
+			if (carved == 0)
+			{
+				// Neither dv nor top can hold another chunk. Go through the regular path, which
+				// also extends the segment so the next run can be carved out of the new top.
+				void* mem = allocChunk(msp, bytes);
+				if (mem == nullptr)
+					break;
+				out[done++] = mem;
+			}
+			else
+				done += carved;
+		}
+		return done;
 	}
 
-	bool free(MemorySpace* msp, void* mem)
+	// Return true if no allocations exist in the segment, i.e. top starts right after the MemorySpace struct
+	// and no segment was added
+	static bool isMemorySpaceEmpty(MemorySpace* msp)
 	{
-		// Acquire lock
-		std::lock_guard<std::mutex> guard(msp->memory_lock);
+		if (msp->seg.next != nullptr)
+			return false;
+		MemoryChunk* next_chunk = nextChunk(memoryToChunk(msp));
+		size_t offset = alignmentOffset(reinterpret_cast<size_t>(chunkToMemory(next_chunk)));
+		next_chunk = reinterpret_cast<MemoryChunk*>(reinterpret_cast<uint8*>(next_chunk)+offset);
+		return (next_chunk == msp->top);
+	}
+
+	// Decommit the committed pages lying completely inside top, past the header of top and pad bytes.
+	// Pages are decommitted one at a time since top may span several adjacent reservations.
+	// Returns the number of bytes decommitted.
+	static size_t trimTop(MemorySpace* msp, size_t pad)
+	{
+		MemorySegment* seg = msp->top_seg;
+		uint8* keep_end = reinterpret_cast<uint8*>(msp->top) + kChunkOverhead + pad;
+		size_t keep_pages = (keep_end - seg->base + (msp->page_size - 1)) / msp->page_size;
+		size_t released = 0;
+		while (seg->curr_page_index > keep_pages && seg->curr_page_index > 1)
+		{
+			--seg->curr_page_index;
+			// Pages decommitted while inside a free chunk which then merged into top only
+			// leave the bookkeeping, as pages past the committed end aren't tracked
+			if (seg->curr_page_index < kMaxDecommitPages && isPageDecommitted(seg, seg->curr_page_index))
+			{
+				setPageDecommitted(seg, seg->curr_page_index, false);
+				continue;
+			}
+			SysAlloc::decommitPage(seg->base + (seg->curr_page_index * msp->page_size), msp->page_size);
+			released += msp->page_size;
+		}
+		releaseBudget(msp, released);
+		return released;
+	}
 
-		if (mem != 0)
+	// Put a chunk back into the bins, merging it with its free neighbours.
+	// Lock should be held by the caller. Returns true if no allocations are left in the segment.
+	static bool freeChunk(MemorySpace* msp, MemoryChunk* ptr)
+	{
+		checkInuseChunk(msp, ptr);
+		if (!isInuse(ptr))
 		{
-			MemoryChunk* ptr = memoryToChunk(mem);
-			checkInuseChunk(msp, ptr);
-			if (isInuse(ptr))
+			ASSERT_ERROR(false, "Chunk is freed twice or was never allocated");
+			return false;
+		}
+
+		size_t ptr_size = chunkSize(ptr);
+		MemoryChunk* next_ptr = chunkPlusOffset(ptr, ptr_size);
+		if (!getPInuse(ptr))
+		{
+			// Consolidate backwards
+			size_t prev_size = ptr->prev_foot;
+			MemoryChunk* prev_ptr = chunkMinusOffset(ptr, prev_size);
+			ptr_size += prev_size;
+			ptr = prev_ptr;
+			if (ptr != msp->dv)
+				unlinkChunk(msp, ptr, prev_size);
+			else if ((next_ptr->head & kInuseBits) == kInuseBits)
 			{
-				// First check if the size of this allocation is greater than segment threshold or 
-				// if the allocation's address does not fall within the segment
-				if ((chunkSize(ptr) > msp->segment_threshold) ||
-					(reinterpret_cast<uint8*>(ptr) < msp->least_addr || 
-					(reinterpret_cast<uint8*>(ptr) > msp->least_addr + msp->footprint)))
-				{
-					// If yes, return the memory to the system directly
-					size_t size = chunkSize(ptr) + kChunkOverhead;
-					//msp->release_segment_func(ptr, size);
-					SysAlloc::releaseSegment(ptr, size);
-					return false;
-				}
+				// The previous chunk is dv and the next one is in use, so just grow dv
+				msp->dv_size = ptr_size;
+				// Clear the kPinuse bit of the next chunk
+				next_ptr->head &= ~kPinuseBit;
+				setSizePinuseOfFreeChunk(msp, ptr, ptr_size);
+				return false;
+			}
+		}
 
-				size_t ptr_size = chunkSize(ptr);
-				MemoryChunk* next_ptr = chunkPlusOffset(ptr, ptr_size);
-				if (!getPInuse(ptr))
-				{
-					size_t prev_foot = ptr->prev_foot;
-					MemoryChunk* prev_ptr = chunkMinusOffset(ptr, prev_foot);
-					ptr_size += prev_foot;
-					ptr = prev_ptr;
-					// Consolidate backwards 
-					if (ptr != msp->dv)
-						unlinkChunk(msp, ptr, prev_foot);
-					else if ((next_ptr->head & kInuseBits) == kInuseBits)
-					{
-						msp->dv_size = ptr_size;
-						// Clear the kPinuse bit of the next chunk
-						next_ptr->head &= ~kPinuseBit;
-						setSizePinuseOfFreeChunk(msp, ptr, ptr_size);
-						return false;
-					}
-				}
-				if (getPInuse(next_ptr))
+		ASSERT_ERROR(getPInuse(next_ptr), "PINUSE bit of the chunk next to a freed chunk is not set");
+		if (!getCInuse(next_ptr))
+		{
+			// Consolidate forward
+			if (next_ptr == msp->top)
+			{
+				size_t top_size = msp->top_size += ptr_size;
+				msp->top = ptr;
+				ptr->head = top_size | kPinuseBit;
+				if (ptr == msp->dv)
 				{
-					if (!getCInuse(next_ptr))
-					{
-						// Consolidate forward
-						if (next_ptr == msp->top)
-						{
-							size_t top_size = msp->top_size += ptr_size;
-							msp->top = ptr;
-							ptr->head = top_size | kPinuseBit;
-							if (ptr == msp->dv)
-							{
-								msp->dv = 0;
-								msp->dv_size = 0;
-							}
-							// Decommit the current page if top has moved to the previous page
-							//if (msp->decommit_page_func != 0)
-							//{
-								if (reinterpret_cast<uint8*>(msp->top) <
-									(msp->least_addr + ((msp->curr_page_index - 1) * msp->page_size)))
-								{
-									void* curr_page_ptr = reinterpret_cast<void*>(msp->least_addr +
-										(msp->curr_page_index - 1) * msp->page_size);
-									//msp->decommit_page_func(curr_page_ptr, msp->page_size);
-									SysAlloc::decommitPage(curr_page_ptr, msp->page_size);
-									--msp->curr_page_index;
-								}
-							//}
-
-							// Get the chunk right after MemorySpace struct, might be useful later
-							MemoryChunk* next_chunk = nextChunk(memoryToChunk(msp));
-							size_t offset = alignmentOffset(reinterpret_cast<size_t>(chunkToMemory(next_chunk)));
-							next_chunk = reinterpret_cast<MemoryChunk*>(reinterpret_cast<uint8*>(next_chunk)+offset);
-							// Now check if the size of top is a multiple of segment_granularity.
-							// If yes, free that portion.
-							if (msp->top_size > msp->segment_granularity)
-							{
-								size_t size = msp->top_size + (reinterpret_cast<uint8*>(msp->top) - msp->least_addr);
-								size_t size_factor = msp->top_size / msp->segment_granularity;
-								for (size_t i = size_factor; i > 1; --i)
-								{
-									uint8* seg = msp->least_addr + (msp->segment_granularity * (i - 1));
-									//msp->release_segment_func(reinterpret_cast<void*>(seg), msp->segment_granularity);
-									SysAlloc::releaseSegment(reinterpret_cast<void*>(seg), msp->segment_granularity);
-								}
-							}
-							if (next_chunk == msp->top)
-							{
-								// This segment needs to be destroyed, so return true
-								return true;
-							}
-							return false;
-						}
-						else if (next_ptr == msp->dv)
-						{
-							size_t dv_size = msp->dv_size += ptr_size;
-							msp->dv = ptr;
-							setSizePinuseOfFreeChunk(msp, ptr, dv_size);
-							return false;
-						}
-						else
-						{
-							size_t next_size = chunkSize(next_ptr);
-							ptr_size += next_size;
-							unlinkChunk(msp, next_ptr, next_size);
-							setSizePinuseOfFreeChunk(msp, ptr, ptr_size);
-							if (ptr == msp->dv)
-							{
-								msp->dv_size = ptr_size;
-								return false;
-							}
-						}
-					}
-					else
-					{
-						next_ptr->head &= ~kPinuseBit;
-						setSizePinuseOfFreeChunk(msp, ptr, ptr_size);
-					}
-					insertChunk(msp, ptr, ptr_size);
-					checkFreeChunk(msp, ptr);
-					return false;
+					msp->dv = 0;
+					msp->dv_size = 0;
 				}
-				else
+				// Give the pages at the end of top back to the system
+				if (top_size > msp->trim_threshold)
+					trimTop(msp, msp->trim_threshold);
+				return isMemorySpaceEmpty(msp);
+			}
+			else if (next_ptr == msp->dv)
+			{
+				size_t dv_size = msp->dv_size += ptr_size;
+				msp->dv = ptr;
+				setSizePinuseOfFreeChunk(msp, ptr, dv_size);
+				return false;
+			}
+			else
+			{
+				size_t next_size = chunkSize(next_ptr);
+				ptr_size += next_size;
+				unlinkChunk(msp, next_ptr, next_size);
+				setSizePinuseOfFreeChunk(msp, ptr, ptr_size);
+				if (ptr == msp->dv)
 				{
-					// TODO: Add error message
+					msp->dv_size = ptr_size;
 					return false;
 				}
 			}
-			else
-				return false;
 		}
 		else
+		{
+			next_ptr->head &= ~kPinuseBit;
+			setSizePinuseOfFreeChunk(msp, ptr, ptr_size);
+		}
+		insertChunk(msp, ptr, ptr_size);
+		// Give the pages inside a big free chunk back to the system, the smaller ones wait
+		// for the decay
+		if (ptr_size > msp->trim_threshold)
+			decommitFreeChunk(msp, ptr, ptr_size);
+		checkFreeChunk(msp, ptr);
+		return false;
+	}
+
+	bool free(MemorySpace* msp, void* mem)
+	{
+		if (mem == 0)
+			return false;
+
+		// First check if this allocation was obtained directly from the system since its size
+		// was greater than the segment threshold
+		if (PageMap::getOwner(mem) == PageMap::kDirectChunk)
+		{
+			// If yes, return the memory to the system directly
+			releaseBudget(msp, freeDirect(mem));
 			return false;
+		}
+
+		MemoryChunk* ptr = memoryToChunk(mem);
+
+		// Acquire lock
+		std::lock_guard<AdaptiveLock> guard(msp->memory_lock);
+		return freeChunk(msp, ptr);
 	}
-	
 
-	void* allocAligned(MemorySpace* msp, size_t alignment, size_t bytes, size_t offset)
+	void freeRemote(MemorySpace* msp, void* mem)
+	{
+		if (mem == 0)
+			return;
+		if (PageMap::getOwner(mem) == PageMap::kDirectChunk)
+		{
+			releaseBudget(msp, freeDirect(mem));
+			return;
+		}
+
+		// Push the block on the list with a CAS loop, the link lives in the block itself
+		void* head = msp->remote_frees.load(std::memory_order_relaxed);
+		do
+		{
+			*reinterpret_cast<void**>(mem) = head;
+		} while (!msp->remote_frees.compare_exchange_weak(head, mem,
+			std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	bool freeBatch(MemorySpace* msp, void** mem, size_t count)
+	{
+		bool empty = false;
+
+		// Acquire lock once for the whole batch
+		std::lock_guard<AdaptiveLock> guard(msp->memory_lock);
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (mem[i] == 0)
+				continue;
+			if (PageMap::getOwner(mem[i]) == PageMap::kDirectChunk)
+				releaseBudget(msp, freeDirect(mem[i]));
+			else
+				empty = freeChunk(msp, memoryToChunk(mem[i]));
+		}
+		return empty;
+	}
+
+	size_t trim(MemorySpace* msp, size_t pad)
+	{
+		std::lock_guard<AdaptiveLock> guard(msp->memory_lock);
+		freeRemoteChunks(msp);
+		return trimTop(msp, pad);
+	}
+
+	// Committed bytes of top past its header. Lock should be held by the caller.
+	static size_t getCommittedTopBytes(MemorySpace* msp)
+	{
+		uint8* top_mem = reinterpret_cast<uint8*>(msp->top) + kChunkOverhead;
+		uint8* committed_end = msp->top_seg->base + (msp->top_seg->curr_page_index * msp->page_size);
+		return (committed_end > top_mem) ? static_cast<size_t>(committed_end - top_mem) : 0;
+	}
+
+	// Fraction (in 1/65536) of the bytes freed age + 1 steps ago which are kept committed:
+	// 1 - smoothstep((age + 1) / kNumDecaySteps)
+	static size_t getDecayKeepFraction(uint32 age)
+	{
+		const uint64 n = kNumDecaySteps;
+		uint64 k = age + 1;
+		return static_cast<size_t>(65536 - ((65536 * k * k * ((3 * n) - (2 * k))) / (n * n * n)));
+	}
+
+	size_t decay(MemorySpace* msp, size_t pad)
+	{
+		std::lock_guard<AdaptiveLock> guard(msp->memory_lock);
+		freeRemoteChunks(msp);
+
+		// Record the pages top gained since the last step as the newest entry of the backlog
+		size_t dirty = getCommittedTopBytes(msp);
+		for (uint32 i = kNumDecaySteps - 1; i > 0; --i)
+			msp->decay_backlog[i] = msp->decay_backlog[i - 1];
+		msp->decay_backlog[0] = (dirty > msp->decay_dirty) ? dirty - msp->decay_dirty : 0;
+
+		// Each entry keeps a shrinking share of its bytes committed as it ages
+		size_t keep = 0;
+		for (uint32 i = 0; i < kNumDecaySteps; ++i)
+			keep += static_cast<size_t>((static_cast<uint64>(msp->decay_backlog[i]) * getDecayKeepFraction(i)) >> 16);
+		if (keep < pad)
+			keep = pad;
+
+		size_t released = (dirty > keep) ? trimTop(msp, keep) : 0;
+		msp->decay_dirty = getCommittedTopBytes(msp);
+
+		// Chunks which sat in their bin for the whole decay time give back their pages, or
+		// their whole segment if nothing else is left in it
+		++msp->decay_step;
+		released += releaseUnusedSegments(msp, kNumDecaySteps);
+		return released + decommitTreeBins(msp, kNumDecaySteps);
+	}
+
+	size_t purge(MemorySpace* msp)
+	{
+		std::lock_guard<AdaptiveLock> guard(msp->memory_lock);
+		freeRemoteChunks(msp);
+		size_t released = releaseUnusedSegments(msp, 0);
+		released += decommitTreeBins(msp, 0);
+		if (msp->dv_size != 0)
+			released += decommitFreeChunk(msp, msp->dv, msp->dv_size);
+		released += trimTop(msp, 0);
+		msp->decay_dirty = getCommittedTopBytes(msp);
+		return released;
+	}
+
+	size_t getDecommittedBytes(MemorySpace* msp)
+	{
+		std::lock_guard<AdaptiveLock> guard(msp->memory_lock);
+		size_t pages = 0;
+		for (MemorySegment* seg = &msp->seg; seg != nullptr; seg = seg->next)
+			pages += seg->decommitted_pages;
+		return pages * msp->page_size;
+	}
+
+	void setTrimThreshold(MemorySpace* msp, size_t threshold)
+	{
+		std::lock_guard<AdaptiveLock> guard(msp->memory_lock);
+		msp->trim_threshold = threshold;
+	}
+
+	// Allocate bytes with mem + offset aligned to alignment. Lock should be held by the caller.
+	static void* allocAlignedChunk(MemorySpace* msp, size_t alignment, size_t bytes, size_t offset)
 	{
-		if (alignment <= kDefaultAlignment)
-			// Just call alloc in this case
-			return alloc(msp, bytes);
 		if (alignment < kMinChunkSize)
 			// Must be at least equal to minimum chunk size
 			alignment = kMinChunkSize;
 		if ((alignment & (alignment - 1)) != 0)
 		{
 			// Ensure the alignment is a power of 2
-			size_t align = kDefaultAlignment << 1;
+			size_t align = kChunkAlignment << 1;
 			while (align < alignment)
 				align <<= 1;
 			alignment = align;
@@ -1231,8 +1928,17 @@ namespace Odin
 		{
 			size_t nb = requestToSize(bytes);
 			size_t req = nb + alignment + offset + kMinChunkSize - kChunkOverhead;
-			uint8* mem = reinterpret_cast<uint8*>(alloc(msp, req));
+			uint8* mem = reinterpret_cast<uint8*>(allocChunk(msp, req));
 
+			if (mem != 0 && PageMap::getOwner(mem) == PageMap::kDirectChunk)
+			{
+				// A chunk obtained directly from the system can't give back a leader or a trailer,
+				// get one which is placed aligned instead
+				if (reinterpret_cast<size_t>(mem + offset) % alignment == 0)
+					return mem;
+				releaseBudget(msp, freeDirect(mem));
+				return allocDirect(msp, bytes, alignment, offset);
+			}
 			if (mem != 0)
 			{
 				void* leader = 0;
@@ -1272,17 +1978,19 @@ namespace Odin
 					MemoryChunk* rem_ptr = chunkPlusOffset(ptr, nb);
 					setSizeInuse(msp, ptr, nb);
 					setSizeInuse(msp, rem_ptr, rem_size);
+					trailer = chunkToMemory(rem_ptr);
 				}
 
 				ASSERT_ERROR(chunkSize(ptr) >= nb, "Chunk size is less than requested size in allocating aligned memory");
+				ASSERT_ERROR(chunkSize(ptr) - kChunkOverhead >= bytes, "Usable size is less than requested size in allocating aligned memory");
 				ASSERT_ERROR(reinterpret_cast<size_t>(chunkToMemory(ptr)) % alignment == 0, "Aligned chunk is not aligned to necessary alignment");
 
 				if (leader != 0)
 					//odin_free(leader);
-					free(msp, leader);
+					freeChunk(msp, memoryToChunk(leader));
 				if (trailer != 0)
 					//odin_free(trailer);
-					free(msp, trailer);
+					freeChunk(msp, memoryToChunk(trailer));
 
 				return chunkToMemory(ptr);
 			}
@@ -1290,6 +1998,205 @@ namespace Odin
 		return nullptr;
 	}
 
+	void* allocAligned(MemorySpace* msp, size_t alignment, size_t bytes, size_t offset)
+	{
+		if (alignment <= kChunkAlignment && (offset & (alignment - 1)) == 0)
+			// Every chunk has this alignment, just call alloc in this case
+			return alloc(msp, bytes);
+
+		// Acquire lock once for the allocation and the leader and trailer frees
+		std::lock_guard<AdaptiveLock> guard(msp->memory_lock);
+		freeRemoteChunks(msp);
+		return allocAlignedChunk(msp, alignment, bytes, offset);
+	}
+
+	// Resize a chunk obtained directly from the system, moving it only if may_move is set.
+	// Returns the new user pointer or NULL, in which case mem is left untouched.
+	static void* reallocDirect(MemorySpace* msp, void* mem, size_t bytes, bool may_move)
+	{
+		MemoryChunk* ptr = memoryToChunk(mem);
+		// Chunks placed for alignment can't be remapped without losing it
+		if (ptr->prev_foot != 0)
+			return nullptr;
+		size_t old_map_size = chunkSize(ptr) + kChunkOverhead;
+		size_t map_size = (padRequest(bytes) + kChunkOverhead + (msp->page_size - 1)) & ~(msp->page_size - 1);
+		if (map_size == old_map_size)
+			return mem;
+		if (map_size > old_map_size && !chargeBudget(msp, map_size - old_map_size))
+			return nullptr;
+		// The segment may move, and its old pages may be handed to another thread as soon as it
+		// does. Unregister it first so that the page map entry of the new owner isn't cleared.
+		PageMap::clearOwner(mem, 1);
+		MemoryChunk* new_ptr = reinterpret_cast<MemoryChunk*>(SysAlloc::resizeSegment(ptr, old_map_size, map_size, may_move));
+		if (new_ptr == nullptr)
+		{
+			PageMap::setOwner(mem, 1, PageMap::kDirectChunk);
+			if (map_size > old_map_size)
+				releaseBudget(msp, map_size - old_map_size);
+			return nullptr;
+		}
+		if (map_size < old_map_size)
+			releaseBudget(msp, old_map_size - map_size);
+		size_t nb = map_size - kChunkOverhead;
+		setSizePinuseOfInuseChunk(msp, new_ptr, nb);
+		markInuseFootNull(new_ptr, nb);
+		void* new_mem = chunkToMemory(new_ptr);
+		PageMap::setOwner(new_mem, 1, PageMap::kDirectChunk);
+		return new_mem;
+	}
+
+	// Try to resize a chunk in place to nb bytes. Lock should be held by the caller.
+	// Returns false if the neighbouring chunks can't absorb the change.
+	static bool tryReallocChunk(MemorySpace* msp, MemoryChunk* ptr, size_t nb)
+	{
+		size_t old_size = chunkSize(ptr);
+		MemoryChunk* next_ptr = chunkPlusOffset(ptr, old_size);
+		if (old_size >= nb)
+		{
+			// Shrink, giving back the remainder if it is large enough to be a chunk
+			size_t rem_size = old_size - nb;
+			if (rem_size >= kMinChunkSize)
+			{
+				MemoryChunk* rem_ptr = chunkPlusOffset(ptr, nb);
+				setSizeInuse(msp, ptr, nb);
+				setSizeInuse(msp, rem_ptr, rem_size);
+				freeChunk(msp, rem_ptr);
+			}
+			return true;
+		}
+		else if (next_ptr == msp->top)
+		{
+			// Grow into top
+			if (old_size + msp->top_size >= nb + kChunkOverhead)
+			{
+				if (!commitPages(msp, reinterpret_cast<uint8*>(next_ptr), reinterpret_cast<uint8*>(chunkPlusOffset(ptr, nb + kChunkOverhead))))
+					return false;
+				size_t new_top_size = old_size + msp->top_size - nb;
+				MemoryChunk* new_top = chunkPlusOffset(ptr, nb);
+				setSizeInuse(msp, ptr, nb);
+				new_top->head = new_top_size | kPinuseBit;
+				msp->top = new_top;
+				msp->top_size = new_top_size;
+				return true;
+			}
+		}
+		else if (next_ptr == msp->dv)
+		{
+			// Grow into dv
+			size_t dv_size = msp->dv_size;
+			if (old_size + dv_size >= nb)
+			{
+				if (!recommitSplit(msp, ptr, old_size + dv_size, nb))
+					return false;
+				size_t rem_size = old_size + dv_size - nb;
+				if (rem_size >= kMinChunkSize)
+				{
+					MemoryChunk* rem_ptr = chunkPlusOffset(ptr, nb);
+					MemoryChunk* after_ptr = chunkPlusOffset(rem_ptr, rem_size);
+					setSizeInuse(msp, ptr, nb);
+					setSizePinuseOfFreeChunk(msp, rem_ptr, rem_size);
+					after_ptr->head &= ~kPinuseBit;
+					msp->dv_size = rem_size;
+					msp->dv = rem_ptr;
+				}
+				else
+				{
+					// Exhaust dv
+					setSizeInuse(msp, ptr, old_size + dv_size);
+					msp->dv_size = 0;
+					msp->dv = 0;
+				}
+				return true;
+			}
+		}
+		else if (!getCInuse(next_ptr))
+		{
+			// Grow into the next free chunk
+			size_t next_size = chunkSize(next_ptr);
+			if (old_size + next_size >= nb)
+			{
+				if (!recommitSplit(msp, ptr, old_size + next_size, nb))
+					return false;
+				size_t rem_size = old_size + next_size - nb;
+				unlinkChunk(msp, next_ptr, next_size);
+				if (rem_size < kMinChunkSize)
+					setSizeInuse(msp, ptr, old_size + next_size);
+				else
+				{
+					MemoryChunk* rem_ptr = chunkPlusOffset(ptr, nb);
+					setSizeInuse(msp, ptr, nb);
+					setSizeInuse(msp, rem_ptr, rem_size);
+					freeChunk(msp, rem_ptr);
+				}
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void* reallocInPlace(MemorySpace* msp, void* mem, size_t bytes)
+	{
+		if (mem == 0 || bytes >= kMaxRequest)
+			return nullptr;
+		if (PageMap::getOwner(mem) == PageMap::kDirectChunk)
+		{
+			// A moved chunk would leave mem unmapped, only resize it where it is
+			return reallocDirect(msp, mem, bytes, false);
+		}
+		std::lock_guard<AdaptiveLock> guard(msp->memory_lock);
+		MemoryChunk* ptr = memoryToChunk(mem);
+		if (tryReallocChunk(msp, ptr, requestToSize(bytes)))
+		{
+			checkInuseChunk(msp, ptr);
+			ASSERT_ERROR(getUsableSize(mem) >= bytes, "Usable size is less than requested size after resizing in place");
+			return mem;
+		}
+		return nullptr;
+	}
+
+	void* realloc(MemorySpace* msp, void* mem, size_t bytes)
+	{
+		if (mem == 0)
+			return alloc(msp, bytes);
+		if (bytes >= kMaxRequest)
+			return nullptr;
+
+		if (PageMap::getOwner(mem) == PageMap::kDirectChunk)
+		{
+			void* new_mem = reallocDirect(msp, mem, bytes, true);
+			if (new_mem != nullptr)
+				return new_mem;
+			// Can't remap, move the data to a new chunk
+			new_mem = alloc(msp, bytes);
+			if (new_mem != nullptr)
+			{
+				size_t old_usable = getUsableSize(mem);
+				memcpy(new_mem, mem, (old_usable < bytes) ? old_usable : bytes);
+				releaseBudget(msp, freeDirect(mem));
+			}
+			return new_mem;
+		}
+
+		std::lock_guard<AdaptiveLock> guard(msp->memory_lock);
+		MemoryChunk* ptr = memoryToChunk(mem);
+		if (tryReallocChunk(msp, ptr, requestToSize(bytes)))
+		{
+			checkInuseChunk(msp, ptr);
+			ASSERT_ERROR(getUsableSize(mem) >= bytes, "Usable size is less than requested size after resizing in place");
+			return mem;
+		}
+
+		// Can't resize in place, move the data to a new chunk without releasing the lock
+		void* new_mem = allocChunk(msp, bytes);
+		if (new_mem != nullptr)
+		{
+			size_t old_usable = getUsableSize(mem);
+			memcpy(new_mem, mem, (old_usable < bytes) ? old_usable : bytes);
+			freeChunk(msp, ptr);
+		}
+		return new_mem;
+	}
+
 	void* calloc(MemorySpace* msp, size_t num_elements, size_t elem_size)
 	{
 		void* mem;
@@ -1302,6 +2209,9 @@ namespace Odin
 				req = kMaxRequest;	// Force downstream failure on overflow
 		}
 		mem = alloc(msp, req);
+		// Chunks are recycled and segments may come from the segment cache, so clear the memory
+		if (mem != 0)
+			memset(mem, 0, req);
 		return mem;
 	}
 
@@ -1341,6 +2251,12 @@ namespace Odin
 			msp->commit_page_func = commit_page_func;
 			msp->decommit_page_func = decommit_page_func;*/
 
+			// The segment may come from the segment cache with stale contents, so clear the bin maps
+			msp->small_map = 0;
+			msp->tree_map = 0;
+			for (uint32 i = 0; i < kNumTreeBins; ++i)
+				msp->tree_bins[i] = 0;
+
 			// Establish circular links for small bins
 			for (uint32 i = 0; i < kNumSmallBins; ++i)
 			{
@@ -1351,17 +2267,35 @@ namespace Odin
 			// Initialize magic
 #if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
 			msp->magic = static_cast<size_t>(GetTickCount() ^ static_cast<size_t>(0x55555555U));
+#else
+			msp->magic = static_cast<size_t>(time(0) ^ static_cast<size_t>(0x55555555U));
 #endif
 			msp->magic |= 8U;	// Ensure nonzero
 			msp->magic &= ~(7U);
 
-			msp->least_addr = reinterpret_cast<uint8*>(segment_base);
-			msp->curr_page_index = 1;
+			msp->seg.base = reinterpret_cast<uint8*>(segment_base);
+			msp->seg.size = segment_size;
+			msp->seg.next = nullptr;
+			msp->seg.curr_page_index = 1;
+			msp->seg.decommitted_pages = 0;
+			for (uint32 i = 0; i < kMaxDecommitPages / 32; ++i)
+				msp->seg.decommit_map[i] = 0;
+			msp->top_seg = &msp->seg;
 
 			msp->page_size = page_size;
 			msp->segment_granularity = segment_granularity;
 			msp->segment_threshold = segment_threshold;
 			msp->footprint = msp->max_footprint = segment_size;
+			msp->huge_pages = false;
+			msp->huge_backed = false;
+			msp->tag = 0;
+			msp->budget = nullptr;
+			msp->remote_frees.store(nullptr, std::memory_order_relaxed);
+			msp->trim_threshold = kDefaultTrimThreshold;
+			for (uint32 i = 0; i < kNumDecaySteps; ++i)
+				msp->decay_backlog[i] = 0;
+			msp->decay_dirty = 0;
+			msp->decay_step = 0;
 
 			return msp;
 		}
@@ -1372,17 +2306,47 @@ namespace Odin
 
 	MemorySpace* createMemorySpace(size_t initialSize, 
 		size_t page_size, size_t segment_granularity,
-		size_t segment_threshold)
+		size_t segment_threshold, bool huge_pages)
 	{
 		// Reserve space for segment
 		size_t size = (initialSize == 0) ? segment_granularity : initialSize;
-		//void* segment = reserve_segment_func(size, NULL);
-		void* segment = SysAlloc::reserveSegment(size, NULL);
+		bool huge_backed = false;
+		void* segment = nullptr;
+		if (huge_pages)
+		{
+			// Commit whole huge pages so that a page is never split between committed and
+			// reserved state
+			const size_t huge_mask = SysAlloc::kHugePageSize - 1;
+			size = (size + huge_mask) & ~huge_mask;
+			page_size = (page_size + huge_mask) & ~huge_mask;
+			segment_granularity = (segment_granularity + huge_mask) & ~huge_mask;
+			segment = SysAlloc::reserveHugeSegment(size, huge_backed);
+		}
+		else
+			//void* segment = reserve_segment_func(size, NULL);
+			segment = SysAlloc::reserveSegment(size, NULL);
+		if (segment == nullptr)
+			return nullptr;
 		// Commit the first page
-		SysAlloc::commitPage(segment, page_size);
+		if (!SysAlloc::commitPage(segment, page_size))
+		{
+			if (huge_pages)
+				SysAlloc::releaseHugeSegment(segment, size, huge_backed);
+			else
+				SysAlloc::releaseSegment(segment, size);
+			return nullptr;
+		}
 		// Initialize the segment
 		MemorySpace* msp = initMemorySpace(segment, size, 
 			page_size, segment_granularity, segment_threshold);
+		msp->huge_pages = huge_pages;
+		msp->huge_backed = huge_backed;
+		// Make every pointer in this segment resolve to the new MemorySpace
+		if (!PageMap::setOwner(segment, size, msp))
+		{
+			destroyMemoryRegion(msp);
+			return nullptr;
+		}
 
 		return msp;
 
@@ -1396,19 +2360,38 @@ namespace Odin
 		// Initialize the segment
 		MemorySpace* msp = initMemorySpace(baseSegment, baseSegmentSize,
 			page_size, segment_granularity, segment_threshold);
+		if (msp != nullptr && !PageMap::setOwner(baseSegment, baseSegmentSize, msp))
+			return nullptr;
 
 		return msp;
 	}
 
 	size_t destroyMemoryRegion(MemorySpace* msp)
 	{
-		void* ptr = reinterpret_cast<void*>(msp->least_addr);
-		size_t size = msp->footprint;
+		void* ptr = reinterpret_cast<void*>(msp->seg.base);
+		size_t size = msp->seg.size;
+		size_t footprint = msp->footprint;
+		// The MemorySpace lives in the first page, read it before the page is decommitted
+		bool huge_pages = msp->huge_pages;
+		bool huge_backed = msp->huge_backed;
+		releaseBudget(msp, getCommittedBytes(msp));
+		// The added segments hold their own MemorySegment
+		MemorySegment* seg = msp->seg.next;
+		while (seg != nullptr)
+		{
+			MemorySegment* next = seg->next;
+			releaseSpaceSegment(msp, seg->base, seg->size);
+			seg = next;
+		}
+		PageMap::clearOwner(ptr, size);
 		SysAlloc::decommitPage(ptr, msp->page_size);
 
 		// Release this memory space
-		SysAlloc::releaseSegment(ptr, size);
-		return size;
+		if (huge_pages)
+			SysAlloc::releaseHugeSegment(ptr, size, huge_backed);
+		else
+			SysAlloc::releaseSegment(ptr, size);
+		return footprint;
 	}
 
 	size_t getTotalReservedMemory(MemorySpace* msp)
@@ -1438,6 +2421,24 @@ namespace Odin
 	}
 
 	
+	size_t getInuseBytes(MemorySpace* msp)
+	{
+		std::lock_guard<AdaptiveLock> guard(msp->memory_lock);
+		freeRemoteChunks(msp);
+		size_t in_use = 0;
+		for (MemorySegment* seg = &msp->seg; seg != nullptr; seg = seg->next)
+		{
+			MemoryChunk* curr_ptr = firstChunk(msp, seg);
+			while (reinterpret_cast<uint8*>(curr_ptr) < segmentFence(seg) && curr_ptr != msp->top)
+			{
+				if (isInuse(curr_ptr))
+					in_use += chunkSize(curr_ptr);
+				curr_ptr = nextChunk(curr_ptr);
+			}
+		}
+		return in_use;
+	}
+
 	void validateMemorySpace(MemorySpace* msp)
 	{
 #if ODIN_DEBUG == 1
@@ -1470,6 +2471,30 @@ namespace Odin
 #endif
 	}
 
+	bool setBudget(MemorySpace* msp, MemoryBudget* budget)
+	{
+		std::lock_guard<AdaptiveLock> guard(msp->memory_lock);
+		if (budget == msp->budget)
+			return true;
+		size_t committed = getCommittedBytes(msp);
+		if (budget != nullptr && !budget->charge(committed))
+			return false;
+		releaseBudget(msp, committed);
+		msp->budget = budget;
+		return true;
+	}
+
+	size_t freeDirect(void* mem)
+	{
+		MemoryChunk* ptr = memoryToChunk(mem);
+		// The lead, the chunk and the imaginary trailing chunk make up the whole segment
+		size_t lead = ptr->prev_foot;
+		size_t size = lead + chunkSize(ptr) + kChunkOverhead;
+		PageMap::clearOwner(mem, 1);
+		SysAlloc::releaseSegment(reinterpret_cast<uint8*>(ptr) - lead, size);
+		return size;
+	}
+
 	MemorySpace* getMemorySpaceAddr(void* mem)
 	{
 		MemoryChunk* ptr = memoryToChunk(mem);
@@ -1,6 +1,9 @@
 #include "DataTypes.h"
 #include "SysAlloc.h"
 #include "CompileOptions.h"
+#include "AdaptiveLock.h"
+#include "MemoryBudget.h"
+#include <atomic>
 #include <mutex>
 
 #ifndef _MEM_ALLOC_H_
@@ -10,6 +13,8 @@ namespace Odin
 {
 	// The minimum alignment
 	const size_t kDefaultAlignment = 8;
+	// Alignment of every chunk of a MemorySpace, two words like malloc (16 bytes on 64 bit)
+	const size_t kChunkAlignment = sizeof(size_t) << 1;
 
 	// Forward declaration
 	struct MemoryChunk;
@@ -17,6 +22,26 @@ namespace Odin
 
 	const uint32 kNumSmallBins = 32;
 	const uint32 kNumTreeBins = 32;
+	// Number of decay steps after which free pages of top are fully decommitted
+	const uint32 kNumDecaySteps = 16;
+	// Number of pages at the start of a segment whose decommitted state is tracked. Segments
+	// only grow beyond it if they were created larger, and free chunks past it then only give
+	// back pages at the end of top.
+	const uint32 kMaxDecommitPages = 4096;
+
+	// A reservation holding chunks of a MemorySpace. The first one is part of the MemorySpace.
+	// When the address range after top is taken, a new segment is reserved elsewhere and top
+	// moves there. Such a segment starts with an in-use chunk holding its MemorySegment and is
+	// chained to the first one.
+	struct MemorySegment
+	{
+		uint8* base;								// The starting address of this segment
+		size_t size;								// Bytes reserved, including the adjacent reservations it grew into
+		MemorySegment* next;						// Next segment added to the MemorySpace
+		uint32 curr_page_index;						// The current committed page within this segment (Index starts from 1)
+		uint32 decommitted_pages;					// Number of bits set in decommit_map
+		uint32 decommit_map[kMaxDecommitPages / 32];	// Bit set if a page below curr_page_index was decommitted inside a free chunk
+	};
 
 	// An opaque type representing an independent region of space that
 	// supports Alloc, etc.
@@ -34,48 +59,127 @@ namespace Odin
 
 		MemoryTreeChunk* tree_bins[kNumTreeBins];	// Array of tree chunk pointers
 		size_t magic;								// Seed value for checksum calculation
-		uint8* least_addr;							// The starting address of this segment
-		uint32 curr_page_index;						// The current committed page within this segment (Index starts from 1)
+		MemorySegment seg;							// The segment holding this MemorySpace, head of the segment list
+		MemorySegment* top_seg;						// The segment holding top
 
 		size_t page_size;							// Page size granularity
 		size_t segment_granularity;					// Segment size granularity
 		size_t segment_threshold;					// Size beyond which an independent call to	
 													// ReserveSegmentFunc is made to satisfy allocation
 
-		size_t footprint;
+		size_t footprint;							// Bytes reserved by all the segments
 		size_t max_footprint;
-
-		std::mutex memory_lock;						// Mutex
+		size_t trim_threshold;						// Size of top beyond which its pages are decommitted
+		size_t decay_backlog[kNumDecaySteps];		// Committed bytes top gained in each of the last decay steps, newest first
+		size_t decay_dirty;							// Committed bytes of top past its header after the last decay step
+		uint32 decay_step;							// Number of decay steps made so far
+
+		bool huge_pages;							// Segments are reserved in huge page mode
+		bool huge_backed;							// The segments are mapped on huge pages, as reported by reserveHugeSegment
+		uint32 tag;									// Set by the owner of this MemorySpace (size class in GeneralAllocator)
+		MemoryBudget* budget;						// Charged for the committed pages and the direct chunks, if set
+		std::atomic<void*> remote_frees;			// Blocks queued by freeRemote, linked through their first word
+
+		AdaptiveLock memory_lock;					// Mutex
 	};
 
 	void* alloc(MemorySpace* msp, size_t bytes);
 	void* allocAligned(MemorySpace* msp, size_t alignment, size_t bytes, size_t offset);
 	void* calloc(MemorySpace* msp, size_t num_elements, size_t elem_size);
 
-	// This function returns true if it ends up deleting the memory segment when no allocaations exist in it
+	// Resize the allocation at mem to bytes. The chunk is grown or shrunk in place whenever the
+	// neighbouring chunk, dv or top can absorb the change. Otherwise the data is moved to a new
+	// chunk of this MemorySpace. Chunks obtained directly from the system are remapped.
+	// Returns NULL and leaves mem untouched on failure.
+	void* realloc(MemorySpace* msp, void* mem, size_t bytes);
+
+	// Same as realloc but never moves the allocation. Returns mem on success, NULL otherwise.
+	void* reallocInPlace(MemorySpace* msp, void* mem, size_t bytes);
+
+	// This function returns true if no allocations exist in the memory segment after the free
 	bool free(MemorySpace* msp, void* mem);
 
+	// Queue an allocation to be freed without taking the lock. The block is freed by the next
+	// allocation, trim or getInuseBytes call on this MemorySpace, which are usually made by the
+	// thread owning it.
+	void freeRemote(MemorySpace* msp, void* mem);
+
+	// Allocate count chunks of bytes each into out, taking the lock once. Runs of chunks are
+	// carved contiguously out of dv and top. Returns the number of chunks allocated, which is
+	// less than count only if the system ran out of memory.
+	size_t allocBatch(MemorySpace* msp, size_t bytes, size_t count, void** out);
+
+	// Free count allocations of this MemorySpace, taking the lock once. NULL entries are skipped.
+	// Returns true if no allocations exist in the memory segment after the last free.
+	bool freeBatch(MemorySpace* msp, void** mem, size_t count);
+
+	// Decommit the pages at the end of the top chunk, keeping pad bytes of it committed.
+	// Returns the number of bytes decommitted.
+	size_t trim(MemorySpace* msp, size_t pad);
+
+	// Advance the decay of the free pages by one step. Pages freed at the end of top during the
+	// last kNumDecaySteps steps are kept committed along a smoothstep curve, pages older than
+	// that are decommitted, keeping at least pad bytes of top. Free chunks which stayed in their
+	// bin for kNumDecaySteps steps get the whole pages inside them decommitted, and an added
+	// segment holding nothing else is released. Call it at a steady rate: the decay time is
+	// kNumDecaySteps times the call interval.
+	// Returns the number of bytes decommitted.
+	size_t decay(MemorySpace* msp, size_t pad);
+
+	// Decommit every free page right away: the whole pages inside the free chunks, dv included,
+	// and the pages at the end of top. The added segments holding no allocation are released.
+	// Returns the number of bytes decommitted.
+	size_t purge(MemorySpace* msp);
+
+	// Return the number of bytes decommitted inside free chunks. Allocations recommit the
+	// pages they need.
+	size_t getDecommittedBytes(MemorySpace* msp);
+
+	// Set the size of top beyond which free decommits the pages at its end, and the size of
+	// a free chunk beyond which free decommits the pages inside it (2MB by default)
+	void setTrimThreshold(MemorySpace* msp, size_t threshold);
+
+	// Charge the committed pages of msp to budget, along with every page and direct chunk it gets
+	// from now on, or stop charging if budget is NULL. The pages charged to the previous budget
+	// are released from it. Returns false, leaving msp unchanged, if the pages don't fit in the
+	// hard limit of budget.
+	bool setBudget(MemorySpace* msp, MemoryBudget* budget);
+
+	// Return a chunk which was obtained directly from the system because its size exceeded the
+	// segment threshold. No lock is needed since the chunk is not part of any segment.
+	// Returns the number of bytes given back, for the caller to release from its budget.
+	size_t freeDirect(void* mem);
+
 	// Get the address of MemorySpace from the footer
 	MemorySpace* getMemorySpaceAddr(void* mem);
 	
 	// Get the size of a memory chunk
 	size_t getChunkSize(void* mem);
 
+	// Get the number of bytes usable by the caller in an allocated chunk
+	size_t getUsableSize(void* mem);
+
 	// Creates and returns a new MemorySpace or NULL on failure
 	// The initial size of the segment will be initialSize or segmentGranularity
 	// if initialSize is 0.
 	// pageSize is the minimum granularity at which memory can be Reserved,
 	// Released, Committed and Decommitted. It is also the guaranteed alignment
 	// of these operations.
-	// segmentGranularity is the size of any given independent segment.
+	// segmentGranularity is the size of any given independent segment. When top runs out, the
+	// segment holding it grows by segmentGranularity into the address range after it, or a new
+	// segment of that size is added if the range is taken.
 	// segmentThreshold is the size of an allocation request above which an
 	// independent call to ReserveSegmentFuncwill be used to satisfy the request,
 	// ensuring the allocation request will not be pooled with other allocations
 	// within this segment.
+	// If huge_pages is true, the segment is aligned to SysAlloc::kHugePageSize, pages are
+	// committed at huge page granularity and the system is asked to back them with huge
+	// pages. Falls back to regular pages if none are available.
 	MemorySpace* createMemorySpace(size_t initialSize,
 		size_t page_size,
 		size_t segment_granularity,
-		size_t segment_threshold);
+		size_t segment_threshold,
+		bool huge_pages = false);
 
 	// Same as CreateMemorySpace but specifies a base segment. If no
 	// ReserveSegmentFunc is specified, MemorySpace will not grow beyond the
@@ -101,6 +205,9 @@ namespace Odin
 	// Return the amount of usable memory in a memory space
 	size_t getUsableSize(MemorySpace* msp);
 
+	// Return the number of bytes held by chunks in use, walking every chunk of the segment
+	size_t getInuseBytes(MemorySpace* msp);
+
 	void validateMemorySpace(MemorySpace* msp);
 }
 #endif
@@ -0,0 +1,76 @@
+#include "MemoryBudget.h"
+
+namespace Odin
+{
+	MemoryBudget::MemoryBudget(size_t soft_limit, size_t hard_limit) : mUsage(0), mPeakUsage(0),
+		mSoftLimit(soft_limit), mHardLimit(hard_limit), mSoftCrossings(0), mRefusedCharges(0),
+		mPending(0), mCallback(nullptr), mUserData(nullptr)
+	{
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void MemoryBudget::setLimits(size_t soft_limit, size_t hard_limit)
+	{
+		mSoftLimit.store(soft_limit, std::memory_order_relaxed);
+		mHardLimit.store(hard_limit, std::memory_order_relaxed);
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void MemoryBudget::setPressureCallback(PressureCallback callback, void* user_data)
+	{
+		mCallback = callback;
+		mUserData = user_data;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	bool MemoryBudget::charge(size_t bytes)
+	{
+		size_t hard_limit = mHardLimit.load(std::memory_order_relaxed);
+		size_t usage = mUsage.load(std::memory_order_relaxed);
+		do
+		{
+			if (hard_limit != 0 && (usage + bytes > hard_limit || usage + bytes < usage))
+			{
+				mRefusedCharges.fetch_add(1, std::memory_order_relaxed);
+				mPending.fetch_or(1U << BUDGET_HARD_LIMIT, std::memory_order_release);
+				return false;
+			}
+		} while (!mUsage.compare_exchange_weak(usage, usage + bytes, std::memory_order_relaxed));
+
+		size_t new_usage = usage + bytes;
+		size_t peak = mPeakUsage.load(std::memory_order_relaxed);
+		while (new_usage > peak && !mPeakUsage.compare_exchange_weak(peak, new_usage, std::memory_order_relaxed))
+			;
+		// Only the charge taking the usage over the soft limit reports it
+		size_t soft_limit = mSoftLimit.load(std::memory_order_relaxed);
+		if (soft_limit != 0 && usage <= soft_limit && new_usage > soft_limit)
+		{
+			mSoftCrossings.fetch_add(1, std::memory_order_relaxed);
+			mPending.fetch_or(1U << BUDGET_SOFT_LIMIT, std::memory_order_release);
+		}
+		return true;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void MemoryBudget::release(size_t bytes)
+	{
+		mUsage.fetch_sub(bytes, std::memory_order_relaxed);
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void MemoryBudget::dispatchPending()
+	{
+		uint32 pending = mPending.exchange(0, std::memory_order_acquire);
+		if (mCallback == nullptr)
+			return;
+		if (pending & (1U << BUDGET_SOFT_LIMIT))
+			mCallback(this, BUDGET_SOFT_LIMIT, mUserData);
+		if (pending & (1U << BUDGET_HARD_LIMIT))
+			mCallback(this, BUDGET_HARD_LIMIT, mUserData);
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void MemoryBudget::getStats(BudgetStats& stats) const
+	{
+		stats.usage = mUsage.load(std::memory_order_relaxed);
+		stats.peak_usage = mPeakUsage.load(std::memory_order_relaxed);
+		stats.soft_limit = mSoftLimit.load(std::memory_order_relaxed);
+		stats.hard_limit = mHardLimit.load(std::memory_order_relaxed);
+		stats.soft_crossings = mSoftCrossings.load(std::memory_order_relaxed);
+		stats.refused_charges = mRefusedCharges.load(std::memory_order_relaxed);
+	}
+}
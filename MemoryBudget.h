@@ -0,0 +1,94 @@
+#ifndef _MEMORY_BUDGET_H_
+#define _MEMORY_BUDGET_H_
+
+#include "DataTypes.h"
+#include "CompileOptions.h"
+#include <atomic>
+
+namespace Odin
+{
+	// Limit reported to the pressure callback of a budget
+	enum BudgetLimit
+	{
+		BUDGET_SOFT_LIMIT = 0,		// The usage went over the soft limit
+		BUDGET_HARD_LIMIT = 1		// A charge was refused because it would have gone over the hard limit
+	};
+
+	// Counters of a budget
+	struct BudgetStats
+	{
+		size_t usage;					// Bytes charged
+		size_t peak_usage;				// Highest number of bytes charged
+		size_t soft_limit;				// 0 if there is no soft limit
+		size_t hard_limit;				// 0 if there is no hard limit
+		uint64 soft_crossings;			// Number of times the usage went over the soft limit
+		uint64 refused_charges;			// Number of charges refused by the hard limit
+	};
+
+	/*
+		Byte budget of one or more allocators, attached with Allocator::setBudget. Allocators
+		charge memory when they commit it or reserve it committed and release it when they give
+		it back to the system, so the budget is only checked on their slow paths. A charge which
+		would take the usage over the hard limit is refused and the allocation fails with NULL,
+		going over the soft limit is only reported.
+		The pressure callback isn't called from within a charge since the allocator may hold its
+		locks at that point. The event is recorded and the allocator dispatches it once it
+		released them, on the thread which caused it, so the callback can free memory to any
+		allocator (e.g. shrink a cache).
+	*/
+	class MemoryBudget
+	{
+	public:
+		// Called when the usage goes over the soft limit or a charge is refused
+		typedef void (*PressureCallback)(MemoryBudget* budget, BudgetLimit limit, void* user_data);
+
+		// A limit of 0 means no limit
+		explicit MemoryBudget(size_t soft_limit = 0, size_t hard_limit = 0);
+
+		// Change the limits. Bytes already charged above a new hard limit stay charged.
+		void setLimits(size_t soft_limit, size_t hard_limit);
+
+		// Set the function called on memory pressure. Should be set before the budget is attached
+		// to an allocator.
+		void setPressureCallback(PressureCallback callback, void* user_data);
+
+		// Charge bytes to the budget. Returns false, charging nothing, if the usage would go over
+		// the hard limit.
+		bool charge(size_t bytes);
+
+		// Give back bytes charged earlier
+		void release(size_t bytes);
+
+		// Call the pressure callback for the events recorded since the last dispatch. Called by
+		// the allocators while they hold no lock.
+		FORCEINLINE void dispatch()
+		{
+			if (mPending.load(std::memory_order_relaxed) != 0)
+				dispatchPending();
+		}
+
+		// Return the number of bytes charged
+		size_t getUsage() const { return mUsage.load(std::memory_order_relaxed); }
+
+		// Fill stats with the counters of the budget
+		void getStats(BudgetStats& stats) const;
+	private:
+		MemoryBudget(const MemoryBudget&) = delete;
+		MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+		// Call the pressure callback for every recorded event
+		void dispatchPending();
+
+		std::atomic<size_t> mUsage;
+		std::atomic<size_t> mPeakUsage;
+		std::atomic<size_t> mSoftLimit;
+		std::atomic<size_t> mHardLimit;
+		std::atomic<uint64> mSoftCrossings;
+		std::atomic<uint64> mRefusedCharges;
+		// Bit (1 << limit) set for every limit with an event waiting for dispatch
+		std::atomic<uint32> mPending;
+		PressureCallback mCallback;
+		void* mUserData;
+	};
+}
+#endif	// _MEMORY_BUDGET_H_
@@ -0,0 +1,419 @@
+#include "MemoryMonitor.h"
+#include "SysAlloc.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <system_error>
+
+#if ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Odin
+{
+#if ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+	// cgroup v1 reports a limit this large when there is none
+	const size_t kNoCgroupLimit = static_cast<size_t>(1) << 62;
+
+	//--------------------------------------------------------------------------------------------------------------
+	// Read a small text file into buffer. The files are read without stdio so that polling
+	// doesn't allocate from the allocators it is about to purge. Returns false if the file
+	// could not be read.
+	static bool readTextFile(const char* path, char* buffer, size_t size)
+	{
+		if (path[0] == '\0')
+			return false;
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return false;
+		size_t length = 0;
+		while (length + 1 < size)
+		{
+			ssize_t count = read(fd, buffer + length, size - 1 - length);
+			if (count < 0 && errno == EINTR)
+				continue;
+			if (count <= 0)
+				break;
+			length += static_cast<size_t>(count);
+		}
+		close(fd);
+		buffer[length] = '\0';
+		return length > 0;
+	}
+
+	// Read a byte count. "max" and the cgroup v1 value for no limit read as 0.
+	static bool readBytes(const char* path, size_t& bytes)
+	{
+		char text[64];
+		if (!readTextFile(path, text, sizeof(text)))
+			return false;
+		if (strncmp(text, "max", 3) == 0)
+		{
+			bytes = 0;
+			return true;
+		}
+		bytes = static_cast<size_t>(strtoull(text, nullptr, 10));
+		if (bytes >= kNoCgroupLimit)
+			bytes = 0;
+		return true;
+	}
+
+	// Find avg10 on the line of a PSI file starting with prefix ("some" or "full").
+	// Returns -1 if there is no such line.
+	static float64 parseStall(const char* text, const char* prefix)
+	{
+		size_t prefix_length = strlen(prefix);
+		for (const char* line = text; line != nullptr && *line != '\0'; line = strchr(line, '\n'))
+		{
+			if (*line == '\n')
+				++line;
+			if (strncmp(line, prefix, prefix_length) != 0)
+				continue;
+			const char* avg10 = strstr(line, "avg10=");
+			const char* line_end = strchr(line, '\n');
+			if (avg10 == nullptr || (line_end != nullptr && avg10 > line_end))
+				return -1.0;
+			return strtod(avg10 + 6, nullptr);
+		}
+		return -1.0;
+	}
+
+	static bool isReadable(const char* path)
+	{
+		return access(path, R_OK) == 0;
+	}
+#endif
+	//--------------------------------------------------------------------------------------------------------------
+	MemoryMonitor::MemoryMonitor() : mInitialized(false), mModerateUsage(kDefaultModerateUsage),
+		mCriticalUsage(kDefaultCriticalUsage), mModerateStall(kDefaultModerateStall),
+		mCriticalStall(kDefaultCriticalStall), mNumAllocators(0), mNumOwnedAllocators(0), mNumHandlers(0), mLevel(PRESSURE_NONE),
+		mNumResponses(0), mReleasedBytes(0), mStopThread(false)
+	{
+		mCurrentPath[0] = mMaxPath[0] = mHighPath[0] = mPressurePath[0] = '\0';
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	MemoryMonitor::~MemoryMonitor()
+	{
+		stop();
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	bool MemoryMonitor::init(const char* cgroup_path)
+	{
+#if ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+		if (cgroup_path != nullptr)
+			return mInitialized = useCgroup(cgroup_path);
+
+		// Every line of /proc/self/cgroup is "hierarchy:controllers:path". The cgroup v2
+		// hierarchy has id 0 and no controllers, a cgroup v1 hierarchy lists memory among them.
+		char text[4096];
+		if (!readTextFile("/proc/self/cgroup", text, sizeof(text)))
+			return false;
+		char v2_path[kMaxPathLength] = "";
+		char v1_path[kMaxPathLength] = "";
+		bool has_v2 = false, has_v1 = false;
+		for (char* line = text; line != nullptr && *line != '\0'; )
+		{
+			char* line_end = strchr(line, '\n');
+			if (line_end != nullptr)
+				*line_end = '\0';
+			char* controllers = strchr(line, ':');
+			char* path = (controllers != nullptr) ? strchr(controllers + 1, ':') : nullptr;
+			if (path != nullptr)
+			{
+				*path++ = '\0';
+				++controllers;
+				if (controllers[0] == '\0')
+				{
+					snprintf(v2_path, sizeof(v2_path), "%s", path);
+					has_v2 = true;
+				}
+				else
+				{
+					// Look for memory in the comma separated list of controllers
+					for (char* name = controllers; name != nullptr; name = strchr(name, ','))
+					{
+						if (*name == ',')
+							++name;
+						if (strncmp(name, "memory", 6) == 0 && (name[6] == ',' || name[6] == '\0'))
+						{
+							snprintf(v1_path, sizeof(v1_path), "%s", path);
+							has_v1 = true;
+							break;
+						}
+					}
+				}
+			}
+			line = (line_end != nullptr) ? line_end + 1 : nullptr;
+		}
+
+		// Inside a cgroup namespace the hierarchy is mounted at the cgroup of the process and
+		// the path may not exist below the mount point, use the mount point itself then
+		char directory[kMaxPathLength];
+		if (has_v2)
+		{
+			snprintf(directory, sizeof(directory), "/sys/fs/cgroup%s", v2_path);
+			if (useCgroup(directory) || useCgroup("/sys/fs/cgroup"))
+				return mInitialized = true;
+		}
+		if (has_v1)
+		{
+			snprintf(directory, sizeof(directory), "/sys/fs/cgroup/memory%s", v1_path);
+			if (useCgroup(directory) || useCgroup("/sys/fs/cgroup/memory"))
+				return mInitialized = true;
+		}
+#endif
+		return false;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	bool MemoryMonitor::useCgroup(const char* directory)
+	{
+#if ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+		snprintf(mCurrentPath, kMaxPathLength, "%s/memory.current", directory);
+		if (isReadable(mCurrentPath))
+		{
+			snprintf(mMaxPath, kMaxPathLength, "%s/memory.max", directory);
+			snprintf(mHighPath, kMaxPathLength, "%s/memory.high", directory);
+			snprintf(mPressurePath, kMaxPathLength, "%s/memory.pressure", directory);
+		}
+		else
+		{
+			// cgroup v1 has no memory.high nor per cgroup stall times
+			snprintf(mCurrentPath, kMaxPathLength, "%s/memory.usage_in_bytes", directory);
+			if (!isReadable(mCurrentPath))
+			{
+				mCurrentPath[0] = '\0';
+				return false;
+			}
+			snprintf(mMaxPath, kMaxPathLength, "%s/memory.limit_in_bytes", directory);
+			mHighPath[0] = '\0';
+			snprintf(mPressurePath, kMaxPathLength, "/proc/pressure/memory");
+		}
+		if (!isReadable(mPressurePath))
+			mPressurePath[0] = '\0';
+		return true;
+#else
+		return false;
+#endif
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void MemoryMonitor::setThresholds(float64 moderate_usage, float64 critical_usage,
+		float64 moderate_stall, float64 critical_stall)
+	{
+		mModerateUsage = moderate_usage;
+		mCriticalUsage = critical_usage;
+		mModerateStall = moderate_stall;
+		mCriticalStall = critical_stall;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	bool MemoryMonitor::addAllocator(Allocator* allocator)
+	{
+		std::lock_guard<std::mutex> guard(mClientsMutex);
+		if (mNumAllocators == kMaxClients)
+			return false;
+		mAllocators[mNumAllocators++] = allocator;
+		return true;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	bool MemoryMonitor::addOwnedAllocator(Allocator* allocator)
+	{
+		std::lock_guard<std::mutex> guard(mClientsMutex);
+		if (mNumOwnedAllocators == kMaxClients)
+			return false;
+		mOwnedAllocators[mNumOwnedAllocators].allocator = allocator;
+		mOwnedAllocators[mNumOwnedAllocators].purge_pending = false;
+		++mNumOwnedAllocators;
+		return true;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void MemoryMonitor::removeAllocator(Allocator* allocator)
+	{
+		std::lock_guard<std::mutex> guard(mClientsMutex);
+		for (uint32 i = 0; i < mNumAllocators; ++i)
+		{
+			if (mAllocators[i] == allocator)
+			{
+				mAllocators[i] = mAllocators[--mNumAllocators];
+				return;
+			}
+		}
+		for (uint32 i = 0; i < mNumOwnedAllocators; ++i)
+		{
+			if (mOwnedAllocators[i].allocator == allocator)
+			{
+				mOwnedAllocators[i] = mOwnedAllocators[--mNumOwnedAllocators];
+				return;
+			}
+		}
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	size_t MemoryMonitor::purgeOwnedAllocator(Allocator* allocator)
+	{
+		bool purge = false;
+		{
+			std::lock_guard<std::mutex> guard(mClientsMutex);
+			for (uint32 i = 0; i < mNumOwnedAllocators; ++i)
+			{
+				if (mOwnedAllocators[i].allocator == allocator)
+				{
+					purge = mOwnedAllocators[i].purge_pending;
+					mOwnedAllocators[i].purge_pending = false;
+					break;
+				}
+			}
+		}
+		if (!purge)
+			return 0;
+		// The calling thread owns the allocator, no other thread touches it
+		size_t released = allocator->purge();
+		mReleasedBytes.fetch_add(released, std::memory_order_relaxed);
+		return released;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	bool MemoryMonitor::addHandler(PressureHandler handler, void* user_data)
+	{
+		std::lock_guard<std::mutex> guard(mClientsMutex);
+		if (mNumHandlers == kMaxClients)
+			return false;
+		mHandlers[mNumHandlers].function = handler;
+		mHandlers[mNumHandlers].user_data = user_data;
+		++mNumHandlers;
+		return true;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void MemoryMonitor::removeHandler(PressureHandler handler, void* user_data)
+	{
+		std::lock_guard<std::mutex> guard(mClientsMutex);
+		for (uint32 i = 0; i < mNumHandlers; ++i)
+		{
+			if (mHandlers[i].function == handler && mHandlers[i].user_data == user_data)
+			{
+				mHandlers[i] = mHandlers[--mNumHandlers];
+				return;
+			}
+		}
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	bool MemoryMonitor::readStats(CgroupMemoryStats& stats) const
+	{
+#if ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+		if (!mInitialized || !readBytes(mCurrentPath, stats.current))
+			return false;
+		// The lower of the two limits is the one the process runs into first
+		size_t max_limit = 0, high_limit = 0;
+		readBytes(mMaxPath, max_limit);
+		readBytes(mHighPath, high_limit);
+		stats.limit = max_limit;
+		if (high_limit != 0 && (stats.limit == 0 || high_limit < stats.limit))
+			stats.limit = high_limit;
+
+		char text[256];
+		if (readTextFile(mPressurePath, text, sizeof(text)))
+		{
+			stats.some_avg10 = parseStall(text, "some");
+			stats.full_avg10 = parseStall(text, "full");
+		}
+		else
+			stats.some_avg10 = stats.full_avg10 = -1.0;
+		return true;
+#else
+		return false;
+#endif
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	PressureLevel MemoryMonitor::getPressureLevel(const CgroupMemoryStats& stats) const
+	{
+		PressureLevel level = PRESSURE_NONE;
+		if (stats.limit != 0)
+		{
+			float64 usage = static_cast<float64>(stats.current) / static_cast<float64>(stats.limit);
+			if (usage >= mCriticalUsage)
+				return PRESSURE_CRITICAL;
+			if (usage >= mModerateUsage)
+				level = PRESSURE_MODERATE;
+		}
+		// Stall times show reclaim going on even without a limit (e.g. a parent cgroup is full)
+		if (mCriticalStall > 0.0 && stats.full_avg10 >= mCriticalStall)
+			return PRESSURE_CRITICAL;
+		if (mModerateStall > 0.0 && stats.some_avg10 >= mModerateStall)
+			level = PRESSURE_MODERATE;
+		return level;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	PressureLevel MemoryMonitor::poll()
+	{
+		CgroupMemoryStats stats;
+		if (!readStats(stats))
+			return PRESSURE_NONE;
+		PressureLevel level = getPressureLevel(stats);
+		uint32 previous = mLevel.exchange(level, std::memory_order_relaxed);
+		// Keep shedding memory while it is critical, the allocators may have refilled their caches
+		if (level == PRESSURE_CRITICAL || static_cast<uint32>(level) > previous)
+			respond(level);
+		return level;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	size_t MemoryMonitor::respond(PressureLevel level)
+	{
+		size_t released = SysAlloc::purgeSegmentCache();
+		{
+			std::lock_guard<std::mutex> guard(mClientsMutex);
+			for (uint32 i = 0; i < mNumAllocators; ++i)
+				released += mAllocators[i]->purge();
+			// The owners purge the others, their bytes are counted when they do
+			for (uint32 i = 0; i < mNumOwnedAllocators; ++i)
+				mOwnedAllocators[i].purge_pending = true;
+			for (uint32 i = 0; i < mNumHandlers; ++i)
+				released += mHandlers[i].function(level, mHandlers[i].user_data);
+		}
+		mNumResponses.fetch_add(1, std::memory_order_relaxed);
+		mReleasedBytes.fetch_add(released, std::memory_order_relaxed);
+		return released;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	bool MemoryMonitor::start(uint32 interval_ms)
+	{
+		std::lock_guard<std::mutex> guard(mThreadMutex);
+		if (!mInitialized || mThread.joinable())
+			return false;
+		if (interval_ms == 0)
+			interval_ms = 1;
+		mStopThread = false;
+		try
+		{
+			mThread = std::thread(&MemoryMonitor::run, this, interval_ms);
+		}
+		catch (const std::system_error&)
+		{
+			return false;
+		}
+		return true;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void MemoryMonitor::stop()
+	{
+		{
+			std::lock_guard<std::mutex> guard(mThreadMutex);
+			if (!mThread.joinable())
+				return;
+			mStopThread = true;
+		}
+		mThreadCondition.notify_one();
+		mThread.join();
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void MemoryMonitor::run(uint32 interval_ms)
+	{
+		std::unique_lock<std::mutex> lock(mThreadMutex);
+		while (!mThreadCondition.wait_for(lock, std::chrono::milliseconds(interval_ms),
+			[this] { return mStopThread; }))
+		{
+			// Don't hold up stop while the allocators are purged
+			lock.unlock();
+			poll();
+			lock.lock();
+		}
+	}
+}
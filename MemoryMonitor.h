@@ -0,0 +1,171 @@
+#ifndef _MEMORY_MONITOR_H_
+#define _MEMORY_MONITOR_H_
+
+#include "DataTypes.h"
+#include "Allocator.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace Odin
+{
+	// Memory pressure of the cgroup of the process
+	enum PressureLevel
+	{
+		PRESSURE_NONE = 0,
+		PRESSURE_MODERATE = 1,		// Getting close to the limit, or tasks start stalling on memory
+		PRESSURE_CRITICAL = 2		// About to be reclaimed or throttled by the kernel
+	};
+
+	// Memory state of a cgroup
+	struct CgroupMemoryStats
+	{
+		size_t current;				// Bytes charged to the cgroup
+		size_t limit;				// Lowest of memory.max and memory.high (memory.limit_in_bytes on cgroup v1), 0 if unlimited
+		float64 some_avg10;			// Percentage of the last 10 seconds some task stalled on memory, -1 without PSI
+		float64 full_avg10;			// Percentage of the last 10 seconds all the tasks stalled on memory, -1 without PSI
+	};
+
+	// Default thresholds of the pressure levels
+	const float64 kDefaultModerateUsage = 0.85;		// Fraction of the limit in use
+	const float64 kDefaultCriticalUsage = 0.95;
+	const float64 kDefaultModerateStall = 5.0;		// some_avg10
+	const float64 kDefaultCriticalStall = 5.0;		// full_avg10
+
+	/*
+		Watches the memory of the cgroup the process runs in and sheds the memory cached by
+		the allocators before the kernel reclaims or throttles the process. It reads
+		memory.current, memory.max and memory.high and the PSI stall times of memory.pressure
+		(cgroup v2), falling back to memory.usage_in_bytes, memory.limit_in_bytes and the
+		system-wide /proc/pressure/memory on cgroup v1.
+		When the pressure level rises, and on every poll while it is critical, the segment
+		cache of SysAlloc is purged, every registered allocator is purged and every registered
+		handler is called. Allocators which aren't thread safe are only flagged, and are purged
+		by the thread owning them. Only available on Linux, init fails elsewhere.
+	*/
+	class MemoryMonitor
+	{
+	public:
+		// Called on memory pressure. Returns the number of bytes released.
+		typedef size_t (*PressureHandler)(PressureLevel level, void* user_data);
+
+		MemoryMonitor();
+		~MemoryMonitor();
+
+		// Find the cgroup of the process, or use the cgroup directory cgroup_path if it is set
+		// (e.g. "/sys/fs/cgroup/my.slice/my.service"). Returns false if there is no cgroup
+		// memory controller to read.
+		bool init(const char* cgroup_path = nullptr);
+
+		// Set the fraction of the limit in use and the PSI stall percentages at which the
+		// pressure becomes moderate and critical. A stall threshold of 0 ignores PSI.
+		void setThresholds(float64 moderate_usage, float64 critical_usage,
+			float64 moderate_stall, float64 critical_stall);
+
+		// Purge allocator on memory pressure, from the thread calling poll (the monitor thread
+		// once started). Only for allocators which can be purged while other threads use them,
+		// such as GeneralAllocator. Returns false if too many are registered.
+		bool addAllocator(Allocator* allocator);
+		// Purge allocator on memory pressure from the thread owning it, for allocators which
+		// aren't thread safe (LinearAllocator, FrameAllocator, PoolAllocator, ...). A response
+		// only flags the allocator, the owner purges it in purgeOwnedAllocator.
+		// Returns false if too many are registered.
+		bool addOwnedAllocator(Allocator* allocator);
+		// Unregister an allocator added with either of the above
+		void removeAllocator(Allocator* allocator);
+
+		// Purge allocator if a response flagged it since the last call. Call it from the thread
+		// owning the allocator at a steady rate (e.g. once per frame). Returns the number of
+		// bytes released.
+		size_t purgeOwnedAllocator(Allocator* allocator);
+
+		// Call handler on memory pressure. It must not register or unregister anything.
+		// Returns false if too many are registered.
+		bool addHandler(PressureHandler handler, void* user_data);
+		void removeHandler(PressureHandler handler, void* user_data);
+
+		// Read the current state of the cgroup. Returns false if it could not be read.
+		bool readStats(CgroupMemoryStats& stats) const;
+
+		// Read the state of the cgroup and respond to the pressure. Returns the pressure level.
+		PressureLevel poll();
+
+		// Purge the segment cache and the allocators added with addAllocator, flag the ones added
+		// with addOwnedAllocator and call the registered handlers. Returns the number of bytes
+		// released, not counting the owned allocators.
+		size_t respond(PressureLevel level);
+
+		// Start a thread calling poll every interval_ms milliseconds. Returns false if the
+		// monitor isn't initialized, is already running or the thread could not be created.
+		bool start(uint32 interval_ms);
+
+		// Stop the monitor thread and wait for it to exit
+		void stop();
+
+		// Return the pressure level found by the last poll
+		PressureLevel getLevel() const { return static_cast<PressureLevel>(mLevel.load(std::memory_order_relaxed)); }
+
+		// Return the number of responses made and the bytes they released
+		uint64 getNumResponses() const { return mNumResponses.load(std::memory_order_relaxed); }
+		uint64 getReleasedBytes() const { return mReleasedBytes.load(std::memory_order_relaxed); }
+	private:
+		// Maximum number of registered allocators and handlers
+		static const uint32 kMaxClients = 32;
+		static const uint32 kMaxPathLength = 512;
+
+		struct Handler
+		{
+			PressureHandler function;
+			void* user_data;
+		};
+
+		struct OwnedAllocator
+		{
+			Allocator* allocator;
+			bool purge_pending;		// Flagged by a response, not purged by the owner yet
+		};
+
+		MemoryMonitor(const MemoryMonitor&) = delete;
+		MemoryMonitor& operator=(const MemoryMonitor&) = delete;
+
+		// Read the cgroup files in directory. Returns false if it has no memory controller files.
+		bool useCgroup(const char* directory);
+		// Get the pressure level of a cgroup state
+		PressureLevel getPressureLevel(const CgroupMemoryStats& stats) const;
+		// Monitor thread function
+		void run(uint32 interval_ms);
+
+		// Files of the cgroup, empty if the cgroup has no such file
+		char mCurrentPath[kMaxPathLength];
+		char mMaxPath[kMaxPathLength];
+		char mHighPath[kMaxPathLength];
+		char mPressurePath[kMaxPathLength];
+		bool mInitialized;
+
+		float64 mModerateUsage;
+		float64 mCriticalUsage;
+		float64 mModerateStall;
+		float64 mCriticalStall;
+
+		// Registered allocators and handlers
+		std::mutex mClientsMutex;
+		Allocator* mAllocators[kMaxClients];
+		uint32 mNumAllocators;
+		OwnedAllocator mOwnedAllocators[kMaxClients];
+		uint32 mNumOwnedAllocators;
+		Handler mHandlers[kMaxClients];
+		uint32 mNumHandlers;
+
+		std::atomic<uint32> mLevel;
+		std::atomic<uint64> mNumResponses;
+		std::atomic<uint64> mReleasedBytes;
+
+		// Thread calling poll periodically, and the flag and condition stopping it
+		std::thread mThread;
+		std::mutex mThreadMutex;
+		std::condition_variable mThreadCondition;
+		bool mStopThread;
+	};
+}
+#endif	// _MEMORY_MONITOR_H_
@@ -0,0 +1,89 @@
+#include "PageMap.h"
+#include "SysAlloc.h"
+#include "Assert.h"
+#include <atomic>
+
+namespace Odin
+{
+	namespace PageMap
+	{
+		typedef std::atomic<MemorySpace*> PageMapLeaf;
+
+		const size_t kRootSize = static_cast<size_t>(1) << kRootBits;
+		const size_t kLeafSize = static_cast<size_t>(1) << kLeafBits;
+		const size_t kLeafMask = kLeafSize - 1;
+
+		// The root level lives in zero initialized static storage, so untouched parts of it
+		// never become resident
+		static std::atomic<PageMapLeaf*> sRoot[kRootSize];
+
+		// Get the leaf covering the page key, creating it if required
+		static PageMapLeaf* getOrCreateLeaf(size_t key)
+		{
+			size_t root_index = key >> kLeafBits;
+			ASSERT_ERROR(root_index < kRootSize, "Address is outside of the range covered by the page map");
+			PageMapLeaf* leaf = sRoot[root_index].load(std::memory_order_acquire);
+			if (leaf == nullptr)
+			{
+				// Memory from the system is zero filled, which is a valid empty leaf
+				PageMapLeaf* new_leaf = static_cast<PageMapLeaf*>(
+					SysAlloc::reserveCommitSegment(kLeafSize * sizeof(PageMapLeaf)));
+				if (new_leaf == nullptr)
+					return nullptr;
+				if (sRoot[root_index].compare_exchange_strong(leaf, new_leaf, std::memory_order_acq_rel))
+					leaf = new_leaf;
+				else
+					// Another thread installed the leaf first
+					SysAlloc::releaseSegment(new_leaf, kLeafSize * sizeof(PageMapLeaf));
+			}
+			return leaf;
+		}
+		//------------------------------------------------------------------------------------------
+		bool setOwner(void* base, size_t size, MemorySpace* owner)
+		{
+			size_t first_key = reinterpret_cast<size_t>(base) >> kPageShift;
+			size_t last_key = (reinterpret_cast<size_t>(base) + size - 1) >> kPageShift;
+			PageMapLeaf* leaf = nullptr;
+			for (size_t key = first_key; key <= last_key; ++key)
+			{
+				if (leaf == nullptr || (key & kLeafMask) == 0)
+				{
+					leaf = getOrCreateLeaf(key);
+					if (leaf == nullptr)
+						return false;
+				}
+				leaf[key & kLeafMask].store(owner, std::memory_order_release);
+			}
+			return true;
+		}
+		//------------------------------------------------------------------------------------------
+		void clearOwner(void* base, size_t size)
+		{
+			size_t first_key = reinterpret_cast<size_t>(base) >> kPageShift;
+			size_t last_key = (reinterpret_cast<size_t>(base) + size - 1) >> kPageShift;
+			for (size_t key = first_key; key <= last_key; ++key)
+			{
+				PageMapLeaf* leaf = sRoot[key >> kLeafBits].load(std::memory_order_acquire);
+				if (leaf == nullptr)
+				{
+					// Nothing is mapped in the range covered by this leaf, skip to the next one
+					key |= kLeafMask;
+					continue;
+				}
+				leaf[key & kLeafMask].store(nullptr, std::memory_order_relaxed);
+			}
+		}
+		//------------------------------------------------------------------------------------------
+		MemorySpace* getOwner(const void* ptr)
+		{
+			size_t key = reinterpret_cast<size_t>(ptr) >> kPageShift;
+			size_t root_index = key >> kLeafBits;
+			if (root_index >= kRootSize)
+				return nullptr;
+			PageMapLeaf* leaf = sRoot[root_index].load(std::memory_order_acquire);
+			if (leaf == nullptr)
+				return nullptr;
+			return leaf[key & kLeafMask].load(std::memory_order_acquire);
+		}
+	}
+}
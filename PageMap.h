@@ -0,0 +1,45 @@
+#ifndef _PAGE_MAP_H_
+#define _PAGE_MAP_H_
+
+#include "DataTypes.h"
+
+namespace Odin
+{
+	// Forward declaration
+	struct MemorySpace;
+
+	/*
+		Two level radix tree mapping every system page of a segment to the MemorySpace owning it.
+		Lookups take two dependent loads and no locks. Leaves are committed lazily the first time
+		a segment lands in the range they cover and are never released.
+		Only the low 48 bits of an address are used.
+	*/
+	namespace PageMap
+	{
+		// Granularity of the map (4KB, the smallest alignment of a segment on any platform)
+		const uint32 kPageShift = 12;
+		// Number of address bits resolved by each level
+		const uint32 kLeafBits = 18;
+		const uint32 kRootBits = 48 - kPageShift - kLeafBits;
+
+		// Owner of a chunk which was obtained directly from the system because its size
+		// exceeded the segment threshold. Only the first page of such a chunk is mapped.
+		MemorySpace* const kDirectChunk = reinterpret_cast<MemorySpace*>(1);
+
+		// Owner of the pages of a slab run. The header of the run sits at the start of the
+		// kSlabRunSize aligned block containing the address.
+		MemorySpace* const kSlabRun = reinterpret_cast<MemorySpace*>(2);
+
+		// Map the pages in [base, base + size) to owner. Returns false if a leaf of the map
+		// could not be allocated.
+		bool setOwner(void* base, size_t size, MemorySpace* owner);
+
+		// Remove the pages in [base, base + size) from the map
+		void clearOwner(void* base, size_t size);
+
+		// Return the owner of the page containing ptr or NULL if the page is not mapped
+		MemorySpace* getOwner(const void* ptr);
+	}
+}
+
+#endif	// _PAGE_MAP_H_
@@ -4,50 +4,95 @@ namespace Odin
 {
 
 	PoolAllocator::PoolAllocator(Allocator* allocator, size_t element_size,
-		size_t element_count, size_t alignment, size_t offset) : mAllocator(allocator),
-		mOffset(offset), mAlignment(alignment)
+		size_t element_count, size_t alignment, size_t offset, uint32 max_blocks,
+		uint32 retained_blocks) : mAlignment(alignment), mCount(0), mOffset(offset),
+		mAllocator(allocator), mStart(nullptr), mFirstBlock(nullptr), mNumBlocks(0), mNumEmptyBlocks(0),
+		mMaxBlocks(max_blocks), mRetainedBlocks(retained_blocks)
 	{
-		// Calculate the total size required by this pool
-		size_t final_element_size = (element_size + (2 * offset)) & ~(alignment - 1);
-		size_t total_size = (final_element_size * element_count) + alignment;
+		ASSERT_ERROR(((alignment & (alignment - 1)) == 0), "Alignment is not a power of 2");
+		if (mAlignment < sizeof(void*))
+			mAlignment = sizeof(void*);
+		if (element_count == 0)
+			element_count = 1;
+		// Calculate the size of an element with its guard bytes. A free element holds the link
+		// of the free list of its block.
+		size_t final_element_size = element_size + (2 * offset);
+		if (final_element_size < sizeof(void*))
+			final_element_size = sizeof(void*);
+		mElementSize = (final_element_size + (mAlignment - 1)) & ~(mAlignment - 1);
 
-		mSize = total_size;
+		// Round the block up to a power of two and fill it with as many elements as fit
+		size_t required = sizeof(Block) + offset + mAlignment + (mElementSize * element_count);
+		mBlockSize = 1;
+		while (mBlockSize < required)
+			mBlockSize <<= 1;
+		uint8* first = reinterpret_cast<uint8*>(((sizeof(Block) + offset + (mAlignment - 1)) &
+			~(mAlignment - 1)) - offset);
+		mCapacity = (mBlockSize - reinterpret_cast<size_t>(first)) / mElementSize;
 		mChunkSize = element_size;
+
+		for (uint32 i = 0; i < kNumLists; i++)
+			mLists[i] = nullptr;
 	}
 	//-------------------------------------------------------------------------------------------
 	PoolAllocator::~PoolAllocator()
 	{
 		ASSERT_ERROR(mCount == 0, "Pool allocator has memory leaks");
-		// Destroy the free list and deallocate the memory
-		mFreeList->~FreeList();
-		mAllocator->deallocate(static_cast<void*>(mStart));
-		mFreeList = nullptr;
+		// Give every block back to the parent allocator
+		for (uint32 i = 0; i < kNumLists; i++)
+		{
+			while (mLists[i] != nullptr)
+				releaseBlock(mLists[i]);
+		}
+		mFirstBlock = nullptr;
+		mStart = nullptr;
 	}
 	//------------------------------------------------------------------------------------------
 	bool PoolAllocator::init()
 	{
-		// Allocate the required memory
-		mStart = static_cast<uint8*>(mAllocator->allocate(mSize + sizeof(FreeList), 
-				mAlignment, mOffset, 0, 0, 0));
-		if (mStart)
-		{
-			// Initialize the free list. Use placement new
-			mFreeList = new(static_cast<void*>(mStart)) FreeList(static_cast<void*>(mStart + sizeof(FreeList)),
-				mSize, mChunkSize, mAlignment, mOffset);
+		if (mFirstBlock != nullptr)
 			return true;
-		}
-		return false;
+		// The first block is taken up front as the pool used to be
+		mFirstBlock = createBlock();
+		if (mFirstBlock == nullptr)
+			return false;
+		mStart = mFirstBlock->unused;
+		return true;
 	}
 	//------------------------------------------------------------------------------------------
 	void* PoolAllocator::allocate(size_t size, size_t alignment, size_t offset,
 		const char* file_name, uint32 line, const char* func_name)
 	{
 		ASSERT_ERROR(mChunkSize == size, "Size of chunk does not match the expected size in pool allocator");
-		ASSERT_ERROR(mAlignment == alignment, "Alignment of chunk does not match the expected alignment in pool allocator");
+		ASSERT_ERROR(mAlignment >= alignment, "Alignment of chunk does not match the expected alignment in pool allocator");
 		ASSERT_ERROR(mOffset == offset, "Offset of chunk does not match the expected offset in pool allocator");
+		// Take the fullest block with a free element, then an empty block, then a new block
+		Block* block = nullptr;
+		for (uint32 i = kNumPartialLists; i > 0 && block == nullptr; i--)
+			block = mLists[i - 1];
+		if (block == nullptr)
+			block = mLists[kEmptyList];
+		if (block == nullptr)
+		{
+			block = createBlock();
+			if (block == nullptr)
+				return nullptr;
+		}
+
+		uint8* ptr = block->free;
+		if (ptr != nullptr)
+			block->free = *(reinterpret_cast<uint8**>(ptr));
+		else
+		{
+			// Hand out the elements of a block in address order the first time round
+			ptr = block->unused;
+			block->unused += mElementSize;
+		}
+		block->used++;
+		updateList(block);
 		// Increment the number of allocations (Used for getTotalAllocated())
 		++mCount;
-		return mFreeList->obtainNode();
+		return static_cast<void*>(ptr);
 	}
 	//------------------------------------------------------------------------------------------
 	void* PoolAllocator::callocate(size_t num_elements, size_t elem_size,
@@ -60,10 +105,18 @@ namespace Odin
 	{
 		if (ptr)
 		{
-			ASSERT_ERROR(ptr > mStart && ptr < (mStart + mSize), "Chunk returned does not belong to this pool");
+			Block* block = getBlock(ptr);
+			ASSERT_ERROR(static_cast<uint8*>(ptr) < block->unused && block->used != 0,
+				"Chunk returned does not belong to this pool");
 			// Decrement the number of allocations (Used for getTotalAllocated())
 			--mCount;
-			mFreeList->returnNode(ptr);
+			*(reinterpret_cast<uint8**>(ptr)) = block->free;
+			block->free = static_cast<uint8*>(ptr);
+			block->used--;
+			updateList(block);
+			// Keep a few empty blocks around for the next burst of allocations
+			if (block->used == 0 && block != mFirstBlock && mNumEmptyBlocks > mRetainedBlocks)
+				releaseBlock(block);
 		}
 	}
 	//------------------------------------------------------------------------------------------
@@ -76,4 +129,107 @@ namespace Odin
 	{
 		return ((mChunkSize + (2 * mOffset)) * mCount);
 	}
+	//------------------------------------------------------------------------------------------
+	size_t PoolAllocator::purge()
+	{
+		size_t released = 0;
+		Block* block = mLists[kEmptyList];
+		while (block != nullptr)
+		{
+			Block* next = block->next;
+			if (block != mFirstBlock)
+			{
+				releaseBlock(block);
+				released += mBlockSize;
+			}
+			block = next;
+		}
+		return released;
+	}
+	//------------------------------------------------------------------------------------------
+	PoolAllocator::Block* PoolAllocator::createBlock()
+	{
+		if (mMaxBlocks != 0 && mNumBlocks >= mMaxBlocks)
+			return nullptr;
+		// The blocks are taken from the backing allocator, which are charged to the budget of
+		// the pool on top of the budget of the backing allocator
+		if (mBudget != nullptr && !mBudget->charge(mBlockSize))
+		{
+			mBudget->dispatch();
+			return nullptr;
+		}
+		uint8* mem = static_cast<uint8*>(mAllocator->allocate(mBlockSize, mBlockSize, 0, 0, 0, 0));
+		if (mem == nullptr)
+		{
+			if (mBudget != nullptr)
+				mBudget->release(mBlockSize);
+			return nullptr;
+		}
+		ASSERT_ERROR((reinterpret_cast<size_t>(mem) & (mBlockSize - 1)) == 0,
+			"Pool block is not aligned to its size");
+
+		Block* block = reinterpret_cast<Block*>(mem);
+		uint8* first = reinterpret_cast<uint8*>(((reinterpret_cast<size_t>(mem + sizeof(Block)) + mOffset +
+			(mAlignment - 1)) & ~(mAlignment - 1)) - mOffset);
+		block->free = nullptr;
+		block->unused = first;
+		block->used = 0;
+		linkBlock(block, kEmptyList);
+		mNumBlocks++;
+		if (mBudget != nullptr)
+			mBudget->dispatch();
+		return block;
+	}
+	//------------------------------------------------------------------------------------------
+	void PoolAllocator::releaseBlock(Block* block)
+	{
+		unlinkBlock(block);
+		mNumBlocks--;
+		mAllocator->deallocate(static_cast<void*>(block));
+		if (mBudget != nullptr)
+			mBudget->release(mBlockSize);
+	}
+	//------------------------------------------------------------------------------------------
+	uint32 PoolAllocator::getListIndex(uint32 used) const
+	{
+		if (used == 0)
+			return kEmptyList;
+		if (used == mCapacity)
+			return kFullList;
+		return static_cast<uint32>((used * kNumPartialLists) / mCapacity);
+	}
+	//------------------------------------------------------------------------------------------
+	void PoolAllocator::updateList(Block* block)
+	{
+		uint32 list = getListIndex(block->used);
+		if (list != block->list)
+		{
+			unlinkBlock(block);
+			linkBlock(block, list);
+		}
+	}
+	//------------------------------------------------------------------------------------------
+	void PoolAllocator::linkBlock(Block* block, uint32 list)
+	{
+		block->list = list;
+		block->prev = nullptr;
+		block->next = mLists[list];
+		if (block->next != nullptr)
+			block->next->prev = block;
+		mLists[list] = block;
+		if (list == kEmptyList)
+			mNumEmptyBlocks++;
+	}
+	//------------------------------------------------------------------------------------------
+	void PoolAllocator::unlinkBlock(Block* block)
+	{
+		if (block->prev != nullptr)
+			block->prev->next = block->next;
+		else
+			mLists[block->list] = block->next;
+		if (block->next != nullptr)
+			block->next->prev = block->prev;
+		if (block->list == kEmptyList)
+			mNumEmptyBlocks--;
+	}
 }
\ No newline at end of file
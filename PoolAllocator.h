@@ -3,16 +3,29 @@
 
 #include "DataTypes.h"
 #include "Allocator.h"
-#include "FreeList.h"
 #include "Assert.h"
 
 namespace Odin
 {
+	/*
+		Allocator for elements of one size, carved out of blocks obtained from a parent
+		allocator. Each block keeps its own free list and occupancy. Allocations are served from
+		the fullest blocks first so that the emptier ones drain and can be given back: once a
+		block is empty it is kept for reuse, or returned to the parent if more than
+		retained_blocks empty blocks are kept already. The first block is kept until the pool is
+		destroyed, so a pool which never grows past it behaves as a fixed size pool.
+		Blocks are aligned to their size, a power of two, so a free finds its block by masking
+		the address.
+	*/
 	class PoolAllocator : public Allocator
 	{
 	public:
-		PoolAllocator(Allocator* allocator, size_t element_size, 
-			size_t element_count,size_t alignment, size_t offset);
+		// Each block holds at least element_count elements. When every block is full, another
+		// block is obtained from allocator unless the pool has max_blocks blocks already
+		// (0 for no limit, 1 for a fixed size pool).
+		PoolAllocator(Allocator* allocator, size_t element_size,
+			size_t element_count, size_t alignment, size_t offset,
+			uint32 max_blocks = 1, uint32 retained_blocks = 1);
 		virtual ~PoolAllocator();
 
 		// Initialize
@@ -34,25 +47,78 @@ namespace Odin
 		// Return the total amount of memory allocated by this allocator
 		virtual size_t getTotalAllocated();
 
-		// Return the starting address of the pool memory area
+		// Return every empty block but the first one to the parent allocator. Returns the number
+		// of bytes released.
+		virtual size_t purge();
+
+		// Return the starting address of the elements of the first block
 		const uint8* getStartAddress() { return mStart; }
+
+		// Return the number of blocks, and how many of them are empty
+		uint32 getNumBlocks() const { return mNumBlocks; }
+		uint32 getNumEmptyBlocks() const { return mNumEmptyBlocks; }
+		// Return the number of elements of a block
+		size_t getBlockCapacity() const { return mCapacity; }
 	private:
-		// The total size of memory space
-		size_t mSize;
+		// Blocks with some elements in use are sorted into kNumPartialLists lists by occupancy
+		// (quarters of the capacity), full and empty blocks have a list of their own
+		static const uint32 kNumPartialLists = 4;
+		static const uint32 kFullList = kNumPartialLists;
+		static const uint32 kEmptyList = kNumPartialLists + 1;
+		static const uint32 kNumLists = kNumPartialLists + 2;
+
+		// Header at the start of every block
+		struct Block
+		{
+			Block* prev;			// Blocks of the same occupancy list
+			Block* next;
+			uint8* free;			// Elements returned to the block
+			uint8* unused;			// First element which was never handed out
+			uint32 used;			// Number of elements in use
+			uint32 list;			// Occupancy list of the block
+		};
+
+		// Get a block from the parent allocator
+		Block* createBlock();
+		// Give a block back to the parent allocator
+		void releaseBlock(Block* block);
+		// Get the block holding an element
+		Block* getBlock(void* ptr) const
+		{
+			return reinterpret_cast<Block*>(reinterpret_cast<size_t>(ptr) & ~(mBlockSize - 1));
+		}
+		// Get the occupancy list of a block with used elements in use
+		uint32 getListIndex(uint32 used) const;
+		// Move a block to the list matching its occupancy
+		void updateList(Block* block);
+		void linkBlock(Block* block, uint32 list);
+		void unlinkBlock(Block* block);
+
+		// Size of an element including the guard bytes, and of a block
+		size_t mElementSize;
+		size_t mBlockSize;
+		// Number of elements of a block
+		size_t mCapacity;
 		// Size of a chunk
 		size_t mChunkSize;
 		// Alignment
 		size_t mAlignment;
-		// Number of elements
+		// Number of elements allocated
 		size_t mCount;
 		// Offset
 		size_t mOffset;
-		// A Free list allocator
-		FreeList *mFreeList;
 		// The allocator to be used
 		Allocator* mAllocator;
-		// The starting address of Memory Space
+		// The starting address of the elements of the first block
 		uint8* mStart;
+		// Block lists by occupancy
+		Block* mLists[kNumLists];
+		// First block, kept for the lifetime of the pool
+		Block* mFirstBlock;
+		uint32 mNumBlocks;
+		uint32 mNumEmptyBlocks;
+		uint32 mMaxBlocks;
+		uint32 mRetainedBlocks;
 	};
 }
 
@@ -0,0 +1,126 @@
+#include "SizeClass.h"
+
+namespace Odin
+{
+	//--------------------------------------------------------------------------------------------------------------
+	const SizeClassTable& getDefaultSizeClassTable()
+	{
+		static const SizeClassTable table =
+		{
+			20,
+			{
+				8, 16, 24, 32, 40, 48, 56, 64,
+				80, 96, 112, 128, 144, 160, 176, 192, 208, 224, 240, 256
+			}
+		};
+		return table;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	bool isValidSizeClassTable(const SizeClassTable& table)
+	{
+		if (table.num_classes == 0 || table.num_classes > kMaxSizeClasses)
+			return false;
+		uint32 prev_size = 0;
+		for (uint32 i = 0; i < table.num_classes; ++i)
+		{
+			uint32 size = table.sizes[i];
+			if (size <= prev_size || (size & 7) != 0 || size > kMaxSmallClassSize)
+				return false;
+			prev_size = size;
+		}
+		return true;
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void resetSizeHistogram(SizeHistogram* histogram)
+	{
+		for (uint32 i = 0; i < kNumSizeBuckets; ++i)
+			histogram->counts[i].store(0, std::memory_order_relaxed);
+		histogram->large_count.store(0, std::memory_order_relaxed);
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void recordSize(SizeHistogram* histogram, size_t size)
+	{
+		if (size <= kMaxSmallClassSize)
+			histogram->counts[(size + 7) >> 3].fetch_add(1, std::memory_order_relaxed);
+		else
+			histogram->large_count.fetch_add(1, std::memory_order_relaxed);
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	bool buildSizeClassTable(const SizeHistogram& histogram, uint32 max_classes, SizeClassTable& table)
+	{
+		// Gather the buckets with requests. Empty requests get the smallest object size.
+		uint64 sizes[kNumSizeBuckets];
+		uint64 counts[kNumSizeBuckets];
+		uint32 num_sizes = 0;
+		for (uint32 i = 1; i < kNumSizeBuckets; ++i)
+		{
+			uint64 count = histogram.counts[i].load(std::memory_order_relaxed);
+			if (i == 1)
+				count += histogram.counts[0].load(std::memory_order_relaxed);
+			if (count != 0)
+			{
+				sizes[num_sizes] = static_cast<uint64>(i) << 3;
+				counts[num_sizes] = count;
+				++num_sizes;
+			}
+		}
+		if (num_sizes == 0 || max_classes == 0)
+			return false;
+
+		uint32 num_classes = max_classes;
+		if (num_classes > kMaxSizeClasses)
+			num_classes = kMaxSizeClasses;
+		if (num_classes > num_sizes)
+			num_classes = num_sizes;
+
+		// Prefix sums of the counts and of the requested bytes, so that the bytes wasted by one
+		// class covering the sizes first to last is a constant time lookup
+		uint64 count_sum[kNumSizeBuckets + 1];
+		uint64 bytes_sum[kNumSizeBuckets + 1];
+		count_sum[0] = bytes_sum[0] = 0;
+		for (uint32 i = 0; i < num_sizes; ++i)
+		{
+			count_sum[i + 1] = count_sum[i] + counts[i];
+			bytes_sum[i + 1] = bytes_sum[i] + (counts[i] * sizes[i]);
+		}
+
+		// waste[n][last] is the fewest bytes wasted when n classes cover the sizes up to last,
+		// the largest class being sizes[last]. first[n][last] is the first size that class covers.
+		uint64 waste[kMaxSizeClasses + 1][kNumSizeBuckets];
+		uint32 first[kMaxSizeClasses + 1][kNumSizeBuckets];
+		for (uint32 last = 0; last < num_sizes; ++last)
+		{
+			waste[1][last] = (sizes[last] * count_sum[last + 1]) - bytes_sum[last + 1];
+			first[1][last] = 0;
+		}
+		for (uint32 n = 2; n <= num_classes; ++n)
+		{
+			for (uint32 last = n - 1; last < num_sizes; ++last)
+			{
+				waste[n][last] = ~static_cast<uint64>(0);
+				for (uint32 i = n - 1; i <= last; ++i)
+				{
+					uint64 class_waste = (sizes[last] * (count_sum[last + 1] - count_sum[i])) -
+						(bytes_sum[last + 1] - bytes_sum[i]);
+					uint64 total = waste[n - 1][i - 1] + class_waste;
+					if (total < waste[n][last])
+					{
+						waste[n][last] = total;
+						first[n][last] = i;
+					}
+				}
+			}
+		}
+
+		// The largest recorded size always gets a class, walk back from it
+		table.num_classes = num_classes;
+		uint32 last = num_sizes - 1;
+		for (uint32 n = num_classes; n > 0; --n)
+		{
+			table.sizes[n - 1] = static_cast<uint32>(sizes[last]);
+			if (n > 1)
+				last = first[n][last] - 1;
+		}
+		return true;
+	}
+}
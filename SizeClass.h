@@ -0,0 +1,48 @@
+#ifndef _SIZE_CLASS_H_
+#define _SIZE_CLASS_H_
+
+#include "DataTypes.h"
+#include <atomic>
+
+namespace Odin
+{
+	// Upper bound of the number of small size classes of a GeneralAllocator
+	const uint32 kMaxSizeClasses = 20;
+	// Largest object size of a small size class. Larger requests go to the dlmalloc instance.
+	const uint32 kMaxSmallClassSize = 1024;
+	// Number of 8 byte buckets of a size histogram, bucket i counts the sizes in (8 * (i - 1), 8 * i]
+	const uint32 kNumSizeBuckets = (kMaxSmallClassSize >> 3) + 1;
+
+	// Object sizes of the small size classes, in increasing order. Every size is a multiple of 8
+	// no larger than kMaxSmallClassSize. A request is served by the first class at least as large.
+	struct SizeClassTable
+	{
+		uint32 num_classes;
+		uint32 sizes[kMaxSizeClasses];
+	};
+
+	// Number of allocation requests of every size, recorded while an application runs
+	struct SizeHistogram
+	{
+		std::atomic<uint64> counts[kNumSizeBuckets];	// Requests up to kMaxSmallClassSize by 8 byte bucket
+		std::atomic<uint64> large_count;				// Requests larger than kMaxSmallClassSize
+	};
+
+	// The table used when none is given: 8 byte steps up to 64 bytes and 16 byte steps up to 256 bytes
+	const SizeClassTable& getDefaultSizeClassTable();
+
+	// Return true if the table has between 1 and kMaxSizeClasses valid sizes in increasing order
+	bool isValidSizeClassTable(const SizeClassTable& table);
+
+	// Clear all the counts of a histogram
+	void resetSizeHistogram(SizeHistogram* histogram);
+
+	// Count a request of size bytes
+	void recordSize(SizeHistogram* histogram, size_t size);
+
+	// Derive the table of at most max_classes classes which wastes the fewest bytes to rounding
+	// for the requests counted by a histogram. Every recorded size up to kMaxSmallClassSize gets
+	// a class. Returns false if the histogram has no such request.
+	bool buildSizeClassTable(const SizeHistogram& histogram, uint32 max_classes, SizeClassTable& table);
+}
+#endif	// _SIZE_CLASS_H_
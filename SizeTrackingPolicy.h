@@ -0,0 +1,39 @@
+#ifndef _SIZE_TRACKING_POLICY_H_
+#define _SIZE_TRACKING_POLICY_H_
+
+#include "DataTypes.h"
+#include <cstring>
+
+namespace Odin
+{
+	// Stores the size of every allocation in a header right in front of it, so that
+	// getAllocSize and reallocate work. The header is unaligned when an offset is requested.
+	class SizeHeaderTracking
+	{
+	public:
+		static const size_t kHeaderSize = sizeof(size_t);
+
+		static inline void store(void* ptr, size_t size)
+		{
+			memcpy(static_cast<uint8*>(ptr) - sizeof(size_t), &size, sizeof(size_t));
+		}
+		static inline size_t load(const void* ptr)
+		{
+			size_t size;
+			memcpy(&size, static_cast<const uint8*>(ptr) - sizeof(size_t), sizeof(size_t));
+			return size;
+		}
+	};
+
+	// Stores nothing per allocation, the size of an allocation is unknown
+	class NoSizeTracking
+	{
+	public:
+		static const size_t kHeaderSize = 0;
+
+		static inline void store(void* ptr, size_t size) {}
+		static inline size_t load(const void* ptr) { return 0; }
+	};
+}
+
+#endif	// _SIZE_TRACKING_POLICY_H_
@@ -0,0 +1,371 @@
+#include "SlabAlloc.h"
+#include "SysAlloc.h"
+#include "PageMap.h"
+#include "Assert.h"
+
+#if ODIN_COMPILER == ODIN_COMPILER_MSVC
+#include <intrin.h>
+#endif
+
+namespace Odin
+{
+	// Bitmap sizes for a run of the smallest objects
+	const uint32 kMaxRunObjects = static_cast<uint32>(kSlabRunSize / kMinSlabObjectSize);
+	const uint32 kBitmapWords = kMaxRunObjects / 32;
+	const uint32 kSummaryWords = kBitmapWords / 32;
+
+	// Header at the start of every run
+	struct SlabRun
+	{
+		SlabSpace* space;							// Owning SlabSpace
+		SlabRun* prev_partial;						// Links in the list of runs with free objects
+		SlabRun* next_partial;
+		SlabRun* prev_run;							// Links in the list of all runs
+		SlabRun* next_run;
+		uint8* objects;								// Address of the first object
+		uint32 object_size;
+		uint32 object_size_inverse;					// 2^32 / object_size rounded up, turns the division into a multiply
+		uint32 num_objects;
+		uint32 free_count;
+		uint32 summary[kSummaryWords];				// Bit set if the bitmap word has a free object
+		uint32 bitmap[kBitmapWords];				// Bit set if the object is free
+	};
+
+	// Objects start at the first 16 byte boundary past the header
+	const size_t kRunHeaderSize = (sizeof(SlabRun) + 15) & ~static_cast<size_t>(15);
+
+	//--------------------------------------------------------------------------------------------------------------
+	// Index of the least significant set bit
+	static FORCEINLINE uint32 findFirstBit(uint32 mask)
+	{
+#if ODIN_COMPILER == ODIN_COMPILER_MSVC
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return static_cast<uint32>(index);
+#elif ODIN_COMPILER == ODIN_COMPILER_GCC
+		return static_cast<uint32>(__builtin_ctz(mask));
+#endif
+	}
+
+	// Get the run containing an object
+	static FORCEINLINE SlabRun* getRun(void* mem)
+	{
+		return reinterpret_cast<SlabRun*>(reinterpret_cast<size_t>(mem) & ~(kSlabRunSize - 1));
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	// Linking and unlinking runs
+
+	static void linkPartial(SlabSpace* ssp, SlabRun* run)
+	{
+		run->prev_partial = nullptr;
+		run->next_partial = ssp->partial_runs;
+		if (ssp->partial_runs)
+			ssp->partial_runs->prev_partial = run;
+		ssp->partial_runs = run;
+	}
+
+	static void unlinkPartial(SlabSpace* ssp, SlabRun* run)
+	{
+		if (run->prev_partial)
+			run->prev_partial->next_partial = run->next_partial;
+		else
+			ssp->partial_runs = run->next_partial;
+		if (run->next_partial)
+			run->next_partial->prev_partial = run->prev_partial;
+		run->prev_partial = run->next_partial = nullptr;
+	}
+
+	// Reserve, commit and initialize a new run with every object free
+	static SlabRun* createRun(SlabSpace* ssp)
+	{
+		if (ssp->budget != nullptr && !ssp->budget->charge(kSlabRunSize))
+			return nullptr;
+		SlabRun* run = static_cast<SlabRun*>(SysAlloc::reserveAlignedSegment(kSlabRunSize, kSlabRunSize));
+		if (run == nullptr || !SysAlloc::commitPage(run, kSlabRunSize) || !PageMap::setOwner(run, kSlabRunSize, PageMap::kSlabRun))
+		{
+			if (run != nullptr)
+				SysAlloc::releaseAlignedSegment(run, kSlabRunSize);
+			if (ssp->budget != nullptr)
+				ssp->budget->release(kSlabRunSize);
+			return nullptr;
+		}
+
+		run->space = ssp;
+		run->prev_partial = run->next_partial = nullptr;
+		run->objects = reinterpret_cast<uint8*>(run) + kRunHeaderSize;
+		run->object_size = ssp->object_size;
+		run->object_size_inverse = static_cast<uint32>(((static_cast<uint64>(1) << 32) + ssp->object_size - 1) / ssp->object_size);
+		run->num_objects = static_cast<uint32>((kSlabRunSize - kRunHeaderSize) / ssp->object_size);
+		run->free_count = run->num_objects;
+		// Mark every object free
+		uint32 full_words = run->num_objects >> 5;
+		for (uint32 i = 0; i < kBitmapWords; ++i)
+		{
+			if (i < full_words)
+				run->bitmap[i] = ~0U;
+			else if (i == full_words && (run->num_objects & 31) != 0)
+				run->bitmap[i] = (1U << (run->num_objects & 31)) - 1;
+			else
+				run->bitmap[i] = 0;
+		}
+		for (uint32 i = 0; i < kSummaryWords; ++i)
+		{
+			run->summary[i] = 0;
+			for (uint32 j = 0; j < 32; ++j)
+			{
+				if (run->bitmap[(i << 5) + j] != 0)
+					run->summary[i] |= (1U << j);
+			}
+		}
+
+		run->prev_run = nullptr;
+		run->next_run = ssp->all_runs;
+		if (ssp->all_runs)
+			ssp->all_runs->prev_run = run;
+		ssp->all_runs = run;
+		ssp->footprint += kSlabRunSize;
+		if (ssp->footprint > ssp->max_footprint)
+			ssp->max_footprint = ssp->footprint;
+		return run;
+	}
+
+	// Unlink a run from the list of all runs and give it back to the system
+	static void releaseRun(SlabSpace* ssp, SlabRun* run)
+	{
+		if (run->prev_run)
+			run->prev_run->next_run = run->next_run;
+		else
+			ssp->all_runs = run->next_run;
+		if (run->next_run)
+			run->next_run->prev_run = run->prev_run;
+		ssp->footprint -= kSlabRunSize;
+		PageMap::clearOwner(run, kSlabRunSize);
+		SysAlloc::releaseAlignedSegment(run, kSlabRunSize);
+		if (ssp->budget != nullptr)
+			ssp->budget->release(kSlabRunSize);
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	// Allocate an object. Lock should be held by the caller.
+	static void* allocObject(SlabSpace* ssp)
+	{
+		SlabRun* run = ssp->partial_runs;
+		if (run == nullptr)
+		{
+			if (ssp->empty_run != nullptr)
+			{
+				run = ssp->empty_run;
+				ssp->empty_run = nullptr;
+				ssp->empty_run_age = 0;
+			}
+			else if ((run = createRun(ssp)) == nullptr)
+				return nullptr;
+			linkPartial(ssp, run);
+		}
+
+		// Find the first bitmap word with a free object through the summary, then the object
+		for (uint32 i = 0; i < kSummaryWords; ++i)
+		{
+			if (run->summary[i] != 0)
+			{
+				uint32 word = (i << 5) + findFirstBit(run->summary[i]);
+				uint32 bit = findFirstBit(run->bitmap[word]);
+				run->bitmap[word] &= ~(1U << bit);
+				if (run->bitmap[word] == 0)
+					run->summary[i] &= ~(1U << (word & 31));
+				if (--run->free_count == 0)
+					unlinkPartial(ssp, run);
+				ssp->in_use += ssp->object_size;
+				return run->objects + (((word << 5) + bit) * run->object_size);
+			}
+		}
+		ASSERT_ERROR(false, "Run in the partial list has no free object");
+		return nullptr;
+	}
+
+	// Free an object of a run of ssp. Lock should be held by the caller.
+	static void freeObject(SlabSpace* ssp, SlabRun* run, void* mem)
+	{
+		uint32 offset = static_cast<uint32>(reinterpret_cast<uint8*>(mem) - run->objects);
+		uint32 index = static_cast<uint32>((static_cast<uint64>(offset) * run->object_size_inverse) >> 32);
+		if (index * run->object_size != offset || index >= run->num_objects)
+		{
+			ASSERT_ERROR(false, "Address is not the start of an object");
+			return;
+		}
+		uint32 word = index >> 5;
+		uint32 bit = index & 31;
+		if ((run->bitmap[word] & (1U << bit)) != 0)
+		{
+			ASSERT_ERROR(false, "Object is freed twice or was never allocated");
+			return;
+		}
+
+		// A full run gets its first free object
+		if (run->free_count == 0)
+			linkPartial(ssp, run);
+		run->bitmap[word] |= (1U << bit);
+		run->summary[word >> 5] |= (1U << (word & 31));
+		ssp->in_use -= ssp->object_size;
+		if (++run->free_count == run->num_objects)
+		{
+			// Keep one empty run around, give the others back to the system
+			unlinkPartial(ssp, run);
+			if (ssp->empty_run == nullptr)
+				ssp->empty_run = run;
+			else
+				releaseRun(ssp, run);
+		}
+	}
+	// Free the objects queued by slabFreeRemote. Lock should be held by the caller.
+	static void freeRemoteObjects(SlabSpace* ssp)
+	{
+		if (ssp->remote_frees.load(std::memory_order_relaxed) == nullptr)
+			return;
+		// Take the whole list at once, pushes made from now on go to a new list
+		void* mem = ssp->remote_frees.exchange(nullptr, std::memory_order_acquire);
+		while (mem != nullptr)
+		{
+			void* next = *reinterpret_cast<void**>(mem);
+			freeObject(ssp, getRun(mem), mem);
+			mem = next;
+		}
+	}
+	//--------------------------------------------------------------------------------------------------------------
+	void initSlabSpace(SlabSpace* ssp, uint32 object_size)
+	{
+		ASSERT_ERROR(object_size >= kMinSlabObjectSize && (object_size & 7) == 0,
+			"Slab object size should be a multiple of 8");
+		ssp->object_size = object_size;
+		ssp->tag = 0;
+		ssp->partial_runs = nullptr;
+		ssp->all_runs = nullptr;
+		ssp->empty_run = nullptr;
+		ssp->empty_run_age = 0;
+		ssp->footprint = ssp->max_footprint = 0;
+		ssp->in_use = 0;
+		ssp->budget = nullptr;
+		ssp->remote_frees.store(nullptr, std::memory_order_relaxed);
+	}
+
+	size_t destroySlabSpace(SlabSpace* ssp)
+	{
+		std::lock_guard<AdaptiveLock> guard(ssp->slab_lock);
+		size_t released = ssp->footprint;
+		while (ssp->all_runs)
+			releaseRun(ssp, ssp->all_runs);
+		ssp->partial_runs = nullptr;
+		ssp->empty_run = nullptr;
+		ssp->empty_run_age = 0;
+		ssp->in_use = 0;
+		ssp->remote_frees.store(nullptr, std::memory_order_relaxed);
+		return released;
+	}
+
+	void* slabAlloc(SlabSpace* ssp)
+	{
+		// Acquire lock
+		std::lock_guard<AdaptiveLock> guard(ssp->slab_lock);
+		freeRemoteObjects(ssp);
+		return allocObject(ssp);
+	}
+
+	size_t slabAllocBatch(SlabSpace* ssp, size_t count, void** out)
+	{
+		// Acquire lock once for the whole batch
+		std::lock_guard<AdaptiveLock> guard(ssp->slab_lock);
+		freeRemoteObjects(ssp);
+		size_t done = 0;
+		while (done < count && (out[done] = allocObject(ssp)) != nullptr)
+			++done;
+		return done;
+	}
+
+	void slabFree(void* mem)
+	{
+		if (mem == 0)
+			return;
+		SlabRun* run = getRun(mem);
+		SlabSpace* ssp = run->space;
+
+		// Acquire lock
+		std::lock_guard<AdaptiveLock> guard(ssp->slab_lock);
+		freeObject(ssp, run, mem);
+	}
+
+	void slabFreeBatch(SlabSpace* ssp, void** mem, size_t count)
+	{
+		// Acquire lock once for the whole batch
+		std::lock_guard<AdaptiveLock> guard(ssp->slab_lock);
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (mem[i] == 0)
+				continue;
+			SlabRun* run = getRun(mem[i]);
+			ASSERT_ERROR(run->space == ssp, "Object belongs to a different SlabSpace");
+			freeObject(ssp, run, mem[i]);
+		}
+	}
+
+	void slabFreeRemote(SlabSpace* ssp, void** mem, size_t count)
+	{
+		// Link the objects into a chain, then push the whole chain at once
+		void* first = nullptr;
+		void* last = nullptr;
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (mem[i] == 0)
+				continue;
+			ASSERT_ERROR(getRun(mem[i])->space == ssp, "Object belongs to a different SlabSpace");
+			if (last != nullptr)
+				*reinterpret_cast<void**>(last) = mem[i];
+			else
+				first = mem[i];
+			last = mem[i];
+		}
+		if (first == nullptr)
+			return;
+
+		void* head = ssp->remote_frees.load(std::memory_order_relaxed);
+		do
+		{
+			*reinterpret_cast<void**>(last) = head;
+		} while (!ssp->remote_frees.compare_exchange_weak(head, first,
+			std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	size_t slabTrim(SlabSpace* ssp)
+	{
+		std::lock_guard<AdaptiveLock> guard(ssp->slab_lock);
+		freeRemoteObjects(ssp);
+		if (ssp->empty_run == nullptr)
+			return 0;
+		releaseRun(ssp, ssp->empty_run);
+		ssp->empty_run = nullptr;
+		ssp->empty_run_age = 0;
+		return kSlabRunSize;
+	}
+
+	size_t slabDecay(SlabSpace* ssp, uint32 steps)
+	{
+		std::lock_guard<AdaptiveLock> guard(ssp->slab_lock);
+		freeRemoteObjects(ssp);
+		if (ssp->empty_run == nullptr || ++ssp->empty_run_age < steps)
+			return 0;
+		releaseRun(ssp, ssp->empty_run);
+		ssp->empty_run = nullptr;
+		ssp->empty_run_age = 0;
+		return kSlabRunSize;
+	}
+
+	size_t getSlabInuseBytes(SlabSpace* ssp)
+	{
+		std::lock_guard<AdaptiveLock> guard(ssp->slab_lock);
+		freeRemoteObjects(ssp);
+		return ssp->in_use;
+	}
+
+	SlabSpace* getSlabSpace(void* mem)
+	{
+		return getRun(mem)->space;
+	}
+}
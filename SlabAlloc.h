@@ -0,0 +1,82 @@
+#include "DataTypes.h"
+#include "CompileOptions.h"
+#include "AdaptiveLock.h"
+#include "MemoryBudget.h"
+#include <atomic>
+#include <mutex>
+
+#ifndef _SLAB_ALLOC_H_
+#define _SLAB_ALLOC_H_
+
+namespace Odin
+{
+	// Size and alignment of a run. Every run holds objects of a single size.
+	const size_t kSlabRunSize = 65536;
+	// Smallest object size, which bounds the number of objects in a run
+	const uint32 kMinSlabObjectSize = 8;
+
+	// Forward declaration
+	struct SlabRun;
+
+	/*
+		Allocator for objects of one fixed size. Objects are carved out of 64KB runs and a free
+		bitmap in the run header tracks them, so objects carry no header of their own.
+		Allocation and free are a couple of bit scans. Runs are kSlabRunSize aligned and
+		registered in the page map as PageMap::kSlabRun, so the run of any object is found by
+		masking its address.
+	*/
+	struct SlabSpace
+	{
+		uint32 object_size;							// Size of every object
+		uint32 tag;									// Set by the owner of this SlabSpace (size class in GeneralAllocator)
+		SlabRun* partial_runs;						// Runs with at least one free object
+		SlabRun* all_runs;							// Every run of this space
+		SlabRun* empty_run;							// A completely free run kept to avoid thrashing
+		uint32 empty_run_age;						// Number of slabDecay calls empty_run has been kept for
+		size_t footprint;							// Bytes reserved by the runs
+		size_t max_footprint;
+		size_t in_use;								// Bytes held by allocated objects, including the queued ones
+		MemoryBudget* budget;						// Charged for the runs, if set before the first allocation
+		std::atomic<void*> remote_frees;			// Objects queued by slabFreeRemote, linked through their first word
+
+		AdaptiveLock slab_lock;						// Mutex
+	};
+
+	// Initialize a SlabSpace for objects of object_size bytes (a multiple of 8)
+	void initSlabSpace(SlabSpace* ssp, uint32 object_size);
+
+	// Return all the runs of a SlabSpace to the system, returning the number of bytes freed
+	size_t destroySlabSpace(SlabSpace* ssp);
+
+	// Allocate an object. Returns NULL if the system is out of memory.
+	void* slabAlloc(SlabSpace* ssp);
+
+	// Allocate count objects into out, taking the lock once. Returns the number of objects
+	// allocated, which is less than count only if the system ran out of memory.
+	size_t slabAllocBatch(SlabSpace* ssp, size_t count, void** out);
+
+	// Free an object of any SlabSpace
+	void slabFree(void* mem);
+
+	// Free count objects of ssp, taking the lock once. NULL entries are skipped.
+	void slabFreeBatch(SlabSpace* ssp, void** mem, size_t count);
+
+	// Queue count objects of ssp to be freed without taking the lock. They are pushed with a
+	// single CAS and freed by the next slabAlloc, slabAllocBatch or getSlabInuseBytes call on
+	// ssp. NULL entries are skipped.
+	void slabFreeRemote(SlabSpace* ssp, void** mem, size_t count);
+
+	// Give the empty run kept by ssp back to the system. Returns the number of bytes released.
+	size_t slabTrim(SlabSpace* ssp);
+
+	// Count one decay step for the empty run kept by ssp and give it back to the system once
+	// it went unused for steps steps. Returns the number of bytes released.
+	size_t slabDecay(SlabSpace* ssp, uint32 steps);
+
+	// Return the number of bytes held by allocated objects, after freeing the queued ones
+	size_t getSlabInuseBytes(SlabSpace* ssp);
+
+	// Get the SlabSpace owning an object
+	SlabSpace* getSlabSpace(void* mem);
+}
+#endif
@@ -0,0 +1,80 @@
+#include "StackAllocator.h"
+
+namespace Odin
+{
+	StackAllocator::StackAllocator(size_t size, bool huge_pages) : LinearAllocator(size, huge_pages)
+	{
+	}
+	//------------------------------------------------------------------------------------------
+	StackAllocator::StackAllocator(void* start, size_t size) : LinearAllocator(start, size)
+	{
+	}
+	//------------------------------------------------------------------------------------------
+	StackAllocator::~StackAllocator()
+	{
+		ASSERT_ERROR(getTotalAllocated() == 0, "Stack allocator has memory leaks");
+	}
+	//------------------------------------------------------------------------------------------
+	void* StackAllocator::callocate(size_t num_elements, size_t elem_size,
+		const char* file_name, uint32 line, const char* func_name)
+	{
+		size_t size = num_elements * elem_size;
+		if (elem_size != 0 && size / elem_size != num_elements)
+			return nullptr;
+		void* mem = allocate(size, kDefaultAlignment, 0, file_name, line, func_name);
+		// Rolled back memory holds the data of the allocations made there before
+		if (mem != nullptr)
+			memset(mem, 0, size);
+		return mem;
+	}
+	//------------------------------------------------------------------------------------------
+	void* StackAllocator::allocateTop(size_t size, size_t alignment)
+	{
+		// Make sure the alignment is a power of 2
+		ASSERT_ERROR(((alignment & (alignment - 1)) == 0), "Alignment is not a power of 2");
+		if (alignment < kDefaultAlignment)
+			alignment = kDefaultAlignment;
+		// The top end grows down, the size is stored right below the aligned allocation
+		size_t free_size = mEnd - mCurrent;
+		if (size > free_size)
+			return nullptr;
+		size_t user_ptr = (reinterpret_cast<size_t>(mEnd) - size) & ~(alignment - 1);
+		if (user_ptr < reinterpret_cast<size_t>(mCurrent) + sizeof(size_t))
+			return nullptr;
+		mEnd = reinterpret_cast<uint8*>(user_ptr - sizeof(size_t));
+
+		// Store the size
+		*(reinterpret_cast<size_t*>(mEnd)) = size;
+		return reinterpret_cast<void*>(user_ptr);
+	}
+	//------------------------------------------------------------------------------------------
+	size_t StackAllocator::getTotalAllocated()
+	{
+		return (mCurrent - mStart) + ((mStart + mSize) - mEnd);
+	}
+	//------------------------------------------------------------------------------------------
+	void StackAllocator::reset(void)
+	{
+		mCurrent = mStart;
+		mEnd = mStart + mSize;
+	}
+	//------------------------------------------------------------------------------------------
+	StackAllocator::Marker StackAllocator::getMarker(StackEnd end) const
+	{
+		return (end == STACK_BOTTOM) ? (mCurrent - mStart) : (mEnd - mStart);
+	}
+	//------------------------------------------------------------------------------------------
+	void StackAllocator::freeToMarker(Marker marker, StackEnd end)
+	{
+		if (end == STACK_BOTTOM)
+		{
+			ASSERT_ERROR(mStart + marker <= mCurrent, "Marker is above the bottom of the stack");
+			mCurrent = mStart + marker;
+		}
+		else
+		{
+			ASSERT_ERROR(mStart + marker >= mEnd && marker <= mSize, "Marker is below the top of the stack");
+			mEnd = mStart + marker;
+		}
+	}
+}
\ No newline at end of file
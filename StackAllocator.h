@@ -0,0 +1,80 @@
+#ifndef _STACK_ALLOCATOR_H_
+#define _STACK_ALLOCATOR_H_
+
+#include "DataTypes.h"
+#include "Assert.h"
+#include "LinearAllocator.h"
+
+namespace Odin
+{
+	// End of a stack allocator
+	enum StackEnd
+	{
+		STACK_BOTTOM = 0,		// Grows up from the start of the memory space, used by allocate
+		STACK_TOP = 1			// Grows down from the end of the memory space
+	};
+
+	/*
+		Linear allocator whose allocations can be rolled back in LIFO order. getMarker records
+		the position of one end of the stack and freeToMarker frees everything allocated from
+		that end since, a Scope doing the same when it goes out of scope. The bottom end is the
+		bump path of the linear allocator. allocateTop allocates from the other end of the same
+		memory space, so long-lived data can grow from the bottom and temporaries from the top
+		(or the other way round) until the two ends meet.
+		The memory space is committed up front, as for a fixed size linear allocator.
+	*/
+	class StackAllocator : public LinearAllocator
+	{
+	public:
+		// Position of one end of the stack
+		typedef size_t Marker;
+
+		// Roll one end of the stack back to where it was when the scope was created
+		class Scope
+		{
+		public:
+			explicit Scope(StackAllocator& allocator, StackEnd end = STACK_BOTTOM) :
+				mAllocator(allocator), mEnd(end), mMarker(allocator.getMarker(end)) {}
+			~Scope() { mAllocator.freeToMarker(mMarker, mEnd); }
+		private:
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+
+			StackAllocator& mAllocator;
+			StackEnd mEnd;
+			Marker mMarker;
+		};
+
+		// Allocate virtual memory for the given size. If huge_pages is true, the memory
+		// is backed by huge pages when the system has them available.
+		explicit StackAllocator(size_t size, bool huge_pages = false);
+
+		// Use the allocated Memory Space passed to perform all allocations
+		StackAllocator(void* start, size_t size);
+		virtual ~StackAllocator();
+
+		// Allocate a continuous array of fixed sized elements from the bottom, cleared to zero
+		virtual void* callocate(size_t num_elements, size_t elem_size,
+			const char* file_name = 0, uint32 line = 0, const char* func_name = 0);
+
+		// Allocate memory from the top end of the stack
+		void* allocateTop(size_t size, size_t alignment = kDefaultAlignment);
+
+		// Return the total amount of memory allocated from both ends
+		virtual size_t getTotalAllocated();
+
+		// Free the allocations of both ends
+		virtual void reset(void);
+
+		// Return the current position of one end of the stack
+		Marker getMarker(StackEnd end = STACK_BOTTOM) const;
+
+		// Free everything allocated from one end of the stack since marker was taken from it
+		void freeToMarker(Marker marker, StackEnd end = STACK_BOTTOM);
+
+		// Return the number of bytes left between the two ends
+		size_t getFreeSize() const { return mEnd - mCurrent; }
+	};
+}
+
+#endif	// _STACK_ALLOCATOR_H_
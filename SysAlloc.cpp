@@ -1,11 +1,125 @@
 #include "SysAlloc.h"
+#include "DataTypes.h"
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+#if ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <errno.h>
+#include <cstdlib>
+#include <cstring>
+#endif
 
 namespace Odin
 {
 	namespace SysAlloc
 	{
+		// The mode used by decommitPage
+		static std::atomic<int> sDecommitMode(DECOMMIT_MODE_DONTNEED);
+		// Bytes in segments mapped on huge pages (MAP_HUGETLB or MEM_LARGE_PAGES)
+		static std::atomic<size_t> sHugePageBytes(0);
+		//----------------------------------------------------------------------------------------------------------------------
+		// Segment cache
+		// Released segments are binned by the power of two of their size, starting at 64KB.
+		// A segment is only reused for a request of exactly the same size, since it has to be
+		// released with its original size later. Segments are decommitted before they are
+		// cached, so the cache only holds address space.
+		const uint32 kSegmentCacheMinShift = 16;
+		const uint32 kNumSegmentCacheBins = 12;		// Sizes from 64KB up to (but excluding) 256MB
+		const uint32 kSegmentCacheBinEntries = 8;
+
+		struct CachedSegment
+		{
+			void* ptr;
+			size_t size;
+			uint64 release_time;	// Milliseconds
+		};
+
+		struct SegmentCache
+		{
+			SegmentCache() : capacity(67108864), decay_ms(10000), cached_bytes(0)
+			{
+				for (uint32 i = 0; i < kNumSegmentCacheBins; ++i)
+					count[i] = 0;
+			}
+
+			std::mutex mutex;
+			size_t capacity;
+			uint32 decay_ms;
+			std::atomic<size_t> cached_bytes;
+			uint32 count[kNumSegmentCacheBins];
+			CachedSegment bins[kNumSegmentCacheBins][kSegmentCacheBinEntries];
+		};
+
+		static SegmentCache sSegmentCache;
+
+		// Current time in milliseconds
+		static uint64 getTimeMs()
+		{
+			return static_cast<uint64>(std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count());
+		}
+
+		// Return the bin of the segment cache for the given size or kNumSegmentCacheBins
+		// if the size is not cached
+		static uint32 getSegmentCacheBin(size_t size)
+		{
+			if (size < (static_cast<size_t>(1) << kSegmentCacheMinShift))
+				return kNumSegmentCacheBins;
+			uint32 bin = 0;
+			size >>= kSegmentCacheMinShift + 1;
+			while (size != 0 && bin < kNumSegmentCacheBins)
+			{
+				size >>= 1;
+				++bin;
+			}
+			return bin;
+		}
+
+		// Remove an entry from a bin. The entries after it move down, so that a bin stays ordered
+		// from the oldest to the most recently released segment. The mutex has to be held.
+		static void removeCachedSegment(uint32 bin, uint32 index)
+		{
+			SegmentCache& cache = sSegmentCache;
+			cache.cached_bytes.fetch_sub(cache.bins[bin][index].size, std::memory_order_relaxed);
+			--cache.count[bin];
+			for (uint32 i = index; i < cache.count[bin]; ++i)
+				cache.bins[bin][i] = cache.bins[bin][i + 1];
+		}
+
+		// Hand the segment back to the system
+		static void releaseSegmentToSystem(void* ptr, size_t size);
+		//----------------------------------------------------------------------------------------------------------------------
+		// Reserve a segment
 		void* reserveSegment(size_t size, void* ptr)
 		{
+			if (ptr == NULL && sSegmentCache.cached_bytes.load(std::memory_order_relaxed) != 0)
+			{
+				// Look for a recently released segment of the same size
+				SegmentCache& cache = sSegmentCache;
+				uint32 bin = getSegmentCacheBin(size);
+				if (bin < kNumSegmentCacheBins)
+				{
+					std::lock_guard<std::mutex> guard(cache.mutex);
+					for (uint32 i = cache.count[bin]; i > 0; --i)
+					{
+						// Prefer the most recently released segment
+						if (cache.bins[bin][i - 1].size == size)
+						{
+							void* cached_ptr = cache.bins[bin][i - 1].ptr;
+							removeCachedSegment(bin, i - 1);
+							return cached_ptr;
+						}
+					}
+				}
+				// Missed the cache. Drop the segments nobody asked for in a while, the free
+				// path leaves that to the scavenger.
+				decaySegmentCache();
+			}
 #if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
 			LPVOID basePtr = VirtualAlloc(
 				ptr,
@@ -16,22 +130,97 @@ namespace Odin
 				return 0;
 			else
 				return basePtr;
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+			// Only reserve address space. No swap or overcommit charge is taken until the
+			// pages are committed with mprotect
+			void* basePtr = mmap(
+				ptr,
+				size,
+				PROT_NONE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+				-1,
+				0);
+			if (basePtr == MAP_FAILED)
+				return 0;
+			// mmap treats the address as a hint. Like VirtualAlloc, fail if the requested
+			// address range could not be reserved
+			if (ptr != NULL && basePtr != ptr)
+			{
+				munmap(basePtr, size);
+				return 0;
+			}
+			return basePtr;
 #endif
 		}
 		//----------------------------------------------------------------------------------------------------------------------
 		// Release a segment
 		void releaseSegment(void* ptr, size_t size)
 		{
+			SegmentCache& cache = sSegmentCache;
+			uint32 bin = getSegmentCacheBin(size);
+			if (bin < kNumSegmentCacheBins && size <= cache.capacity)
+			{
+				// Claim room in the cache first, a segment that will be unmapped anyway is not
+				// worth decommitting
+				bool claimed = false;
+				{
+					std::lock_guard<std::mutex> guard(cache.mutex);
+					if (cache.cached_bytes.load(std::memory_order_relaxed) + size <= cache.capacity)
+					{
+						cache.cached_bytes.fetch_add(size, std::memory_order_relaxed);
+						claimed = true;
+					}
+				}
+				if (claimed)
+				{
+					// Give back the pages outside the lock, the segment may have been fully
+					// committed. The budget charge for them was already released by the owner.
+#if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
+					decommitPage(ptr, size);
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+					// Not MADV_FREE, which would leave the pages resident until there is memory pressure
+					madvise(ptr, size, MADV_DONTNEED);
+					mprotect(ptr, size, PROT_NONE);
+#endif
+					uint64 now = getTimeMs();
+					CachedSegment evicted = { nullptr, 0, 0 };
+					{
+						std::lock_guard<std::mutex> guard(cache.mutex);
+						if (cache.count[bin] == kSegmentCacheBinEntries)
+						{
+							// Bin is full, evict the oldest segment
+							evicted = cache.bins[bin][0];
+							removeCachedSegment(bin, 0);
+						}
+						// The bytes of the entry were added to cached_bytes when it was claimed
+						CachedSegment& entry = cache.bins[bin][cache.count[bin]++];
+						entry.ptr = ptr;
+						entry.size = size;
+						entry.release_time = now;
+					}
+					if (evicted.ptr != nullptr)
+						releaseSegmentToSystem(evicted.ptr, evicted.size);
+					return;
+				}
+			}
+			releaseSegmentToSystem(ptr, size);
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		// Hand the segment back to the system
+		static void releaseSegmentToSystem(void* ptr, size_t size)
+		{
 #if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
 			BOOL success = VirtualFree(
 				ptr,
 				0,
 				MEM_RELEASE);
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+			munmap(ptr, size);
 #endif
 		}
 		//----------------------------------------------------------------------------------------------------------------------
 		// Commit a page
-		void commitPage(void* ptr, size_t size)
+		bool commitPage(void* ptr, size_t size)
 		{
 #if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
 			LPVOID result_ptr = VirtualAlloc(
@@ -39,6 +228,10 @@ namespace Odin
 				size,
 				MEM_COMMIT,
 				PAGE_READWRITE);
+			return (result_ptr != NULL);
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+			// The pages are faulted in by the kernel on first touch
+			return (mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0);
 #endif
 		}
 		//----------------------------------------------------------------------------------------------------------------------
@@ -50,6 +243,32 @@ namespace Odin
 				reinterpret_cast<LPVOID>(ptr),
 				size,
 				MEM_DECOMMIT);
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+			purgePage(ptr, size);
+			// Revoke access so that the range behaves like a decommitted range on Windows
+			mprotect(ptr, size, PROT_NONE);
+#endif
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		// Return the physical memory of a page to the system, keeping it accessible
+		void purgePage(void* ptr, size_t size)
+		{
+#if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
+			decommitPage(ptr, size);
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+#if defined(MADV_FREE)
+			if (sDecommitMode.load(std::memory_order_relaxed) == DECOMMIT_MODE_FREE)
+			{
+				if (madvise(ptr, size, MADV_FREE) != 0 && errno == EINVAL)
+				{
+					// Kernel older than 4.5, use MADV_DONTNEED from now on
+					sDecommitMode.store(DECOMMIT_MODE_DONTNEED, std::memory_order_relaxed);
+					madvise(ptr, size, MADV_DONTNEED);
+				}
+			}
+			else
+#endif
+				madvise(ptr, size, MADV_DONTNEED);
 #endif
 		}
 		//----------------------------------------------------------------------------------------------------------------------
@@ -68,7 +287,361 @@ namespace Odin
 				return 0;
 			else
 				return basePtr;
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+			void* basePtr = mmap(
+				NULL,
+				size,
+				PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS,
+				-1,
+				0);
+			if (basePtr == MAP_FAILED)
+				return 0;
+			else
+				return basePtr;
+#endif
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		// Resize a committed segment
+		void* resizeSegment(void* ptr, size_t old_size, size_t new_size, bool may_move)
+		{
+#if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
+			// Windows can't grow a reservation in place or move it without copying
+			return 0;
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+			// The kernel moves the page table entries, no data is copied
+			void* basePtr = mremap(ptr, old_size, new_size, may_move ? MREMAP_MAYMOVE : 0);
+			if (basePtr == MAP_FAILED)
+				return 0;
+			else
+				return basePtr;
+#endif
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		// Select how decommitPage returns pages to the system
+		void setDecommitMode(DecommitMode mode)
+		{
+#if ODIN_PLATFORM == ODIN_PLATFORM_LINUX && defined(MADV_FREE)
+			sDecommitMode.store(mode, std::memory_order_relaxed);
+#else
+			sDecommitMode.store(DECOMMIT_MODE_DONTNEED, std::memory_order_relaxed);
+#endif
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		DecommitMode getDecommitMode()
+		{
+			return static_cast<DecommitMode>(sDecommitMode.load(std::memory_order_relaxed));
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		// Return the page size of the system
+		size_t getSystemPageSize()
+		{
+#if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
+			SYSTEM_INFO system_info;
+			GetSystemInfo(&system_info);
+			return static_cast<size_t>(system_info.dwPageSize);
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+			return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		// Reserve an aligned segment
+		void* reserveAlignedSegment(size_t size, size_t alignment)
+		{
+#if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
+			SYSTEM_INFO system_info;
+			GetSystemInfo(&system_info);
+			if (alignment <= system_info.dwAllocationGranularity)
+				return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+			// Windows can't release part of a reservation, so find an aligned range and reserve
+			// it again. Another thread may grab the range in between, so retry a few times.
+			for (uint32 attempt = 0; attempt < 8; ++attempt)
+			{
+				uint8* rawPtr = static_cast<uint8*>(VirtualAlloc(NULL, size + alignment, MEM_RESERVE, PAGE_NOACCESS));
+				if (rawPtr == NULL)
+					return 0;
+				VirtualFree(rawPtr, 0, MEM_RELEASE);
+				void* alignedPtr = reinterpret_cast<void*>((reinterpret_cast<size_t>(rawPtr) + (alignment - 1)) &
+					~(alignment - 1));
+				void* basePtr = VirtualAlloc(alignedPtr, size, MEM_RESERVE, PAGE_NOACCESS);
+				if (basePtr != NULL)
+					return basePtr;
+			}
+			return 0;
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+			// Over reserve by the alignment and trim both ends to get an aligned range
+			void* rawAddr = mmap(
+				NULL,
+				size + alignment,
+				PROT_NONE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+				-1,
+				0);
+			if (rawAddr == MAP_FAILED)
+				return 0;
+			uint8* rawPtr = static_cast<uint8*>(rawAddr);
+			uint8* basePtr = reinterpret_cast<uint8*>((reinterpret_cast<size_t>(rawPtr) + (alignment - 1)) &
+				~(alignment - 1));
+			size_t lead_size = basePtr - rawPtr;
+			if (lead_size != 0)
+				munmap(rawPtr, lead_size);
+			if (alignment - lead_size != 0)
+				munmap(basePtr + size, alignment - lead_size);
+			return basePtr;
 #endif
 		}
+		//----------------------------------------------------------------------------------------------------------------------
+		// Release an aligned segment. Cached segments are reused without regard to alignment, so
+		// aligned segments never go through the cache.
+		void releaseAlignedSegment(void* ptr, size_t size)
+		{
+			releaseSegmentToSystem(ptr, size);
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		// Return the number of processors of the system
+		uint32 getProcessorCount()
+		{
+#if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
+			SYSTEM_INFO system_info;
+			GetSystemInfo(&system_info);
+			return static_cast<uint32>(system_info.dwNumberOfProcessors);
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+			long count = sysconf(_SC_NPROCESSORS_CONF);
+			return (count > 0) ? static_cast<uint32>(count) : 1;
+#endif
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		// Return the processor the calling thread is running on
+		uint32 getCurrentProcessor()
+		{
+#if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
+			return static_cast<uint32>(GetCurrentProcessorNumber());
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+			// Served from the vDSO, so this doesn't enter the kernel
+			int cpu = sched_getcpu();
+			return (cpu >= 0) ? static_cast<uint32>(cpu) : 0;
+#endif
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		// Reserve a huge page aligned segment
+		void* reserveHugeSegment(size_t size, bool& huge_backed, void* ptr)
+		{
+			huge_backed = false;
+			size = (size + (kHugePageSize - 1)) & ~(kHugePageSize - 1);
+#if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
+			// Large pages can't be reserved without committing them on Windows. Use regular pages.
+			return reserveSegment(size, ptr);
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+			uint8* basePtr = nullptr;
+			if (ptr != NULL)
+			{
+				basePtr = static_cast<uint8*>(reserveSegment(size, ptr));
+				if (basePtr == nullptr)
+					return 0;
+			}
+			else
+			{
+				// Over reserve by a huge page and trim both ends to get an aligned range
+				uint8* rawPtr = static_cast<uint8*>(reserveSegment(size + kHugePageSize, NULL));
+				if (rawPtr == nullptr)
+					return 0;
+				basePtr = reinterpret_cast<uint8*>((reinterpret_cast<size_t>(rawPtr) + (kHugePageSize - 1)) &
+					~(kHugePageSize - 1));
+				size_t lead_size = basePtr - rawPtr;
+				if (lead_size != 0)
+					munmap(rawPtr, lead_size);
+				if (kHugePageSize - lead_size != 0)
+					munmap(basePtr + size, kHugePageSize - lead_size);
+			}
+#if defined(MADV_HUGEPAGE)
+			// Transparent huge pages are handed out on fault once the range is committed, if the
+			// kernel has any. Whether it did shows in getTransparentHugePageBytes only.
+			madvise(basePtr, size, MADV_HUGEPAGE);
+#endif
+			return basePtr;
+#endif
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		// Reserve and commit a huge page backed segment
+		void* reserveCommitHugeSegment(size_t size, bool& huge_backed)
+		{
+			huge_backed = false;
+#if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
+			// Needs SeLockMemoryPrivilege, GetLargePageMinimum returns 0 if large pages are unsupported
+			size_t large_page_size = GetLargePageMinimum();
+			if (large_page_size != 0)
+			{
+				size_t large_size = (size + (large_page_size - 1)) & ~(large_page_size - 1);
+				LPVOID basePtr = VirtualAlloc(
+					NULL,
+					large_size,
+					MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES,
+					PAGE_READWRITE);
+				if (basePtr != NULL)
+				{
+					huge_backed = true;
+					sHugePageBytes.fetch_add(large_size, std::memory_order_relaxed);
+					return basePtr;
+				}
+			}
+			return reserveCommitSegment(size);
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+			size = (size + (kHugePageSize - 1)) & ~(kHugePageSize - 1);
+#if defined(MAP_HUGETLB)
+			// Try the preallocated hugetlbfs pool first
+			void* basePtr = mmap(
+				NULL,
+				size,
+				PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+				-1,
+				0);
+			if (basePtr != MAP_FAILED)
+			{
+				huge_backed = true;
+				sHugePageBytes.fetch_add(size, std::memory_order_relaxed);
+				return basePtr;
+			}
+#endif
+			// Fall back to transparent huge pages
+			void* alignedPtr = reserveHugeSegment(size, huge_backed);
+			if (alignedPtr == nullptr)
+				return 0;
+			if (!commitPage(alignedPtr, size))
+			{
+				releaseHugeSegment(alignedPtr, size, huge_backed);
+				huge_backed = false;
+				return 0;
+			}
+			return alignedPtr;
+#endif
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		// Release a huge page segment
+		void releaseHugeSegment(void* ptr, size_t size, bool huge_backed)
+		{
+			// Take back the size the segment was reserved with
+#if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
+			if (huge_backed)
+			{
+				size_t large_page_size = GetLargePageMinimum();
+				size = (size + (large_page_size - 1)) & ~(large_page_size - 1);
+			}
+#elif ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+			size = (size + (kHugePageSize - 1)) & ~(kHugePageSize - 1);
+#endif
+			if (huge_backed)
+				sHugePageBytes.fetch_sub(size, std::memory_order_relaxed);
+			// Huge page segments bypass the segment cache
+			releaseSegmentToSystem(ptr, size);
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		// Return the number of bytes mapped on huge pages
+		size_t getHugePageBytes()
+		{
+			return sHugePageBytes.load(std::memory_order_relaxed);
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		// Return the number of bytes of the process backed by transparent huge pages
+		size_t getTransparentHugePageBytes()
+		{
+#if ODIN_PLATFORM == ODIN_PLATFORM_LINUX
+			// Read without stdio, which would allocate from the allocator being measured
+			int fd = open("/proc/self/smaps_rollup", O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				return 0;
+			char text[4096];
+			size_t length = 0;
+			while (length + 1 < sizeof(text))
+			{
+				ssize_t count = read(fd, text + length, sizeof(text) - 1 - length);
+				if (count < 0 && errno == EINTR)
+					continue;
+				if (count <= 0)
+					break;
+				length += static_cast<size_t>(count);
+			}
+			close(fd);
+			text[length] = '\0';
+			const char* field = strstr(text, "AnonHugePages:");
+			if (field == nullptr)
+				return 0;
+			return static_cast<size_t>(strtoull(field + 14, nullptr, 10)) << 10;
+#else
+			return 0;
+#endif
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		// Configure the segment cache
+		void configureSegmentCache(size_t capacity, uint32 decay_ms)
+		{
+			{
+				std::lock_guard<std::mutex> guard(sSegmentCache.mutex);
+				sSegmentCache.capacity = capacity;
+				sSegmentCache.decay_ms = decay_ms;
+			}
+			// Trim the cache down to the new capacity
+			if (sSegmentCache.cached_bytes.load(std::memory_order_relaxed) > capacity)
+				purgeSegmentCache();
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		// Release the cached segments which passed the decay time
+		static size_t releaseCachedSegments(bool expired_only)
+		{
+			SegmentCache& cache = sSegmentCache;
+			size_t released = 0;
+			CachedSegment to_release[kSegmentCacheBinEntries];
+			for (uint32 bin = 0; bin < kNumSegmentCacheBins; ++bin)
+			{
+				uint32 num_to_release = 0;
+				{
+					std::lock_guard<std::mutex> guard(cache.mutex);
+					uint64 now = getTimeMs();
+					for (uint32 i = cache.count[bin]; i > 0; --i)
+					{
+						CachedSegment& entry = cache.bins[bin][i - 1];
+						if (!expired_only || now - entry.release_time >= cache.decay_ms)
+						{
+							to_release[num_to_release++] = entry;
+							removeCachedSegment(bin, i - 1);
+						}
+					}
+				}
+				// Talk to the system outside the lock
+				for (uint32 i = 0; i < num_to_release; ++i)
+				{
+					releaseSegmentToSystem(to_release[i].ptr, to_release[i].size);
+					released += to_release[i].size;
+				}
+			}
+			return released;
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		size_t decaySegmentCache()
+		{
+			if (sSegmentCache.cached_bytes.load(std::memory_order_relaxed) == 0)
+				return 0;
+			return releaseCachedSegments(true);
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		size_t purgeSegmentCache()
+		{
+			return releaseCachedSegments(false);
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		size_t getSegmentCacheSize()
+		{
+			return sSegmentCache.cached_bytes.load(std::memory_order_relaxed);
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		void lockSegmentCache()
+		{
+			sSegmentCache.mutex.lock();
+		}
+		//----------------------------------------------------------------------------------------------------------------------
+		void unlockSegmentCache()
+		{
+			sSegmentCache.mutex.unlock();
+		}
 	}
-}
\ No newline at end of file
+}
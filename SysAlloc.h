@@ -1,33 +1,131 @@
 #ifndef _SYS_ALLOC_H_
 #define _SYS_ALLOC_H_
 
+#include "CompileOptions.h"
+#include "DataTypes.h"
+
+#if ODIN_PLATFORM == ODIN_PLATFORM_WIN32
 #include <Windows.h>
 #include <WinBase.h>
+#endif
 
 
 namespace Odin
 {
 	namespace SysAlloc
 	{
+		// Size and alignment of huge page backed segments
+		const size_t kHugePageSize = 2097152;
+
+		// How decommitted pages are handed back to the system. Only Linux makes a distinction,
+		// Windows always uses MEM_DECOMMIT.
+		enum DecommitMode
+		{
+			DECOMMIT_MODE_DONTNEED,		// Pages are dropped immediately (RSS falls at once)
+			DECOMMIT_MODE_FREE			// Pages are reclaimed lazily by the kernel under pressure
+		};
+
 		// Declare functions to reserve and release memory from the system
 		// Reserve a segment. if ptr is specified, reserve space starting from the specified address
 		// (used by alloc to extend the segment size when more memory is needed)
+		// If ptr is not specified, a recently released segment of the same size is taken from the
+		// segment cache first. Such a segment is only reserved, like a new one. A request missing
+		// the cache returns the cached segments older than the decay time to the system.
 		void* reserveSegment(size_t size, void* ptr = NULL);
 		
-		// Release a segment
+		// Release a segment. The segment is kept in the segment cache, decommitted, if there is
+		// room for it.
 		void releaseSegment(void* ptr, size_t size);
 		
-		// Commit a page
-		void commitPage(void* ptr, size_t size);
+		// Commit a page. Returns false if the system could not back the pages
+		bool commitPage(void* ptr, size_t size);
 		
 		// Decommit a page
 		void decommitPage(void* ptr, size_t size);
+
+		// Return the physical memory of a committed page to the system but keep the page
+		// accessible, its contents becoming undefined. On Linux the protection is left alone so
+		// the mapping isn't split, which decommitting many scattered pages would do until the
+		// process runs out of mappings. On Windows the page is decommitted and has to be
+		// committed again before use, as with decommitPage.
+		void purgePage(void* ptr, size_t size);
 		
 		// Reserve and commit a segment
 		// This function will bypass the direct mapped cache and directly commits
 		// pages from the system.
 		void* reserveCommitSegment(size_t size);
+
+		// Select how decommitPage returns pages to the system. Falls back to
+		// DECOMMIT_MODE_DONTNEED if the kernel does not support lazy freeing.
+		void setDecommitMode(DecommitMode mode);
+		DecommitMode getDecommitMode();
+
+		// Return the page size of the system
+		size_t getSystemPageSize();
+
+		// Reserve a segment whose address is a multiple of alignment (a power of two). The segment
+		// bypasses the segment cache, it has to be released with releaseAlignedSegment.
+		void* reserveAlignedSegment(size_t size, size_t alignment);
+
+		// Return a segment obtained from reserveAlignedSegment to the system right away
+		void releaseAlignedSegment(void* ptr, size_t size);
+
+		// Return the number of processors of the system
+		uint32 getProcessorCount();
+
+		// Return the processor the calling thread is running on. The thread may be migrated
+		// right after the call, so the result is only a hint.
+		uint32 getCurrentProcessor();
+
+		// Resize a segment obtained from reserveCommitSegment, moving it if required and may_move
+		// is set. Pages added to the segment are committed. Returns the new address of the segment,
+		// or NULL if the system can't resize it (the segment is left untouched in that case).
+		void* resizeSegment(void* ptr, size_t old_size, size_t new_size, bool may_move = true);
+
+		// Configure the cache of released segments. capacity is the maximum number of bytes
+		// held by the cache (0 disables it) and decay_ms is the time after which a cached
+		// segment which was not reused is returned to the system, by the next decaySegmentCache
+		// call or the next reservation missing the cache.
+		void configureSegmentCache(size_t capacity, uint32 decay_ms);
+
+		// Return the cached segments older than the decay time to the system.
+		// Returns the number of bytes released.
+		size_t decaySegmentCache();
+
+		// Return all the cached segments to the system. Returns the number of bytes released.
+		size_t purgeSegmentCache();
+
+		// Return the number of bytes currently held by the segment cache
+		size_t getSegmentCacheSize();
+
+		// Hold the lock of the segment cache across a fork(), so that the child doesn't inherit
+		// it locked by another thread
+		void lockSegmentCache();
+		void unlockSegmentCache();
+
+		// Reserve a segment aligned to kHugePageSize and ask the system to back it with huge pages
+		// once its pages are committed. Commits should be done at kHugePageSize granularity.
+		// These are transparent huge pages on Linux, which the kernel may or may not hand out,
+		// so huge_backed is always set to false. If ptr is specified, reserve space starting
+		// from the specified address.
+		void* reserveHugeSegment(size_t size, bool& huge_backed, void* ptr = NULL);
+
+		// Reserve and commit a segment backed by huge pages, falling back to regular pages
+		// if none are available. size is rounded up to kHugePageSize. huge_backed is set to true
+		// if the segment is mapped on huge pages (MAP_HUGETLB or MEM_LARGE_PAGES).
+		void* reserveCommitHugeSegment(size_t size, bool& huge_backed);
+
+		// Release a segment obtained from reserveHugeSegment or reserveCommitHugeSegment
+		void releaseHugeSegment(void* ptr, size_t size, bool huge_backed);
+
+		// Return the number of bytes currently living in segments mapped on huge pages, the
+		// ones reserveCommitHugeSegment reported as huge_backed
+		size_t getHugePageBytes();
+
+		// Return the number of bytes of the whole process the kernel backs with transparent huge
+		// pages (AnonHugePages of /proc/self/smaps_rollup). 0 on Windows or if it can't be read.
+		size_t getTransparentHugePageBytes();
 	}
 }
 
-#endif	//_SYS_ALLOC_H_
\ No newline at end of file
+#endif	//_SYS_ALLOC_H_
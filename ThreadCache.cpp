@@ -0,0 +1,117 @@
+#include "ThreadCache.h"
+#include "GeneralAllocator.h"
+#include "SysAlloc.h"
+#include <mutex>
+
+namespace Odin
+{
+	// Guards the links between caches and allocators, so that a thread exiting while its
+	// allocator is destroyed never touches a dead allocator
+	static std::mutex sRegistryLock;
+
+	// Size of a cache rounded up to the system page size
+	static size_t getCacheBytes()
+	{
+		size_t page_size = SysAlloc::getSystemPageSize();
+		return (sizeof(ThreadCache) + (page_size - 1)) & ~(page_size - 1);
+	}
+
+	// Unlink a cache from the list of its allocator. Registry lock should be held by the caller.
+	static void unlinkFromAllocator(ThreadCache* cache)
+	{
+		if (cache->prev_in_allocator)
+			cache->prev_in_allocator->next_in_allocator = cache->next_in_allocator;
+		else
+			*cache->allocator_list = cache->next_in_allocator;
+		if (cache->next_in_allocator)
+			cache->next_in_allocator->prev_in_allocator = cache->prev_in_allocator;
+		cache->allocator = nullptr;
+		cache->allocator_list = nullptr;
+		cache->prev_in_allocator = cache->next_in_allocator = nullptr;
+	}
+
+	// Owns the caches of a thread and hands their blocks back when the thread exits
+	struct ThreadCacheList
+	{
+		ThreadCache* head;
+		// Set once the thread is exiting. Thread local destructors running after this one may
+		// still allocate and free, they bypass the caches since nothing would drain them.
+		bool destroyed;
+
+		ThreadCacheList() : head(nullptr), destroyed(false) {}
+		~ThreadCacheList()
+		{
+			destroyed = true;
+			std::lock_guard<std::mutex> guard(sRegistryLock);
+			ThreadCache* cache = head;
+			while (cache)
+			{
+				ThreadCache* next = cache->next_in_thread;
+				if (cache->allocator)
+				{
+					cache->allocator->drainThreadCache(cache);
+					unlinkFromAllocator(cache);
+				}
+				SysAlloc::releaseSegment(cache, getCacheBytes());
+				cache = next;
+			}
+			head = nullptr;
+		}
+	};
+
+	static thread_local ThreadCacheList tCaches;
+
+	namespace ThreadCaches
+	{
+		//-----------------------------------------------------------------------------------------
+		ThreadCache* find(const GeneralAllocator* allocator)
+		{
+			// A thread rarely uses more than one allocator, so the list is short
+			for (ThreadCache* cache = tCaches.head; cache; cache = cache->next_in_thread)
+			{
+				if (cache->allocator == allocator)
+					return cache;
+			}
+			return nullptr;
+		}
+		//-----------------------------------------------------------------------------------------
+		ThreadCache* create(GeneralAllocator* allocator, ThreadCache** list)
+		{
+			if (tCaches.destroyed)
+				return nullptr;
+			// Memory from the system is zero filled, so all the magazines start out empty
+			ThreadCache* cache = static_cast<ThreadCache*>(SysAlloc::reserveCommitSegment(getCacheBytes()));
+			if (cache == nullptr)
+				return nullptr;
+			cache->allocator = allocator;
+			cache->next_in_thread = tCaches.head;
+			tCaches.head = cache;
+
+			std::lock_guard<std::mutex> guard(sRegistryLock);
+			cache->allocator_list = list;
+			cache->prev_in_allocator = nullptr;
+			cache->next_in_allocator = *list;
+			if (*list)
+				(*list)->prev_in_allocator = cache;
+			*list = cache;
+			return cache;
+		}
+		//-----------------------------------------------------------------------------------------
+		void detach(ThreadCache** list)
+		{
+			std::lock_guard<std::mutex> guard(sRegistryLock);
+			while (*list)
+				unlinkFromAllocator(*list);
+		}
+		//-----------------------------------------------------------------------------------------
+		void lockRegistry()
+		{
+			sRegistryLock.lock();
+		}
+		//-----------------------------------------------------------------------------------------
+		void unlockRegistry()
+		{
+			sRegistryLock.unlock();
+		}
+	}
+}
@@ -0,0 +1,65 @@
+#ifndef _THREAD_CACHE_H_
+#define _THREAD_CACHE_H_
+
+#include "DataTypes.h"
+#include "SizeClass.h"
+
+namespace Odin
+{
+	// Forward declaration
+	class GeneralAllocator;
+
+	// Number of size classes served from thread caches (all the small size classes)
+	const uint32 kNumCachedClasses = kMaxSizeClasses;
+	// Upper bound of the number of blocks a magazine can hold
+	const uint32 kMaxMagazineCapacity = 256;
+	// Default number of blocks a magazine holds and moves to or from its MemorySpace at once
+	const uint32 kDefaultCacheCapacity = 64;
+	const uint32 kDefaultCacheBatch = 32;
+
+	// Stack of free blocks of one size class
+	struct Magazine
+	{
+		uint32 count;
+		void* blocks[kMaxMagazineCapacity];
+	};
+
+	/*
+		Magazines of one thread for one GeneralAllocator. Blocks sitting in a magazine are still
+		allocated as far as the backing MemorySpace is concerned, so popping and pushing them
+		needs no lock. Caches live in memory obtained directly from the system so that creating
+		one never recurses into an allocator.
+	*/
+	struct ThreadCache
+	{
+		GeneralAllocator* allocator;			// Owning allocator, NULL once it is destroyed
+		ThreadCache* next_in_thread;			// Caches of the same thread for other allocators
+		ThreadCache** allocator_list;			// Head of the list of caches of the allocator
+		ThreadCache* prev_in_allocator;			// Caches of other threads for the same allocator
+		ThreadCache* next_in_allocator;
+		int64 bytes_until_sample;				// Bytes left until the next heap profile sample of the thread
+		Magazine magazines[kNumCachedClasses];
+	};
+
+	namespace ThreadCaches
+	{
+		// Return the cache of the calling thread for allocator or NULL if it has none
+		ThreadCache* find(const GeneralAllocator* allocator);
+
+		// Create the cache of the calling thread for allocator and link it into list, the list
+		// of caches of that allocator. Returns NULL if the system is out of memory or the thread
+		// is exiting.
+		ThreadCache* create(GeneralAllocator* allocator, ThreadCache** list);
+
+		// Unlink all the caches in list from their allocator, called when the allocator is
+		// destroyed. Blocks left in the caches go away with the allocator's segments.
+		void detach(ThreadCache** list);
+
+		// Hold the registry lock across a fork(), so that the child doesn't inherit it locked
+		// by an exiting thread
+		void lockRegistry();
+		void unlockRegistry();
+	}
+}
+
+#endif	// _THREAD_CACHE_H_